@@ -16,12 +16,29 @@
 
 // Include our library.
 #include <vOP.h>
-// Plus the Wire library.
+// Plus the Wire library. (Which it talks i2c through, unless it's built with VOP_TWI.)
 #include <Wire.h>
 
 
 vOP vop;
 
+// --------------------------------------------------------- 
+// -- Your own i2c commands.                              --
+// Opcodes CMD_USER_FIRST (128) and up are yours. Write a  --
+// handler, and list it here, in opcode order.            --
+// See vOPCommands.h for the details.                     --
+// --------------------------------------------------------- 
+
+/*
+unsigned int getAnswer(vOP &vop, unsigned int param, byte *error) {
+	return 42;
+}
+
+VOP_USER_COMMANDS(
+	VOP_COMMAND(CMD_USER_FIRST, PARAM_NONE, RESPONSE_INT, getAnswer)
+);
+*/
+
 void loop() {
 
 	// Call this as frequently as you can.
@@ -41,6 +58,27 @@ void setup() {
 	// --------------------------------------------------------- 
 
 
+	// Powering more than one computer? Build with VOP_CHANNELS (in vOPConfig.h) set to how many,
+	// and give each channel past the first its relay and ignition pins, before vop.setup().
+	// The ignitions need to be on the same port as the first (pins 0-7 on an Uno).
+	// vop.setChannelPins(1, 5, 4);
+	// And if they'd pull too much turning on together, space them out (millis.)
+	// vop.setPowerOnStagger(2000);
+
+	// Got the Pi's gpio-poweroff pin wired up? Then we can cut the power as soon as it's halted,
+	// instead of waiting out the shutdown. (Channel, pin, the level it shows, and for how long, in millis.)
+	// vop.setHaltPin(0, 6, HIGH, 100);
+
+	// Parked with the Pi on? Build with VOP_SUPPLY (in vOPConfig.h), put the supply on an analog pin through
+	// a divider, and the Pis are shut down before the battery's flat. (The pin, and the millivolts that'd read
+	// as full scale: 20000 for a 30k/10k divider on a 5V board.) It has the ADC to itself after that.
+	// vop.setSupplyPin(A0, 20000);
+
+	// Want to see what it's doing? The log goes out of the serial port as binary, so read it with
+	// extras/host/vop_log, not the serial monitor. (Or leave it be, and the Pi can read it over i2c.)
+	// vop.setLogSerial(115200);
+
+
 	// --------------------------------------------------------- 
 	// -- Setup routine.                                      --
 	// Some methods don't like to be run up on object         --
@@ -49,35 +87,27 @@ void setup() {
 
 	vop.setup();
 
-	// --------------------------------------------------------- 
-	// -- Wire setup.                                         --
-	// Go ahead and begin on the address of your choosing.    --
-	// And then call a wrapper to access the library's        --
-	// methods for working with i2c.                          --
-	// ---------------------------------------------------------
+	// Want to save the vehicle battery? Let vop.loop() nap between deadlines.
+	// It still wakes for the ignition and for i2c, but your code above runs less often.
+	// vop.setSleepMode(true);
 
-	Wire.begin(0x04);
-	Wire.onReceive(receiveWrapper);
-	Wire.onRequest(requestWrapper);
+	// Got more lines to watch, like the accessory, door or reverse lights? Debounce them with the ignition.
+	// They need to be on the ignition's port (pins 0-7 on an Uno), then ask vop.inputState(pin).
+	// vop.watchInput(4, 3);
 
+	// Would the Pi rather wait on a GPIO than poll? Wire this pin to one of its GPIOs (with a pull-up on the Pi),
+	// and it's pulled low whenever there are events waiting in the feed. (Open drain, it's never driven high.)
+	// vop.setAttentionPin(5);
 
+	// --------------------------------------------------------- 
+	// -- i2c setup.                                          --
+	// Go ahead and begin on the address of your choosing.    --
+	// The library hooks itself up to Wire (or to its own     --
+	// TWI driver, with VOP_TWI), no wrappers needed.         --
+	// ---------------------------------------------------------
 
-}
-
-// --------------------------------------------------------- 
-// -- The Wrappers!                                       --
-// Rick The Ruler & Doug E. Fresh                         --
-// Wire library is picky about calling a plain function   --
-// as a callback. So, this was expedient to create this   --
-// way. In the future I may try to pack this directly     --
-// into the library.                                      --
-// --------------------------------------------------------- 
+	vop.beginI2c(0x04);
 
 
-void receiveWrapper(int numbytes) {
-	vop.receiveData(numbytes);
-}
 
-void requestWrapper() {
-	vop.fillRequest();
 }
\ No newline at end of file
@@ -0,0 +1,38 @@
+#ifndef Arduino_h
+#define Arduino_h
+
+// --------------------------------------------------------------------------
+// -- Just enough of the Arduino core to compile vOP on the host.
+// Everything that talks to hardware goes through vOPHal.h, which vOPMock.cpp implements.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+// The analog pins, numbered as they are on an Uno.
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+
+// No separate flash on the host. (The size report can build this with avr-g++, which has.)
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#else
+#define PROGMEM
+#define memcpy_P memcpy
+#endif
+
+#endif
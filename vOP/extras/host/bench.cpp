@@ -0,0 +1,365 @@
+// --------------------------------------------------------------------------
+// -- bench: Micro-benchmarks for the vOP hot path, on the host.
+// Runs vOP.cpp against the mock HAL and reports the cost of each piece in ns and cycles.
+// The virtual clock ticks forward every iteration so the timers actually fire,
+// so the numbers include the cost of doing real work, not just the early-outs.
+//
+// Usage: ./vop_bench [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vOP.h"
+#include "vOPDebounce.h"
+#include "vOPLog.h"
+#include "vOPMock.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_CYCLES() __rdtsc()
+#else
+#define BENCH_CYCLES() 0ULL
+#endif
+
+#define BENCH_PIN_IGNITION 2
+#define BENCH_CMD_GET_IGNITION_STATE 11
+#define BENCH_TICK_MICROS 100
+#define BENCH_DEBOUNCE_INPUTS 4
+#define BENCH_DEBOUNCE_DEPTH 4
+#define BENCH_SAMPLES 1024
+#define BENCH_CMD_READ_REGISTERS 27
+
+static vOP vop;
+static vOP vop_deferred;
+static vOP vop_registers;
+static byte bench_reply[4];		// What the last exchange got back: error, command, and its result.
+
+// -- The things we time. Each is one iteration.
+
+static void benchLoop() {
+	mock_advanceMicros(BENCH_TICK_MICROS);
+	vop.loop();
+}
+
+static void benchRequestPair() {
+	// The command and its parameters, then the end-of-command on its own.
+	static const byte frame[] = {BENCH_CMD_GET_IGNITION_STATE, 0, 0};
+	static const byte end_of_command[] = {10};
+	mock_i2cWrite(vop, frame, sizeof(frame));
+	mock_i2cWrite(vop, end_of_command, sizeof(end_of_command));
+	mock_i2cRead(vop, bench_reply, sizeof(bench_reply));
+}
+
+// The same exchange in deferred mode: the interrupt side queues, loop() runs it, the read copies it out.
+static void benchDeferredPair() {
+	static const byte frame[] = {BENCH_CMD_GET_IGNITION_STATE, 0, 0};
+	static const byte end_of_command[] = {10};
+	mock_i2cWrite(vop_deferred, frame, sizeof(frame));
+	mock_i2cWrite(vop_deferred, end_of_command, sizeof(end_of_command));
+	vop_deferred.runQueuedCommands();
+	mock_i2cRead(vop_deferred, bench_reply, sizeof(bench_reply));
+}
+
+// -- Wire against our own TWI driver (VOP_TWI.) The mock hands the TWI side one byte at a time,
+// the way its interrupt would, and lets it send in place, so what's left is just the difference
+// in our code: Wire's buffer and copies, against parsing and sending as the bytes go.
+// The bus itself isn't in it, at 100kHz a byte takes 90us whichever way.
+
+static void benchRequestPairTwi() {
+	static const byte frame[] = {BENCH_CMD_GET_IGNITION_STATE, 0, 0};
+	static const byte end_of_command[] = {10};
+	mock_twiWrite(vop, frame, sizeof(frame));
+	mock_twiWrite(vop, end_of_command, sizeof(end_of_command));
+	mock_twiRead(vop, bench_reply, sizeof(bench_reply));
+}
+
+// The whole status block, in register mode (set up in main.)
+static void benchRegisterRead() {
+	byte block[STATUS_BLOCK_SIZE];
+	mock_i2cRead(vop_registers, block, sizeof(block));
+}
+
+static void benchRegisterReadTwi() {
+	byte block[STATUS_BLOCK_SIZE];
+	mock_twiRead(vop_registers, block, sizeof(block));
+}
+
+static void benchDebounceIgnition() {
+	mock_advanceMicros(BENCH_TICK_MICROS);
+	vop.debounceIgnition();
+}
+
+static void benchWatchDog() {
+	mock_advanceMicros(BENCH_TICK_MICROS);
+	vop.watchDog();
+}
+
+static void benchShutdownRequestHandler() {
+	mock_advanceMicros(BENCH_TICK_MICROS);
+	vop.shutdownRequestHandler();
+}
+
+static void benchBootUpHandler() {
+	mock_advanceMicros(BENCH_TICK_MICROS);
+	vop.bootUpHandler();
+}
+
+// -- Command dispatch: run a mix of the read-only commands straight through runCommand().
+
+static const byte bench_opcodes[] = {11, 12, 14, 17, 20, 23, 25, 102, 103, 104, 200};
+static byte bench_opcode_index = 0;
+static volatile byte bench_sink = 0;
+
+static void benchDispatch() {
+	byte params[2] = {1, 2};
+	byte result[2];
+	vop.runCommand(bench_opcodes[bench_opcode_index], params, result);
+	if (++bench_opcode_index == sizeof(bench_opcodes)) {
+		bench_opcode_index = 0;
+	}
+}
+
+// The switch runCommand() used to be, cut down to the same mix. Each case does what the old one did,
+// the fields it read are stand-ins here (they're private to vOP), so what's left is the difference
+// in getting there: a switch, against the table's copy out of flash and an indirect call.
+
+struct benchSwitchState {
+	byte ignition_state;
+	bool watchdog_mode;
+	bool shutdown_request_mode;
+	byte inputs;
+	bool debug_ign_debounce;
+	byte test;
+	byte watchdog_state;
+};
+static benchSwitchState bench_switch_state;
+
+static byte __attribute__((noinline)) benchSwitchCommand(byte cmd, byte *params, byte *return_buffer) {
+
+	bool use_int = true;
+	unsigned int result_data = 0;
+	byte error = 0;
+
+	switch (cmd) {
+		case 11:	// CMD_GET_IGNITION_STATE
+			result_data = bench_switch_state.ignition_state;
+			break;
+		case 12:	// CMD_GET_LAST_IGNITION_CHANGE_SECONDS
+			result_data = vop.ignitionChangedLast(true);
+			break;
+		case 14:	// CMD_ECHO
+			use_int = false;
+			return_buffer[0] = params[0];
+			return_buffer[1] = params[1];
+			break;
+		case 17:	// CMD_GET_WATCHDOG
+			result_data = bench_switch_state.watchdog_mode;
+			break;
+		case 20:	// CMD_GET_SHUTDOWN_STATE
+			result_data = bench_switch_state.shutdown_request_mode;
+			break;
+		case 23:	// CMD_GET_SLEEP_MINUTES
+			result_data = vop.sleepMillis() / 60000UL;
+			break;
+		case 25:	// CMD_GET_INPUTS
+			result_data = bench_switch_state.inputs;
+			break;
+		case 102:	// CMD_DEBUG_GET_IGN_DETECT
+			result_data = bench_switch_state.debug_ign_debounce;
+			break;
+		case 103:	// CMD_DEBUG_GET_TEST_VALUE
+			result_data = bench_switch_state.test;
+			break;
+		case 104:	// CMD_DEBUG_GET_WDT_STATE
+			result_data = bench_switch_state.watchdog_state;
+			break;
+		default:
+			error = 2;	// ERR_COMMAND_UNKNOWN
+			break;
+	}
+
+	if (use_int) {
+		return_buffer[0] = (result_data >> 8) & 0xFF;
+		return_buffer[1] = result_data & 0xFF;
+	}
+	return error;
+
+}
+
+static void benchDispatchSwitch() {
+	byte params[2] = {1, 2};
+	byte result[2];
+	bench_sink ^= benchSwitchCommand(bench_opcodes[bench_opcode_index], params, result) ^ result[1];
+	if (++bench_opcode_index == sizeof(bench_opcodes)) {
+		bench_opcode_index = 0;
+	}
+}
+
+// -- Debouncing four inputs: the old one-pin-at-a-time loop, against the vertical counters.
+// Both eat the same stream of bouncy port reads.
+
+static byte bench_samples[BENCH_SAMPLES];
+static unsigned int bench_sample_index = 0;
+static unsigned long bench_sample_time = 0;
+
+struct benchPinDebounce {
+	byte last;
+	byte counter;
+	byte state;
+	unsigned long changed_at;
+};
+static benchPinDebounce bench_pins[BENCH_DEBOUNCE_INPUTS];
+static vOPDebouncer bench_debouncer;
+
+static void benchSamplesFill() {
+	// A port that mostly sits still, with each input bouncing now and then.
+	unsigned long seed = 1;
+	byte port = 0;
+	for (unsigned int i = 0; i < BENCH_SAMPLES; i++) {
+		seed = seed * 1103515245UL + 12345UL;
+		if (((seed >> 16) & 7) == 0) {
+			port ^= 1 << ((seed >> 20) % BENCH_DEBOUNCE_INPUTS);
+		}
+		bench_samples[i] = port;
+	}
+	bench_debouncer.watch((1 << BENCH_DEBOUNCE_INPUTS) - 1, BENCH_DEBOUNCE_DEPTH);
+}
+
+static void benchDebouncePerPin() {
+	byte port = bench_samples[bench_sample_index++ & (BENCH_SAMPLES - 1)];
+	bench_sample_time++;
+	for (byte i = 0; i < BENCH_DEBOUNCE_INPUTS; i++) {
+		benchPinDebounce &pin = bench_pins[i];
+		byte now = (port >> i) & 1;
+		if (now == pin.last) {
+			pin.counter++;
+			if (pin.counter >= BENCH_DEBOUNCE_DEPTH - 1) {
+				pin.counter = 0;
+				if (pin.state != now) {
+					pin.state = now;
+					pin.changed_at = bench_sample_time;
+				}
+			}
+		} else {
+			pin.counter = 0;
+		}
+		pin.last = now;
+	}
+	bench_sink ^= bench_pins[0].state;
+}
+
+static void benchDebounceVertical() {
+	byte port = bench_samples[bench_sample_index++ & (BENCH_SAMPLES - 1)];
+	bench_sample_time++;
+	bench_sink ^= bench_debouncer.sample(port, bench_sample_time);
+}
+
+#if VOP_LOG
+// -- The log: a record with two numbers in, and straight back out, as the serial drain would take it.
+
+static vOPLog bench_log;
+
+static void benchLog() {
+	byte out[LOG_HEADER_SIZE + 4];
+	bench_sample_time++;
+	bench_log.log(LOG_WATCHDOG_CHECK, 2, 0, bench_sample_time & 0xFF, bench_sample_time);
+	bench_sink ^= bench_log.read(out, sizeof(out), false);
+}
+#endif
+
+// -- The harness.
+
+static unsigned long long nowNanos() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static double benchRun(const char *name, unsigned long iterations, void (*fn)()) {
+
+	// Warm up, then time the lot.
+	for (unsigned long i = 0; i < iterations / 10; i++) {
+		fn();
+	}
+
+	unsigned long long start_ns = nowNanos();
+	unsigned long long start_cycles = BENCH_CYCLES();
+	for (unsigned long i = 0; i < iterations; i++) {
+		fn();
+	}
+	unsigned long long cycles = BENCH_CYCLES() - start_cycles;
+	unsigned long long ns = nowNanos() - start_ns;
+
+	printf("%-28s %10.2f ns/op %10.2f cycles/op\n", name, (double)ns / iterations, (double)cycles / iterations);
+	return (double)ns / iterations;
+
+}
+
+// -- benchReplyOk : Try an exchange once, before we time it. If it comes back with an error, we'd
+// only be timing the error path, so that's the end of the run.
+
+static void benchReplyOk(const char *name, void (*fn)()) {
+
+	memset(bench_reply, 0xFF, sizeof(bench_reply));
+	fn();
+	if (bench_reply[0] != 0 || bench_reply[1] != BENCH_CMD_GET_IGNITION_STATE) {
+		fprintf(stderr, "vop_bench: %s came back with error %u, for command %u\n", name, bench_reply[0], bench_reply[1]);
+		exit(1);
+	}
+
+}
+
+int main(int argc, char **argv) {
+
+	unsigned long iterations = 1000000;
+	if (argc > 1) {
+		iterations = strtoul(argv[1], NULL, 10);
+	}
+
+	vop.setup();
+	vop_deferred.setup();
+	vop_deferred.setDeferredMode(true);
+	mock_setPin(BENCH_PIN_IGNITION, HIGH);
+
+	// Register mode, the whole block on each read.
+	static const byte registers[] = {BENCH_CMD_READ_REGISTERS, 0, 0};
+	static const byte end_of_command[] = {10};
+	vop_registers.setup();
+	mock_i2cWrite(vop_registers, registers, sizeof(registers));
+	mock_i2cWrite(vop_registers, end_of_command, sizeof(end_of_command));
+
+	benchReplyOk("receiveData+fillRequest", benchRequestPair);
+	benchReplyOk("deferred", benchDeferredPair);
+	benchReplyOk("TWI driver", benchRequestPairTwi);
+
+	printf("vOP host benchmark, %lu iterations, clock +%dus per op\n", iterations, BENCH_TICK_MICROS);
+	benchRun("loop()", iterations, benchLoop);
+	benchRun("receiveData+fillRequest", iterations, benchRequestPair);
+	benchRun("  deferred, with the loop", iterations, benchDeferredPair);
+	double pair_ns = benchRun("  TWI driver, byte by byte", iterations, benchRequestPairTwi);
+	double wire_ns = benchRun("status block read, Wire", iterations, benchRegisterRead);
+	double twi_ns = benchRun("  TWI driver, in place", iterations, benchRegisterReadTwi);
+	// Per byte of the exchange (4 in, 4 back) is about what each TWI interrupt costs us.
+	printf("%-28s %10.2f ns/byte\n", "  TWI, per byte of the pair", pair_ns / 8);
+	printf("%-28s %10.1f MB/s, Wire %.1f MB/s\n", "  TWI, status block reads",
+		STATUS_BLOCK_SIZE * 1000.0 / twi_ns, STATUS_BLOCK_SIZE * 1000.0 / wire_ns);
+	benchRun("debounceIgnition()", iterations, benchDebounceIgnition);
+	benchRun("watchDog()", iterations, benchWatchDog);
+	benchRun("shutdownRequestHandler()", iterations, benchShutdownRequestHandler);
+	benchRun("bootUpHandler()", iterations, benchBootUpHandler);
+	double table_ns = benchRun("runCommand() dispatch", iterations, benchDispatch);
+	double switch_ns = benchRun("  the old switch, same mix", iterations, benchDispatchSwitch);
+	printf("%-28s %10.2fx\n", "  table against switch", table_ns / switch_ns);
+#if VOP_LOG
+	benchRun("log a record, and drain it", iterations, benchLog);
+#endif
+
+	benchSamplesFill();
+	benchRun("debounce 4 inputs, per pin", iterations, benchDebouncePerPin);
+	benchRun("debounce 4 inputs, vertical", iterations, benchDebounceVertical);
+
+	return 0;
+
+}
@@ -0,0 +1,29 @@
+#!/bin/sh
+# --------------------------------------------------------------------------
+# Sim check: replays every trace in traces/ through vop_sim, and diffs each timeline against
+# its golden file (the .golden next to the .trace.) How long each took is shown too, so a
+# change that slows vOP down (or makes it wake more often) stands out.
+#
+# When a change to vOP is meant to change a timeline, look over the diff, then take the new ones:
+#   make sim-update
+
+SIM=${SIM:-./vop_sim}
+UPDATE=${UPDATE:-0}
+
+failed=0
+for trace in traces/*.trace; do
+	golden="${trace%.trace}.golden"
+	if [ "$UPDATE" = 1 ]; then
+		$SIM "$trace" > "$golden" || exit 1
+		echo "updated $golden"
+		continue
+	fi
+	out=$(mktemp)
+	$SIM "$trace" > "$out" || exit 1
+	if ! diff -u "$golden" "$out"; then
+		echo "FAILED $trace"
+		failed=1
+	fi
+	rm -f "$out"
+done
+exit $failed
@@ -0,0 +1,55 @@
+// --------------------------------------------------------------------------
+// -- vop_sim: Replays days of a vehicle's life through vOP, in a blink. (The engine, and the
+// trace format, are in vOPSim.h.)
+//
+// What comes out is the timeline: every event vOP records (relay, watchdog, shutdown, ignition,
+// see EVENT_ in vOP.h), what the Pis did about them, and the replies to the scripted i2c. Then a
+// summary of each channel. It's the same every run, so keep one as a golden file and diff against
+// it (make sim-check does just that for the traces in traces/.) How long it took goes to stderr.
+//
+// Usage: ./vop_sim [-v] [trace]   (stdin if there's no trace, -v shows every pat and poll too)
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "vOPSim.h"
+
+int main(int argc, char **argv) {
+
+	int arg = 1;
+	bool verbose = false;
+	if (arg < argc && strcmp(argv[arg], "-v") == 0) {
+		verbose = true;
+		arg++;
+	}
+	const char *name = "stdin";
+	FILE *in = stdin;
+	if (arg < argc) {
+		name = argv[arg];
+		in = fopen(name, "r");
+		if (!in) {
+			perror(name);
+			return 2;
+		}
+	}
+	simReadTrace(name, in);
+	if (in != stdin) {
+		fclose(in);
+	}
+
+	struct timespec started;
+	clock_gettime(CLOCK_MONOTONIC, &started);
+
+	unsigned long ran = simRun(false, verbose);
+	simPrintSummary(ran);
+
+	struct timespec finished;
+	clock_gettime(CLOCK_MONOTONIC, &finished);
+	double seconds = (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) / 1e9;
+	fprintf(stderr, "vop_sim: %s, %.1f days in %.3fs, %lu loop() calls, %lu clock jumps\n",
+		name, ran / 86400000.0, seconds, sim_loops, sim_jumps);
+
+	return 0;
+
+}
@@ -0,0 +1,49 @@
+#!/bin/sh
+# --------------------------------------------------------------------------
+# Size report: compiles just the library (and one vOP instance, which is where most of
+# the RAM goes) for each build setting in vOPConfig.h, and shows what each costs
+# next to the default build.
+#
+# By default this is the host compiler, which only tells you which way things move.
+# For the real numbers, point it at the AVR toolchain:
+#   make size CXX=avr-g++ SIZE=avr-size SIZEFLAGS="-Os -mmcu=atmega328p"
+
+CXX=${CXX:-g++}
+SIZE=${SIZE:-size}
+SIZEFLAGS=${SIZEFLAGS:--Os}
+LIB=${LIB:-../..}
+
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+# The instance, so its members show up as bss.
+echo '#include "vOP.h"
+vOP vop;' > "$OUT/instance.cpp"
+
+# name, then the -D flags.
+CONFIGS="default:
+fixed-timing:-DVOP_FIXED_TIMING=1
+no-journal:-DVOP_JOURNAL=0
+fixed-no-journal:-DVOP_FIXED_TIMING=1 -DVOP_JOURNAL=0
+instrumented:-DVOP_INSTRUMENT=1
+supply:-DVOP_SUPPLY=1
+no-log:-DVOP_LOG=0
+2-channels:-DVOP_CHANNELS=2"
+
+printf '%-18s %8s %8s %10s %8s\n' config flash ram "+/- flash" "+/- ram"
+
+echo "$CONFIGS" | while IFS=: read -r name defines; do
+	mkdir -p "$OUT/$name"
+	for src in "$LIB"/*.cpp "$OUT/instance.cpp"; do
+		$CXX -DVOP_HAL_EXTERNAL -I. -I"$LIB" $defines $SIZEFLAGS -ffunction-sections -fdata-sections \
+			-c "$src" -o "$OUT/$name/$(basename "$src" .cpp).o" || exit 1
+	done
+	# text is flash, and data goes in both (it's copied out of flash at startup.)
+	$SIZE -t "$OUT/$name"/*.o | awk -v name="$name" '
+		END { flash = $1 + $2; ram = $2 + $3 }
+		END {
+			if (name == "default") { print flash, ram > "'"$OUT"'/base"; b[1] = flash; b[2] = ram }
+			else { getline base < "'"$OUT"'/base"; split(base, b, " ") }
+			printf "%-18s %8d %8d %+10d %+8d\n", name, flash, ram, flash - b[1], ram - b[2]
+		}'
+done
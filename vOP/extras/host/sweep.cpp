@@ -0,0 +1,372 @@
+// --------------------------------------------------------------------------
+// -- vop_sweep: Runs traces through vOP across a grid of tunings, on every core, to see which
+// settings are worth having. (The engine, and the trace format, are in vOPSim.h.)
+//
+// Each point of the grid runs each trace, and adds up how that went for the driver, over every
+// trace and channel: how long the Pi was down with the ignition on, how long it ran on the
+// battery, how often the watchdog cut a Pi that hadn't hung, and the worst of how long vOP took to
+// see the ignition change, and to cut a hung Pi. A point's on the pareto front if no other point
+// is at least as good on all five of those, and better on one.
+//
+// vOP and the mock are the micro's globals, so each run is a fork of its own, with a fresh copy
+// of everything. Up to -j of them at once (as many as there are cores, if you don't say), and as
+// each finishes the next run starts in its place, so the long traces don't hold the short ones up.
+//
+// Usage: ./vop_sweep [-j jobs] [-p] trace... name=values...
+//   name      A tuning, as for the tune line in a trace (watchdog_timeout, debounce_interval...),
+//             in the TUNE_'s own units. debounce_depth sets debounce_on_depth and debounce_off_depth
+//             together.
+//   values    Comma separated, and lo:hi:step for a range (lo:hi steps by 1.) e.g. 10:60:10,120
+//   -p        Only print the points on the pareto front.
+//
+// The CSV goes to stdout, one line for each point, in grid order (the last name changes fastest.)
+// Points that vOP wouldn't take (out of range for a TUNE_, say) are left out, with why on stderr.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <vector>
+
+#include "vOPSim.h"
+
+// What comes back down the pipe from each run.
+struct sweepResult {
+	unsigned long ran;
+	simChannel channels[VOP_CHANNELS];
+};
+
+// A point of the grid, all its traces added up.
+struct sweepPoint {
+	bool valid;							// Every trace ran (and vOP took the tunings.)
+	unsigned int runs;
+	unsigned long downtime;				// These are all millis...
+	unsigned long battery_time;
+	unsigned long relay_total;
+	unsigned long ignition_latency;		// ...the worst of them, for these two.
+	unsigned long hang_latency;
+	unsigned int power_ups;
+	unsigned int needless_cuts;
+	unsigned int watchdog_cuts;
+	unsigned int boot_failures;
+	bool pareto;
+};
+
+struct sweepParam {
+	const char *name;
+	std::vector<unsigned int> values;
+};
+
+// One run at a time, in each slot of the pool.
+struct sweepSlot {
+	pid_t pid;
+	int fd;
+	unsigned int job;
+};
+
+static std::vector<const char *> sweep_traces;
+static std::vector<sweepParam> sweep_params;
+
+static void usage() {
+
+	fprintf(stderr, "usage: vop_sweep [-j jobs] [-p] trace... name=values...\n");
+	exit(2);
+
+}
+
+// -- parseValues : name=values, from the command line. (See above for the values.)
+
+static void parseValues(char *arg) {
+
+	sweepParam param;
+	char *equals = strchr(arg, '=');
+	*equals = 0;
+	param.name = arg;
+
+	for (char *item = strtok(equals + 1, ","); item; item = strtok(0, ",")) {
+		unsigned long numbers[3] = {0, 0, 1};
+		int count = 0;
+		char *at = item;
+		for (;;) {
+			char *end;
+			numbers[count++] = strtoul(at, &end, 0);
+			if (end == at || (*end && *end != ':') || count > 3) {
+				fprintf(stderr, "vop_sweep: %s: bad value %s\n", param.name, item);
+				exit(2);
+			}
+			if (!*end) {
+				break;
+			}
+			at = end + 1;
+		}
+		if (count == 1) {
+			numbers[1] = numbers[0];
+		}
+		if (numbers[2] == 0 || numbers[1] < numbers[0] || numbers[1] > 0xFFFF) {
+			fprintf(stderr, "vop_sweep: %s: bad range %s\n", param.name, item);
+			exit(2);
+		}
+		for (unsigned long value = numbers[0]; value <= numbers[1]; value += numbers[2]) {
+			param.values.push_back(value);
+		}
+	}
+	if (param.values.empty()) {
+		fprintf(stderr, "vop_sweep: %s has no values\n", param.name);
+		exit(2);
+	}
+	sweep_params.push_back(param);
+
+}
+
+// -- valueAt : The value of a parameter, at a point of the grid.
+
+static unsigned int valueAt(unsigned int point, unsigned int param) {
+
+	for (unsigned int i = sweep_params.size() - 1; i > param; i--) {
+		point /= sweep_params[i].values.size();
+	}
+	return sweep_params[param].values[point % sweep_params[param].values.size()];
+
+}
+
+static bool tune(const char *name, unsigned int value) {
+
+	if (strcmp(name, "debounce_depth") == 0) {
+		return simTune("debounce_on_depth", value) && simTune("debounce_off_depth", value);
+	}
+	return simTune(name, value);
+
+}
+
+// -- runJob : In the child. Run a trace at a point, and send back what happened.
+
+static void runJob(unsigned int job, int fd) {
+
+	unsigned int point = job / sweep_traces.size();
+	const char *name = sweep_traces[job % sweep_traces.size()];
+
+	FILE *in = fopen(name, "r");
+	if (!in) {
+		perror(name);
+		_exit(2);
+	}
+	simReadTrace(name, in);
+	fclose(in);
+	for (unsigned int i = 0; i < sweep_params.size(); i++) {
+		tune(sweep_params[i].name, valueAt(point, i));
+	}
+
+	sweepResult result;
+	result.ran = simRun(true, false);
+	memcpy(result.channels, sim_channels, sizeof(result.channels));
+	if (write(fd, &result, sizeof(result)) != (ssize_t)sizeof(result)) {
+		_exit(2);
+	}
+	_exit(0);
+
+}
+
+// -- addResult : Add a run to its point.
+
+static void addResult(sweepPoint &point, const sweepResult &result) {
+
+	point.runs++;
+	for (byte ch = 0; ch < VOP_CHANNELS; ch++) {
+		const simChannel &channel = result.channels[ch];
+		point.downtime += channel.downtime;
+		point.battery_time += channel.battery_time;
+		point.relay_total += channel.relay_total;
+		point.power_ups += channel.power_ups;
+		point.needless_cuts += channel.needless_cuts;
+		point.watchdog_cuts += channel.watchdog_cuts;
+		point.boot_failures += channel.boot_failures;
+		if (channel.ignition_latency > point.ignition_latency) {
+			point.ignition_latency = channel.ignition_latency;
+		}
+		if (channel.hang_latency > point.hang_latency) {
+			point.hang_latency = channel.hang_latency;
+		}
+	}
+
+}
+
+// -- dominates : Is a at least as good as b on everything the driver cares about, and better on something?
+
+static bool dominates(const sweepPoint &a, const sweepPoint &b) {
+
+	unsigned long as[] = {a.downtime, a.battery_time, a.needless_cuts, a.ignition_latency, a.hang_latency};
+	unsigned long bs[] = {b.downtime, b.battery_time, b.needless_cuts, b.ignition_latency, b.hang_latency};
+	bool better = false;
+	for (unsigned int i = 0; i < sizeof(as) / sizeof(as[0]); i++) {
+		if (as[i] > bs[i]) {
+			return false;
+		}
+		if (as[i] < bs[i]) {
+			better = true;
+		}
+	}
+	return better;
+
+}
+
+int main(int argc, char **argv) {
+
+	long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	bool front_only = false;
+
+	for (int arg = 1; arg < argc; arg++) {
+		if (strcmp(argv[arg], "-j") == 0) {
+			if (++arg == argc || (jobs = atol(argv[arg])) < 1) {
+				usage();
+			}
+		} else if (strcmp(argv[arg], "-p") == 0) {
+			front_only = true;
+		} else if (strchr(argv[arg], '=')) {
+			parseValues(argv[arg]);
+		} else {
+			sweep_traces.push_back(argv[arg]);
+		}
+	}
+	if (sweep_traces.empty()) {
+		usage();
+	}
+	if (jobs < 1) {
+		jobs = 1;
+	}
+
+	// Read each trace once here, so anything wrong with one is said once (and it exits.) Then the
+	// names. (The tunings they leave behind don't matter, each run reads its trace again.)
+	for (unsigned int i = 0; i < sweep_traces.size(); i++) {
+		FILE *in = fopen(sweep_traces[i], "r");
+		if (!in) {
+			perror(sweep_traces[i]);
+			return 2;
+		}
+		simReadTrace(sweep_traces[i], in);
+		fclose(in);
+	}
+	unsigned int points = 1;
+	for (unsigned int i = 0; i < sweep_params.size(); i++) {
+		if (!tune(sweep_params[i].name, sweep_params[i].values[0])) {
+			fprintf(stderr, "vop_sweep: no such tuning: %s\n", sweep_params[i].name);
+			return 2;
+		}
+		points *= sweep_params[i].values.size();
+	}
+
+	struct timespec started;
+	clock_gettime(CLOCK_MONOTONIC, &started);
+
+	std::vector<sweepPoint> grid(points);
+	memset(&grid[0], 0, points * sizeof(sweepPoint));
+	for (unsigned int i = 0; i < points; i++) {
+		grid[i].valid = true;
+	}
+
+	// The pool: keep every slot busy, until there's nothing left to start and everything's back.
+	unsigned int total = points * sweep_traces.size();
+	unsigned int next = 0;
+	std::vector<sweepSlot> running;
+	while (next < total || !running.empty()) {
+
+		while (next < total && running.size() < (unsigned long)jobs) {
+			int fds[2];
+			if (pipe(fds) != 0) {
+				perror("vop_sweep: pipe");
+				return 2;
+			}
+			fflush(stdout);
+			fflush(stderr);
+			pid_t pid = fork();
+			if (pid < 0) {
+				perror("vop_sweep: fork");
+				return 2;
+			}
+			if (pid == 0) {
+				close(fds[0]);
+				runJob(next, fds[1]);
+			}
+			close(fds[1]);
+			sweepSlot slot = {pid, fds[0], next++};
+			running.push_back(slot);
+		}
+
+		int status;
+		pid_t pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			perror("vop_sweep: waitpid");
+			return 2;
+		}
+		for (unsigned int i = 0; i < running.size(); i++) {
+			if (running[i].pid != pid) {
+				continue;
+			}
+			// It's all in the pipe by the time it's exited. (It's well under a pipe's worth.)
+			sweepResult result;
+			sweepPoint &point = grid[running[i].job / sweep_traces.size()];
+			if (WIFEXITED(status) && WEXITSTATUS(status) == 0
+				&& read(running[i].fd, &result, sizeof(result)) == (ssize_t)sizeof(result)) {
+				addResult(point, result);
+			} else {
+				point.valid = false;
+			}
+			close(running[i].fd);
+			running.erase(running.begin() + i);
+			break;
+		}
+
+	}
+
+	// The front, the slow way. (It's only the points, not the runs.)
+	unsigned int valid = 0;
+	unsigned int front = 0;
+	for (unsigned int i = 0; i < points; i++) {
+		if (!grid[i].valid) {
+			continue;
+		}
+		valid++;
+		grid[i].pareto = true;
+		for (unsigned int j = 0; j < points && grid[i].pareto; j++) {
+			if (grid[j].valid && dominates(grid[j], grid[i])) {
+				grid[i].pareto = false;
+			}
+		}
+		if (grid[i].pareto) {
+			front++;
+		}
+	}
+
+	for (unsigned int i = 0; i < sweep_params.size(); i++) {
+		printf("%s,", sweep_params[i].name);
+	}
+	printf("downtime_s,battery_s,relay_on_s,power_ups,needless_cuts,watchdog_cuts,failed_boots,"
+		"ignition_latency_ms,hang_latency_ms,pareto\n");
+	for (unsigned int i = 0; i < points; i++) {
+		const sweepPoint &point = grid[i];
+		if (!point.valid || (front_only && !point.pareto)) {
+			continue;
+		}
+		for (unsigned int p = 0; p < sweep_params.size(); p++) {
+			printf("%u,", valueAt(i, p));
+		}
+		printf("%.3f,%.3f,%.3f,%u,%u,%u,%u,%lu,%lu,%u\n", point.downtime / 1000.0, point.battery_time / 1000.0,
+			point.relay_total / 1000.0, point.power_ups, point.needless_cuts, point.watchdog_cuts,
+			point.boot_failures, point.ignition_latency, point.hang_latency, point.pareto ? 1 : 0);
+	}
+
+	struct timespec finished;
+	clock_gettime(CLOCK_MONOTONIC, &finished);
+	double seconds = (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) / 1e9;
+	fprintf(stderr, "vop_sweep: %u points x %u traces, %u runs on %ld cores in %.3fs, %u on the front",
+		points, (unsigned int)sweep_traces.size(), total, jobs, seconds, front);
+	if (valid < points) {
+		fprintf(stderr, ", %u left out", points - valid);
+	}
+	fprintf(stderr, "\n");
+
+	return 0;
+
+}
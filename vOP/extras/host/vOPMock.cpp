@@ -0,0 +1,339 @@
+// --------------------------------------------------------------------------
+// -- vOPMock: Host implementation of vOPHal.h
+
+#include "vOPMock.h"
+#include "vOP.h"
+#include "vOPHal.h"
+
+#include <stdio.h>
+
+static unsigned long mock_micros = 0;				// The virtual time. It doesn't wrap, what vOP sees of it does.
+static unsigned long mock_sleep_limit = MOCK_MAX_SLEEP;
+
+static byte mock_pins[MOCK_PIN_COUNT];
+static byte mock_pin_modes[MOCK_PIN_COUNT];
+static void (*mock_pin_wake[MOCK_PIN_COUNT])();
+
+static byte mock_eeprom[MOCK_EEPROM_SIZE];
+static unsigned long mock_eeprom_writes[MOCK_EEPROM_SIZE];
+static bool mock_eeprom_busy = false;
+static unsigned long mock_eeprom_busy_since = 0;
+static bool mock_eeprom_erased = false;
+
+static unsigned int mock_analog[MOCK_PIN_COUNT];
+static unsigned int mock_analog_noise[MOCK_PIN_COUNT];
+static byte mock_adc_pin = 0;
+static void (*mock_adc_handler)(unsigned int value) = 0;
+static unsigned long mock_adc_last = 0;
+static unsigned long mock_noise_seed = 1;
+
+static unsigned long mock_serial_baud = 0;
+static byte mock_serial_tx[MOCK_SERIAL_TX_BUFFER];
+static byte mock_serial_tx_count = 0;
+static unsigned long mock_serial_last = 0;
+static byte mock_serial_wire[MOCK_SERIAL_WIRE];
+static unsigned int mock_serial_wire_count = 0;
+
+static byte mock_rx[MOCK_I2C_BUFFER];
+static byte mock_rx_length = 0;
+static byte mock_rx_index = 0;
+
+static byte mock_tx[MOCK_I2C_BUFFER];
+static const byte *mock_tx_data = mock_tx;	// Where a read goes out from: mock_tx, or vOP's own buffer (see vop_hal_i2cSend.)
+static byte mock_tx_length = 0;
+static bool mock_twi = false;				// Is this read going through the TWI driver, or Wire?
+
+// -- Clock ------------------------------------------------------------------
+
+static void mock_adcCatchUp();
+static void mock_serialCatchUp();
+
+void mock_setMillis(unsigned long ms) { mock_micros = ms * 1000UL; mock_adc_last = mock_micros; mock_serial_last = mock_micros; }
+void mock_advanceMillis(unsigned long ms) { mock_micros += ms * 1000UL; mock_adcCatchUp(); mock_serialCatchUp(); }
+void mock_advanceMicros(unsigned long us) { mock_micros += us; mock_adcCatchUp(); mock_serialCatchUp(); }
+
+unsigned long mock_millis() { return mock_micros / 1000UL; }
+
+// 32 bits, like the micro's, so they wrap where its do: millis() every 49.7 days, micros() every 71.6 minutes.
+uint32_t vop_hal_millis() { return (uint32_t)(mock_micros / 1000UL); }
+uint32_t vop_hal_micros() { return (uint32_t)mock_micros; }
+
+// -- GPIO -------------------------------------------------------------------
+
+void mock_setPin(byte pin, byte value) {
+	byte old = mock_pins[pin];
+	mock_pins[pin] = value;
+	// Fire the edge interrupt, if vOP asked for one.
+	if (old != value && mock_pin_wake[pin]) {
+		mock_pin_wake[pin]();
+	}
+}
+
+byte mock_getPin(byte pin) { return mock_pins[pin]; }
+byte mock_getPinMode(byte pin) { return mock_pin_modes[pin]; }
+
+void vop_hal_pinMode(byte pin, byte mode) { mock_pin_modes[pin] = mode; }
+int vop_hal_digitalRead(byte pin) { return mock_pins[pin]; }
+void vop_hal_digitalWrite(byte pin, byte value) { mock_pins[pin] = value; }
+
+// Pins come in ports of eight, like pins 0-7 being PORTD on an Uno.
+byte vop_hal_readPort(byte pin) {
+	byte first = pin & ~7;
+	byte port = 0;
+	for (byte i = 0; i < 8 && first + i < MOCK_PIN_COUNT; i++) {
+		if (mock_pins[first + i]) {
+			port |= 1 << i;
+		}
+	}
+	return port;
+}
+
+byte vop_hal_pinBit(byte pin) { return 1 << (pin & 7); }
+
+// -- Critical sections ------------------------------------------------------
+// There are no interrupts on the host, the i2c events are called in line.
+
+byte vop_hal_interruptsOff() { return 0; }
+void vop_hal_interruptsRestore(byte state) { (void)state; }
+
+// -- Power ------------------------------------------------------------------
+// Sleeping just moves the clock on, as nothing can interrupt us mid-call (so only a wake that
+// came before it counts). A nap is capped so a caller driving inputs between loops doesn't skip past them.
+
+void vop_hal_sleep(uint32_t ms, volatile byte *woken) {
+	if (*woken) {
+		return;
+	}
+	if (ms > mock_sleep_limit) {
+		ms = mock_sleep_limit;
+	}
+	mock_advanceMillis(ms);
+}
+
+void mock_setSleepLimit(unsigned long ms) { mock_sleep_limit = ms; }
+
+bool vop_hal_attachWake(byte pin, void (*handler)()) { mock_pin_wake[pin] = handler; return true; }
+
+// A power cut takes RAM with it, and the warm state's only a plain variable here, so we wipe it.
+void mock_powerCut() { memset(&vop_warm_state, 0, sizeof(vop_warm_state)); }
+
+// -- ADC --------------------------------------------------------------------
+
+void mock_setAnalog(byte pin, unsigned int value, unsigned int noise) {
+	mock_analog[pin] = value;
+	mock_analog_noise[pin] = noise;
+}
+
+bool vop_hal_adcStart(byte pin, void (*handler)(unsigned int value)) {
+	if (pin >= MOCK_PIN_COUNT) {
+		return false;
+	}
+	mock_adc_pin = pin;
+	mock_adc_handler = handler;
+	mock_adc_last = mock_micros;
+	return true;
+}
+
+// Hand over every conversion that's come due, with its noise (the same every run.)
+static void mock_adcCatchUp() {
+	while (mock_adc_handler && mock_micros - mock_adc_last >= MOCK_ADC_MICROS) {
+		mock_adc_last += MOCK_ADC_MICROS;
+		long value = mock_analog[mock_adc_pin];
+		unsigned int noise = mock_analog_noise[mock_adc_pin];
+		if (noise) {
+			mock_noise_seed = mock_noise_seed * 1103515245UL + 12345UL;
+			value += (long)((mock_noise_seed >> 16) % (2 * noise + 1)) - noise;
+		}
+		mock_adc_handler(value < 0 ? 0 : (value > 1023 ? 1023 : value));
+	}
+}
+
+// -- Serial -----------------------------------------------------------------
+
+void vop_hal_serialBegin(unsigned long baud) {
+	mock_serial_baud = baud;
+	mock_serial_tx_count = 0;
+	mock_serial_last = mock_micros;
+}
+
+byte vop_hal_serialRoom() {
+	return mock_serial_baud ? MOCK_SERIAL_TX_BUFFER - mock_serial_tx_count : 0;
+}
+
+void vop_hal_serialWrite(const byte *data, byte length) {
+	// Like HardwareSerial, a write that doesn't fit would wait for room, which vOP should never let happen.
+	if (length > vop_hal_serialRoom()) {
+		fprintf(stderr, "vOPMock: serial write of %d bytes with room for %d, it would have blocked\n", length, vop_hal_serialRoom());
+		length = vop_hal_serialRoom();
+	}
+	memcpy(&mock_serial_tx[mock_serial_tx_count], data, length);
+	mock_serial_tx_count += length;
+}
+
+// Send whatever the baud rate would have got out by now (ten bits a byte.)
+static void mock_serialCatchUp() {
+	if (!mock_serial_baud) {
+		return;
+	}
+	unsigned long per_byte = 10000000UL / mock_serial_baud;
+	while (mock_serial_tx_count && mock_micros - mock_serial_last >= per_byte) {
+		mock_serial_last += per_byte;
+		if (mock_serial_wire_count < MOCK_SERIAL_WIRE) {
+			mock_serial_wire[mock_serial_wire_count++] = mock_serial_tx[0];
+		}
+		memmove(mock_serial_tx, mock_serial_tx + 1, --mock_serial_tx_count);
+	}
+	// An idle line doesn't bank time for later.
+	if (!mock_serial_tx_count) {
+		mock_serial_last = mock_micros;
+	}
+}
+
+unsigned int mock_serialRead(byte *data, unsigned int length) {
+	if (length > mock_serial_wire_count) {
+		length = mock_serial_wire_count;
+	}
+	memcpy(data, mock_serial_wire, length);
+	mock_serial_wire_count -= length;
+	memmove(mock_serial_wire, mock_serial_wire + length, mock_serial_wire_count);
+	return length;
+}
+
+// -- EEPROM -----------------------------------------------------------------
+
+void mock_eepromErase() {
+	memset(mock_eeprom, 0xFF, sizeof(mock_eeprom));
+	memset(mock_eeprom_writes, 0, sizeof(mock_eeprom_writes));
+	mock_eeprom_erased = true;
+}
+
+unsigned long mock_eepromWrites(unsigned int address) { return mock_eeprom_writes[address]; }
+
+byte vop_hal_eepromRead(unsigned int address) {
+	if (!mock_eeprom_erased) {
+		mock_eepromErase();
+	}
+	return mock_eeprom[address];
+}
+
+void vop_hal_eepromWrite(unsigned int address, byte value) {
+	if (!mock_eeprom_erased) {
+		mock_eepromErase();
+	}
+	mock_eeprom[address] = value;
+	mock_eeprom_writes[address]++;
+	mock_eeprom_busy = true;
+	mock_eeprom_busy_since = mock_micros;
+}
+
+bool vop_hal_eepromReady() {
+	if (mock_eeprom_busy && mock_micros - mock_eeprom_busy_since >= MOCK_EEPROM_WRITE_MICROS) {
+		mock_eeprom_busy = false;
+	}
+	return !mock_eeprom_busy;
+}
+
+unsigned int vop_hal_eepromSize() { return MOCK_EEPROM_SIZE; }
+
+// -- i2c --------------------------------------------------------------------
+
+void mock_i2cWrite(vOP &vop, const byte *data, byte length) {
+
+	if (length > MOCK_I2C_BUFFER) {
+		length = MOCK_I2C_BUFFER;
+	}
+	memcpy(mock_rx, data, length);
+	mock_rx_length = length;
+	mock_rx_index = 0;
+	vop.receiveData(length);
+
+}
+
+byte mock_i2cRead(vOP &vop, byte *data, byte length) {
+
+	mock_twi = false;
+	mock_tx_data = mock_tx;
+	mock_tx_length = 0;
+	vop.fillRequest();
+	if (length > mock_tx_length) {
+		length = mock_tx_length;
+	}
+	memcpy(data, mock_tx_data, length);
+	return length;
+
+}
+
+// The TWI driver (VOP_TWI) hands each byte over as it comes off the bus, and sends each from wherever
+// vop_hal_i2cSend left it, one TWDR at a time.
+
+void mock_twiWrite(vOP &vop, const byte *data, byte length) {
+
+	for (byte i = 0; i < length; i++) {
+		vop.receiveByte(data[i], i);
+	}
+
+}
+
+byte mock_twiRead(vOP &vop, byte *data, byte length) {
+
+	mock_twi = true;
+	mock_tx_data = mock_tx;
+	mock_tx_length = 0;
+	vop.fillRequest();
+	if (length > mock_tx_length) {
+		length = mock_tx_length;
+	}
+	for (byte i = 0; i < length; i++) {
+		data[i] = mock_tx_data[i];
+	}
+	mock_twi = false;
+	return length;
+
+}
+
+// The master here calls vOP itself, so there's nothing to hook up.
+void vop_hal_i2cBegin(byte address, void (*received)(int count), void (*requested)()) {
+	(void)address;
+	(void)received;
+	(void)requested;
+}
+
+void vop_hal_twiBegin(byte address, void (*received)(byte value, byte index), void (*requested)()) {
+	(void)address;
+	(void)received;
+	(void)requested;
+}
+
+int vop_hal_i2cAvailable() { return mock_rx_length - mock_rx_index; }
+
+int vop_hal_i2cRead() {
+	if (mock_rx_index >= mock_rx_length) {
+		return -1;
+	}
+	return mock_rx[mock_rx_index++];
+}
+
+void vop_hal_i2cWrite(const byte *data, byte length) {
+	// Anything sent in place so far is copied in ahead of it, so it all goes out in order.
+	if (mock_tx_data != mock_tx) {
+		memmove(mock_tx, mock_tx_data, mock_tx_length);
+		mock_tx_data = mock_tx;
+	}
+	// Like Wire, anything past the buffer is dropped.
+	while (length-- && mock_tx_length < MOCK_I2C_BUFFER) {
+		mock_tx[mock_tx_length++] = *data++;
+	}
+}
+
+void vop_hal_i2cSend(const byte *data, byte length) {
+	// The TWI driver sends the first piece straight from where it is. Wire copies it like anything else.
+	if (mock_twi && !mock_tx_length) {
+		mock_tx_data = data;
+		mock_tx_length = length > MOCK_I2C_BUFFER ? MOCK_I2C_BUFFER : length;
+		return;
+	}
+	vop_hal_i2cWrite(data, length);
+}
+
+// Reads are over before mock_twiRead returns, so nothing's ever still going out.
+bool vop_hal_i2cSending() { return false; }
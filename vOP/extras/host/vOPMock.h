@@ -0,0 +1,63 @@
+#ifndef vOPMock_h
+#define vOPMock_h
+
+// --------------------------------------------------------------------------
+// -- vOPMock: The host side of the HAL.
+// A virtual clock, a bank of pins, an EEPROM and an i2c master you can drive from a test program.
+// Nothing moves unless you move it, so runs are deterministic.
+
+#include "Arduino.h"
+
+class vOP;
+
+#define MOCK_PIN_COUNT 20
+#define MOCK_I2C_BUFFER 32
+#define MOCK_MAX_SLEEP 1000
+#define MOCK_EEPROM_SIZE 1024
+#define MOCK_EEPROM_WRITE_MICROS 3300
+#define MOCK_ADC_MICROS 1024
+#define MOCK_SERIAL_TX_BUFFER 64
+#define MOCK_SERIAL_WIRE 4096
+
+// -- Clock: set or advance the virtual time. vOP sees it through vop_hal_millis(), which wraps at
+// 32 bits like the micro's, millis is all of it.
+void mock_setMillis(unsigned long ms);
+unsigned long mock_millis();
+void mock_advanceMillis(unsigned long ms);
+void mock_advanceMicros(unsigned long us);
+// How far a nap (vop_hal_sleep) can move the clock, MOCK_MAX_SLEEP to start with. 0 and they don't
+// move it at all, for a caller that moves the clock itself.
+void mock_setSleepLimit(unsigned long ms);
+
+// -- GPIO: drive an input, or look at what vOP drove.
+void mock_setPin(byte pin, byte value);
+byte mock_getPin(byte pin);
+byte mock_getPinMode(byte pin);
+
+// -- ADC: what an analog pin reads (0-1023), give or take noise. Once vOP starts the ADC, it gets a
+// reading every MOCK_ADC_MICROS as the clock moves, like timer 0 triggering it on the real thing.
+void mock_setAnalog(byte pin, unsigned int value, unsigned int noise = 0);
+
+// -- Serial: a transmit buffer the size of HardwareSerial's, sent at the baud rate vOP started it
+// at as the clock moves. Read takes what's come out of the TX pin so far, and returns how many bytes.
+unsigned int mock_serialRead(byte *data, unsigned int length);
+
+// -- EEPROM: starts blank (0xFF), and each write keeps it busy for as long as the real thing.
+// Erase puts it back to blank, writes counts how often a cell has been written, for looking at wear.
+void mock_eepromErase();
+unsigned long mock_eepromWrites(unsigned int address);
+
+// -- Power: a new vOP is a reset of the micro, which keeps the warm state (see vOP.h) like the real
+// RAM does. Cut the power first to lose it, as well.
+void mock_powerCut();
+
+// -- i2c: behave like the Raspberry Pi master.
+// Write hands the bytes to vOP::receiveData(), read calls vOP::fillRequest() and returns how many bytes it wrote.
+void mock_i2cWrite(vOP &vop, const byte *data, byte length);
+byte mock_i2cRead(vOP &vop, byte *data, byte length);
+// The same, the way the TWI driver (VOP_TWI) does it: a byte at a time into vOP::receiveByte(), and
+// reads sent straight from vOP's buffers where it can. Either works, whatever VOP_TWI is.
+void mock_twiWrite(vOP &vop, const byte *data, byte length);
+byte mock_twiRead(vOP &vop, byte *data, byte length);
+
+#endif
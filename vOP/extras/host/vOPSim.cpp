@@ -0,0 +1,981 @@
+// --------------------------------------------------------------------------
+// -- vOPSim: The trace replay engine behind vop_sim and vop_sweep. See vOPSim.h.
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "vOP.h"
+#include "vOPMock.h"
+#include "vOPSim.h"
+
+// The commands the Pis and the summary need. (Keep these in step with CMD_ in vOP.cpp.)
+#define SIM_CMD_GET_IGNITION_STATE 11
+#define SIM_CMD_PAT_WATCHDOG 15
+#define SIM_CMD_REQUEST_SHUTDOWN_SECONDS 18
+#define SIM_CMD_CANCEL_SHUTDOWN 21
+#define SIM_CMD_SELECT_CHANNEL 37
+#define SIM_CMD_HALTING 43
+#define SIM_CMD_HALTED 44
+#define SIM_END_OF_COMMAND 10
+
+// And the watchdog states. (WATCHDOG_STATE_ in vOP.cpp.)
+#define SIM_WATCHDOG_SHUTDOWN 1
+#define SIM_WATCHDOG_BOOTING 2
+#define SIM_WATCHDOG_IDLE 3
+
+#define SIM_LINE 256
+#define SIM_MAX_DEPTH 8					// How deep repeats can nest.
+#define SIM_SPINS 4						// loop() calls without the clock moving, before we nudge it on a milli.
+#define SIM_NEVER ULONG_MAX				// (The run's clock goes past 32 bits, even if vOP's doesn't.)
+
+// -- What a line of the trace does.
+#define SIM_IGNITION 0
+#define SIM_PIN 1
+#define SIM_CMD 2
+#define SIM_WRITE 3
+#define SIM_READ 4
+#define SIM_PI 5
+#define SIM_MARK 6
+#define SIM_TUNE 7
+
+// -- The Pi settings, and what it's up to.
+#define PI_BOOT 0
+#define PI_PAT 1
+#define PI_SHUTDOWN 2
+#define PI_HALT 3
+#define PI_SETTINGS 4
+
+#define PI_OFF 0						// No power.
+#define PI_BOOTING 1					// Powered, not answering yet.
+#define PI_UP 2							// Patting and polling.
+#define PI_HALTING 3					// Told us it's halting, and will say when it has.
+#define PI_DOWN 4						// Halted (or hung), still powered.
+
+struct simAction {
+	unsigned long at;					// From the start of the run (millis.)
+	byte kind;							// SIM_ above.
+	byte ch;							// For pi.
+	byte pin;							// For pin, and the TUNE_ for tune.
+	byte value;							// ignition and pin: the level. read: how many. pi: 1 on, 0 off, 2 hang, 3 settings.
+	byte length;						// How many bytes for cmd and write.
+	byte bytes[MOCK_I2C_BUFFER];
+	unsigned long settings[PI_SETTINGS];	// For pi, SIM_NEVER where the line left it alone.
+	unsigned int tuning;				// For tune.
+	int line;							// Where it came from, in the trace.
+	char text[SIM_LINE];				// For mark.
+};
+
+struct simPi {
+	bool present;						// Is there one at all? (pi off)
+	unsigned long settings[PI_SETTINGS];
+	byte state;							// PI_ above.
+	unsigned long next;					// When it next does something, or SIM_NEVER.
+	bool asked;							// Has it asked for a shutdown?
+	bool hung;							// Is it hung (rather than halted)...
+	unsigned long hung_at;				// ...since?
+};
+
+struct simEvent {
+	unsigned long time;
+	byte type;
+	byte arg;
+	byte ch;
+};
+
+// The names for tune lines (and vop_sweep.) Keep these in step with TUNE_ in vOP.h.
+struct simTuning {
+	const char *name;
+	byte id;
+};
+
+static const simTuning sim_tunings[] = {
+	{"watchdog_timeout", TUNE_WATCHDOG_TIMEOUT},
+	{"watchdog_turnoff", TUNE_WATCHDOG_TURNOFF},
+	{"watchdog_run", TUNE_WATCHDOG_RUN},
+	{"watchdog_boot", TUNE_WATCHDOG_BOOT},
+	{"power_minimum_off", TUNE_POWER_MINIMUM_OFF},
+	{"power_on_stagger", TUNE_POWER_ON_STAGGER},
+	{"debounce_interval", TUNE_DEBOUNCE_INTERVAL},
+	{"debounce_on_depth", TUNE_DEBOUNCE_ON_DEPTH},
+	{"ignition_holdoff", TUNE_IGNITION_HOLDOFF},
+	{"debounce_off_depth", TUNE_DEBOUNCE_OFF_DEPTH},
+	{"supply_cutoff", TUNE_SUPPLY_CUTOFF},
+};
+
+#define SIM_TUNINGS (sizeof(sim_tunings) / sizeof(sim_tunings[0]))
+
+static vOP vop;
+static const char *sim_trace_name = "stdin";
+static bool sim_quiet = false;
+static bool sim_verbose = false;
+static std::vector<simAction> sim_actions;
+static simPi sim_pis[VOP_CHANNELS];
+static std::vector<simEvent> sim_events;		// Recorded by the hook, waiting for us to look at them.
+static bool sim_ignition = false;				// The ignition, as the trace drives it.
+
+simChannel sim_channels[VOP_CHANNELS];
+unsigned long sim_loops = 0;
+unsigned long sim_jumps = 0;
+
+// --------------------------------------------------------------------------
+// -- Reading the trace.
+
+static void simError(int line, const char *message, const char *token) {
+
+	fprintf(stderr, "%s:%d: %s%s%s\n", sim_trace_name, line, message, token ? ": " : "", token ? token : "");
+	exit(2);
+
+}
+
+// -- parseTime : 1d7h30m and friends into millis. Returns false if it isn't one.
+
+static bool parseTime(const char *token, unsigned long *ms) {
+
+	unsigned long total = 0;
+	const char *p = token;
+	if (!*p) {
+		return false;
+	}
+	while (*p) {
+		if (*p < '0' || *p > '9') {
+			return false;
+		}
+		unsigned long number = strtoul(p, (char **)&p, 10);
+		if (strncmp(p, "ms", 2) == 0) {
+			p += 2;
+		} else if (*p == 'd') {
+			number *= 86400000UL;
+			p++;
+		} else if (*p == 'h') {
+			number *= 3600000UL;
+			p++;
+		} else if (*p == 'm') {
+			number *= 60000UL;
+			p++;
+		} else if (*p == 's') {
+			number *= 1000UL;
+			p++;
+		} else if (*p) {
+			return false;
+		}
+		total += number;
+	}
+	*ms = total;
+	return true;
+
+}
+
+static unsigned long needTime(int line, const char *token) {
+
+	unsigned long ms;
+	if (!token || !parseTime(token, &ms)) {
+		simError(line, "expected a time", token);
+	}
+	return ms;
+
+}
+
+static byte needByte(int line, const char *token) {
+
+	char *end;
+	if (!token) {
+		simError(line, "expected a byte", 0);
+	}
+	unsigned long value = strtoul(token, &end, 0);
+	if (*end || value > 0xFF) {
+		simError(line, "expected a byte", token);
+	}
+	return value;
+
+}
+
+// -- findTuning : The TUNE_ with this name, or TUNE_COUNT if there isn't one.
+
+static byte findTuning(const char *name) {
+
+	for (unsigned int i = 0; i < SIM_TUNINGS; i++) {
+		if (strcmp(sim_tunings[i].name, name) == 0) {
+			return sim_tunings[i].id;
+		}
+	}
+	return TUNE_COUNT;
+
+}
+
+static const char *tuningName(byte id) {
+
+	for (unsigned int i = 0; i < SIM_TUNINGS; i++) {
+		if (sim_tunings[i].id == id) {
+			return sim_tunings[i].name;
+		}
+	}
+	return "?";
+
+}
+
+// -- parseLines : Turn the lines from first up to a matching end (or the last) into actions, starting at base.
+// Returns the line after the end, and where the last line left the time.
+
+static unsigned int parseLines(std::vector<char *> &lines, unsigned int first, unsigned long base, int depth, unsigned long *last) {
+
+	unsigned long previous = base;
+
+	for (unsigned int i = first; i < lines.size(); i++) {
+
+		// Tokens, up to the comment.
+		char copy[SIM_LINE];
+		strncpy(copy, lines[i], SIM_LINE - 1);
+		copy[SIM_LINE - 1] = 0;
+		char *hash = strchr(copy, '#');
+		if (hash) {
+			*hash = 0;
+		}
+		char *tokens[SIM_LINE / 2];
+		unsigned int count = 0;
+		for (char *token = strtok(copy, " \t\r\n"); token; token = strtok(0, " \t\r\n")) {
+			tokens[count++] = token;
+		}
+		if (!count) {
+			continue;
+		}
+		int line = i + 1;
+
+		if (strcmp(tokens[0], "end") == 0) {
+			if (!depth) {
+				simError(line, "end without a repeat", 0);
+			}
+			*last = previous;
+			return i + 1;
+		}
+
+		// When.
+		unsigned long at;
+		if (tokens[0][0] == '+') {
+			at = previous + needTime(line, tokens[0] + 1);
+		} else {
+			at = base + needTime(line, tokens[0]);
+		}
+		previous = at;
+		if (count < 2) {
+			simError(line, "nothing to do", 0);
+		}
+
+		simAction action;
+		memset(&action, 0, sizeof(action));
+		action.at = at;
+		action.line = line;
+		const char *what = tokens[1];
+
+		if (strcmp(what, "repeat") == 0) {
+			if (count != 5 || strcmp(tokens[3], "every") != 0) {
+				simError(line, "expected repeat <count> every <time>", 0);
+			}
+			if (depth >= SIM_MAX_DEPTH) {
+				simError(line, "repeats nested too deep", 0);
+			}
+			unsigned long times = strtoul(tokens[2], 0, 10);
+			unsigned long every = needTime(line, tokens[4]);
+			unsigned int after = i + 1;
+			unsigned long inner;
+			for (unsigned long r = 0; r < times; r++) {
+				after = parseLines(lines, i + 1, at + r * every, depth + 1, &inner);
+			}
+			if (!times) {
+				// Still have to find its end.
+				std::vector<simAction> keep;
+				keep.swap(sim_actions);
+				after = parseLines(lines, i + 1, at, depth + 1, &inner);
+				keep.swap(sim_actions);
+			}
+			previous = at + times * every;
+			i = after - 1;
+			continue;
+		}
+
+		if (strcmp(what, "ignition") == 0 && count == 3) {
+			action.kind = SIM_IGNITION;
+			if (strcmp(tokens[2], "on") == 0) {
+				action.value = HIGH;
+			} else if (strcmp(tokens[2], "off") == 0) {
+				action.value = LOW;
+			} else {
+				simError(line, "expected ignition on or off", tokens[2]);
+			}
+		} else if (strcmp(what, "pin") == 0 && count == 4) {
+			action.kind = SIM_PIN;
+			action.pin = needByte(line, tokens[2]);
+			action.value = needByte(line, tokens[3]) ? HIGH : LOW;
+			if (action.pin >= MOCK_PIN_COUNT) {
+				simError(line, "no such pin", tokens[2]);
+			}
+		} else if ((strcmp(what, "cmd") == 0 && count >= 3 && count <= 5) || (strcmp(what, "write") == 0 && count >= 3)) {
+			action.kind = what[0] == 'c' ? SIM_CMD : SIM_WRITE;
+			if (count - 2 > MOCK_I2C_BUFFER) {
+				simError(line, "too many bytes for one write", 0);
+			}
+			for (unsigned int t = 2; t < count; t++) {
+				action.bytes[action.length++] = needByte(line, tokens[t]);
+			}
+			// A command always has its two parameters.
+			while (action.kind == SIM_CMD && action.length < 3) {
+				action.bytes[action.length++] = 0;
+			}
+		} else if (strcmp(what, "read") == 0 && count == 3) {
+			action.kind = SIM_READ;
+			action.value = needByte(line, tokens[2]);
+			if (action.value > MOCK_I2C_BUFFER) {
+				simError(line, "too many bytes for one read", tokens[2]);
+			}
+		} else if (strcmp(what, "pi") == 0 && count >= 3) {
+			action.kind = SIM_PI;
+			unsigned int t = 2;
+			if (strncmp(tokens[t], "ch", 2) == 0) {
+				action.ch = needByte(line, tokens[t] + 2);
+				if (action.ch >= VOP_CHANNELS) {
+					simError(line, "no such channel", tokens[t]);
+				}
+				t++;
+			}
+			for (byte s = 0; s < PI_SETTINGS; s++) {
+				action.settings[s] = SIM_NEVER;
+			}
+			if (t + 1 == count && strcmp(tokens[t], "on") == 0) {
+				action.value = 1;
+			} else if (t + 1 == count && strcmp(tokens[t], "off") == 0) {
+				action.value = 0;
+			} else if (t + 1 == count && strcmp(tokens[t], "hang") == 0) {
+				action.value = 2;
+			} else {
+				action.value = 3;
+				if (t == count || (count - t) % 2) {
+					simError(line, "expected pi settings in pairs, like boot 30s", 0);
+				}
+				for (; t < count; t += 2) {
+					const char *names[PI_SETTINGS] = {"boot", "pat", "shutdown", "halt"};
+					byte s = 0;
+					while (s < PI_SETTINGS && strcmp(tokens[t], names[s]) != 0) {
+						s++;
+					}
+					if (s == PI_SETTINGS) {
+						simError(line, "no such pi setting", tokens[t]);
+					}
+					action.settings[s] = needTime(line, tokens[t + 1]);
+				}
+				if (action.settings[PI_PAT] == 0) {
+					simError(line, "the pi has to pat more often than never", 0);
+				}
+			}
+		} else if (strcmp(what, "tune") == 0 && count == 4) {
+			action.kind = SIM_TUNE;
+			action.pin = findTuning(tokens[2]);
+			if (action.pin == TUNE_COUNT) {
+				simError(line, "no such tuning", tokens[2]);
+			}
+			char *end;
+			unsigned long value = strtoul(tokens[3], &end, 0);
+			if (*end || value > 0xFFFF) {
+				simError(line, "expected a number", tokens[3]);
+			}
+			action.tuning = value;
+		} else if (strcmp(what, "mark") == 0) {
+			action.kind = SIM_MARK;
+			// The rest of the line, as it was written.
+			const char *text = strstr(lines[i], "mark") + 4;
+			text += strspn(text, " \t");
+			strncpy(action.text, text, SIM_LINE - 1);
+			char *cut = action.text + strcspn(action.text, "#\r\n");
+			*cut = 0;
+			while (cut > action.text && (cut[-1] == ' ' || cut[-1] == '\t')) {
+				*--cut = 0;
+			}
+		} else {
+			simError(line, "don't know how to", what);
+		}
+
+		sim_actions.push_back(action);
+
+	}
+
+	if (depth) {
+		simError(lines.size(), "repeat without an end", 0);
+	}
+	*last = previous;
+	return lines.size();
+
+}
+
+static bool actionEarlier(const simAction &a, const simAction &b) {
+
+	return a.at < b.at;
+
+}
+
+// -- simReadTrace : Read a trace, ready to run. (It exits with a message if there's anything wrong with it.)
+
+void simReadTrace(const char *name, FILE *in) {
+
+	sim_trace_name = name;
+	sim_actions.clear();
+
+	std::vector<char *> lines;
+	char buffer[SIM_LINE];
+	while (fgets(buffer, sizeof(buffer), in)) {
+		lines.push_back(strdup(buffer));
+	}
+
+	unsigned long last;
+	parseLines(lines, 0, 0, 0, &last);
+	// Repeats and absolute times can land out of order, so put them in time order (keeping the order of ties.)
+	std::stable_sort(sim_actions.begin(), sim_actions.end(), actionEarlier);
+
+	for (unsigned int i = 0; i < lines.size(); i++) {
+		free(lines[i]);
+	}
+
+}
+
+// -- simTune : Have the run start with vOP::setTuning, by name. Returns false if there's no such name.
+// (It's checked against the TUNE_'s bounds when it runs, and exits with a message if it's out.)
+
+bool simTune(const char *name, unsigned int value) {
+
+	simAction action;
+	memset(&action, 0, sizeof(action));
+	action.kind = SIM_TUNE;
+	action.pin = findTuning(name);
+	action.tuning = value;
+	if (action.pin == TUNE_COUNT) {
+		return false;
+	}
+	sim_actions.insert(sim_actions.begin(), action);
+	return true;
+
+}
+
+// --------------------------------------------------------------------------
+// -- The timeline.
+
+static void printTime(unsigned long ms) {
+
+	printf("%3lud %02lu:%02lu:%02lu.%03lu  ", ms / 86400000UL, ms / 3600000UL % 24, ms / 60000UL % 60, ms / 1000UL % 60, ms % 1000UL);
+
+}
+
+// -- timeline : Start a line of the timeline, unless we're quiet. Returns whether to carry on printing it.
+
+static bool timeline(unsigned long at) {
+
+	if (sim_quiet) {
+		return false;
+	}
+	printTime(at);
+	return true;
+
+}
+
+static void printBytes(const byte *bytes, byte length) {
+
+	for (byte i = 0; i < length; i++) {
+		printf(" %u", bytes[i]);
+	}
+
+}
+
+static void printEvent(const simEvent &event) {
+
+	static const char *watchdog_states[] = {"watching", "shutting down", "booting", "idle"};
+
+	if (!timeline(event.time)) {
+		return;
+	}
+	printf("ch%u ", event.ch);
+	switch (event.type) {
+		case EVENT_IGNITION:
+			printf("ignition %s", event.arg ? "on" : "off");
+			break;
+		case EVENT_WATCHDOG:
+			printf("watchdog %s", event.arg < 4 ? watchdog_states[event.arg] : "?");
+			break;
+		case EVENT_SHUTDOWN_REQUESTED:
+			printf("shutdown requested");
+			break;
+		case EVENT_SHUTDOWN_CANCELLED:
+			printf("shutdown cancelled");
+			break;
+		case EVENT_SHUTDOWN_EXECUTED:
+			printf("shutdown executed");
+			break;
+		case EVENT_RELAY:
+			printf("relay %s", event.arg ? "on" : "off");
+			break;
+		case EVENT_SHUTDOWN_DUE:
+			printf("shutdown due");
+			break;
+		case EVENT_HALTED:
+			printf("halted, power cut (%s)", event.arg == HALT_BY_PIN ? "by pin" : "by command");
+			break;
+		case EVENT_IGNITION_DIP:
+			printf("ignition dipped for %u.%us", event.arg / 10, event.arg % 10);
+			break;
+		case EVENT_SUPPLY:
+			printf("supply %s", event.arg ? "low" : "back");
+			break;
+		default:
+			printf("event %u (%u)", event.type, event.arg);
+			break;
+	}
+	printf("\n");
+
+}
+
+// -- The hook: vOP can call it from inside a command, so just keep it for later.
+
+static void eventHook(byte type, byte arg, byte ch) {
+
+	simEvent event;
+	event.time = mock_millis();
+	event.type = type;
+	event.arg = arg;
+	event.ch = ch;
+	sim_events.push_back(event);
+
+}
+
+// --------------------------------------------------------------------------
+// -- The i2c, as the Pi does it.
+
+static byte sendCommand(byte op, byte p0, byte p1, byte *reply) {
+
+	const byte frame[] = {op, p0, p1};
+	const byte end_of_command[] = {SIM_END_OF_COMMAND};
+	mock_i2cWrite(vop, frame, sizeof(frame));
+	mock_i2cWrite(vop, end_of_command, sizeof(end_of_command));
+	return mock_i2cRead(vop, reply, 4);
+
+}
+
+// -- piCommand : One command, from the Pi on this channel. Returns the result.
+
+static unsigned int piCommand(byte ch, const char *what, byte op, unsigned int param) {
+
+	byte reply[4];
+	if (VOP_CHANNELS > 1) {
+		sendCommand(SIM_CMD_SELECT_CHANNEL, ch, 0, reply);
+	}
+	sendCommand(op, param & 0xFF, param >> 8, reply);
+	if (what && (sim_verbose || what[0] != '.') && timeline(mock_millis())) {
+		printf("ch%u pi %s", ch, what[0] == '.' ? what + 1 : what);
+		if (reply[0]) {
+			printf(" (error %u)", reply[0]);
+		}
+		printf("\n");
+	}
+	return (reply[2] << 8) | reply[3];
+
+}
+
+// --------------------------------------------------------------------------
+// -- The Pis.
+
+// -- piStep : It's time for the Pi to do its next thing.
+
+static void piStep(byte ch) {
+
+	simPi &pi = sim_pis[ch];
+	unsigned long now = mock_millis();
+	pi.next = SIM_NEVER;
+
+	switch (pi.state) {
+
+		case PI_BOOTING:
+			if (timeline(now)) {
+				printf("ch%u pi up\n", ch);
+			}
+			pi.state = PI_UP;
+			// It pats as soon as it's up.
+			// Fall through.
+
+		case PI_UP:
+			piCommand(ch, ".pats the watchdog", SIM_CMD_PAT_WATCHDOG, 0);
+			// And looks at the ignition.
+			if (piCommand(ch, ".polls the ignition", SIM_CMD_GET_IGNITION_STATE, 0)) {
+				if (pi.asked) {
+					piCommand(ch, "cancels the shutdown", SIM_CMD_CANCEL_SHUTDOWN, 0);
+					pi.asked = false;
+				}
+			} else if (!pi.asked && pi.settings[PI_SHUTDOWN]) {
+				char what[64];
+				snprintf(what, sizeof(what), "asks for a shutdown in %lus", pi.settings[PI_SHUTDOWN] / 1000);
+				piCommand(ch, what, SIM_CMD_REQUEST_SHUTDOWN_SECONDS, pi.settings[PI_SHUTDOWN] / 1000);
+				pi.asked = true;
+			}
+			pi.next = now + pi.settings[PI_PAT];
+			break;
+
+		case PI_HALTING:
+			piCommand(ch, "halted", SIM_CMD_HALTED, 0);
+			pi.state = PI_DOWN;
+			break;
+
+	}
+
+}
+
+// -- piEvent : What the Pi does about an event. (It hears about them straight away, like it would on the attention line.)
+
+static void piEvent(const simEvent &event) {
+
+	simPi &pi = sim_pis[event.ch];
+	unsigned long now = mock_millis();
+
+	if (event.type == EVENT_RELAY) {
+		pi.asked = false;
+		pi.hung = false;
+		pi.state = event.arg ? PI_BOOTING : PI_OFF;
+		pi.next = event.arg ? now + pi.settings[PI_BOOT] : SIM_NEVER;
+	} else if (event.type == EVENT_SHUTDOWN_DUE && pi.state == PI_UP && pi.settings[PI_HALT]) {
+		piCommand(event.ch, "halting", SIM_CMD_HALTING, 0);
+		pi.state = PI_HALTING;
+		pi.next = now + pi.settings[PI_HALT];
+	}
+
+	if (!pi.present) {
+		pi.next = SIM_NEVER;
+	}
+
+}
+
+// -- tally : Keep the summary's numbers.
+
+static void tally(const simEvent &event) {
+
+	simChannel &channel = sim_channels[event.ch];
+	switch (event.type) {
+		case EVENT_RELAY:
+			if (event.arg && !channel.relay) {
+				channel.relay_since = event.time;
+				channel.power_ups++;
+			} else if (!event.arg && channel.relay) {
+				channel.relay_total += event.time - channel.relay_since;
+				// Whose doing was it? (The watchdog only goes idle after it's cut the power.)
+				bool watchdog = channel.watchdog_state == SIM_WATCHDOG_SHUTDOWN || channel.watchdog_state == SIM_WATCHDOG_BOOTING;
+				if (channel.watchdog_state == SIM_WATCHDOG_SHUTDOWN) {
+					channel.watchdog_cuts++;
+				} else if (channel.watchdog_state == SIM_WATCHDOG_BOOTING) {
+					channel.boot_failures++;
+				}
+				// And did it need doing?
+				simPi &pi = sim_pis[event.ch];
+				if (pi.hung) {
+					if (event.time - pi.hung_at > channel.hang_latency) {
+						channel.hang_latency = event.time - pi.hung_at;
+					}
+				} else if (watchdog && pi.present) {
+					channel.needless_cuts++;
+				}
+			}
+			channel.relay = event.arg;
+			break;
+		case EVENT_WATCHDOG:
+			channel.watchdog_state = event.arg;
+			break;
+		case EVENT_IGNITION:
+			channel.latched = event.arg;
+			if (channel.latch_pending && channel.latched == sim_ignition) {
+				if (event.time - channel.changed_at > channel.ignition_latency) {
+					channel.ignition_latency = event.time - channel.changed_at;
+				}
+				channel.latch_pending = false;
+			}
+			break;
+		case EVENT_SHUTDOWN_EXECUTED:
+			channel.shutdowns++;
+			break;
+		case EVENT_HALTED:
+			channel.halts++;
+			break;
+	}
+
+}
+
+// -- account : Add up the driver's side of things, for a stretch of time where nothing changed.
+
+static void account(unsigned long length) {
+
+	for (byte ch = 0; ch < VOP_CHANNELS; ch++) {
+		simChannel &channel = sim_channels[ch];
+		simPi &pi = sim_pis[ch];
+		// Without a Pi, up is just powered.
+		bool up = pi.present ? pi.state == PI_UP : channel.relay;
+		if (sim_ignition && !up) {
+			channel.downtime += length;
+		}
+		if (channel.relay && !sim_ignition) {
+			channel.battery_time += length;
+		}
+	}
+
+}
+
+// -- dispatchEvents : Print what vOP recorded, and let the Pis act on it. (Which can record more.)
+
+static void dispatchEvents() {
+
+	for (unsigned int i = 0; i < sim_events.size(); i++) {
+		simEvent event = sim_events[i];
+		printEvent(event);
+		tally(event);
+		piEvent(event);
+	}
+	sim_events.clear();
+
+}
+
+// --------------------------------------------------------------------------
+// -- The script's own lines.
+
+static void runAction(const simAction &action) {
+
+	byte reply[MOCK_I2C_BUFFER];
+	byte length;
+
+	switch (action.kind) {
+
+		case SIM_IGNITION:
+			mock_setPin(PIN_IGNITION, action.value);
+			// Start the clock on how long vOP takes to see it. (Unless it's back where vOP has it.)
+			sim_ignition = action.value;
+			for (byte ch = 0; ch < VOP_CHANNELS; ch++) {
+				simChannel &channel = sim_channels[ch];
+				channel.latch_pending = sim_ignition != channel.latched;
+				channel.changed_at = action.at;
+			}
+			break;
+
+		case SIM_PIN:
+			mock_setPin(action.pin, action.value);
+			break;
+
+		case SIM_CMD:
+			length = sendCommand(action.bytes[0], action.bytes[1], action.bytes[2], reply);
+			if (timeline(action.at)) {
+				printf("i2c cmd");
+				printBytes(action.bytes, action.length);
+				printf(" ->");
+				printBytes(reply, length);
+				printf("\n");
+			}
+			break;
+
+		case SIM_WRITE:
+			mock_i2cWrite(vop, action.bytes, action.length);
+			if (timeline(action.at)) {
+				printf("i2c write");
+				printBytes(action.bytes, action.length);
+				printf("\n");
+			}
+			break;
+
+		case SIM_READ:
+			length = mock_i2cRead(vop, reply, action.value);
+			if (timeline(action.at)) {
+				printf("i2c read ->");
+				printBytes(reply, length);
+				printf("\n");
+			}
+			break;
+
+		case SIM_PI: {
+			simPi &pi = sim_pis[action.ch];
+			if (action.value == 3) {
+				for (byte s = 0; s < PI_SETTINGS; s++) {
+					if (action.settings[s] != SIM_NEVER) {
+						pi.settings[s] = action.settings[s];
+					}
+				}
+			} else if (action.value == 2) {
+				if (pi.state != PI_OFF) {
+					if (timeline(action.at)) {
+						printf("ch%u pi hangs\n", action.ch);
+					}
+					pi.state = PI_DOWN;
+					pi.next = SIM_NEVER;
+					pi.hung = true;
+					pi.hung_at = action.at;
+				}
+			} else {
+				pi.present = action.value;
+				pi.next = SIM_NEVER;
+				if (pi.present && pi.state != PI_OFF) {
+					// Powered all along, so it starts again from the top.
+					pi.state = PI_BOOTING;
+					pi.next = action.at + pi.settings[PI_BOOT];
+				}
+			}
+			break;
+		}
+
+		case SIM_MARK:
+			if (timeline(action.at)) {
+				printf("-- %s\n", action.text);
+			}
+			break;
+
+		case SIM_TUNE: {
+			byte error = vop.setTuning(action.pin, action.tuning);
+			if (error) {
+				// (Line 0 is one from simTune, not the trace.)
+				if (action.line) {
+					fprintf(stderr, "%s:%d: ", sim_trace_name, action.line);
+				} else {
+					fprintf(stderr, "%s: ", sim_trace_name);
+				}
+				fprintf(stderr, "can't tune %s to %u (error %u)\n", tuningName(action.pin), action.tuning, error);
+				exit(2);
+			}
+			if (timeline(action.at)) {
+				printf("tune %s %u\n", tuningName(action.pin), action.tuning);
+			}
+			break;
+		}
+
+	}
+
+}
+
+// --------------------------------------------------------------------------
+// -- The run.
+
+static void printDuration(unsigned long ms) {
+
+	printf("%lud %02lu:%02lu:%02lu", ms / 86400000UL, ms / 3600000UL % 24, ms / 60000UL % 60, ms / 1000UL % 60);
+
+}
+
+// -- simRun : Run the trace through vOP, from power on to the last line. Returns how long it ran (millis.)
+// Quiet leaves the timeline out, and just keeps count.
+
+unsigned long simRun(bool quiet, bool verbose) {
+
+	sim_quiet = quiet;
+	sim_verbose = verbose;
+	sim_ignition = false;
+	sim_events.clear();
+	for (byte ch = 0; ch < VOP_CHANNELS; ch++) {
+		simPi &pi = sim_pis[ch];
+		pi.present = true;
+		pi.settings[PI_BOOT] = 30000;
+		pi.settings[PI_PAT] = 10000;
+		pi.settings[PI_SHUTDOWN] = 60000;
+		pi.settings[PI_HALT] = 0;
+		pi.state = PI_OFF;
+		pi.next = SIM_NEVER;
+		pi.asked = false;
+		pi.hung = false;
+		memset(&sim_channels[ch], 0, sizeof(sim_channels[ch]));
+		sim_channels[ch].watchdog_state = SIM_WATCHDOG_IDLE;
+	}
+
+	// We move the clock, vOP's naps don't.
+	mock_setMillis(0);
+	mock_setSleepLimit(0);
+	vop.setEventHook(eventHook);
+	vop.setup();
+
+	unsigned long end = sim_actions.empty() ? 0 : sim_actions.back().at;
+	unsigned long now = 0;
+	unsigned int next_action = 0;
+	byte spins = 0;
+	sim_loops = 0;
+	sim_jumps = 0;
+
+	for (;;) {
+
+		// Everything that's due now: the script, then the Pis, then vOP.
+		while (next_action < sim_actions.size() && sim_actions[next_action].at <= now) {
+			runAction(sim_actions[next_action++]);
+			dispatchEvents();
+		}
+		for (byte ch = 0; ch < VOP_CHANNELS; ch++) {
+			if (sim_pis[ch].present && sim_pis[ch].next <= now) {
+				piStep(ch);
+				dispatchEvents();
+			}
+		}
+		vop.loop();
+		sim_loops++;
+		dispatchEvents();
+
+		if (next_action == sim_actions.size() && now >= end) {
+			break;
+		}
+
+		// And then straight on to whatever's next.
+		unsigned long target = end;
+		if (next_action < sim_actions.size()) {
+			target = sim_actions[next_action].at;
+		}
+		for (byte ch = 0; ch < VOP_CHANNELS; ch++) {
+			if (sim_pis[ch].present && sim_pis[ch].next < target) {
+				target = sim_pis[ch].next;
+			}
+		}
+		unsigned long wait = vop.nextDeadline();
+		if (wait != VOP_NO_DEADLINE && now + wait < target) {
+			target = now + wait;
+		}
+		if (target <= now) {
+			// Something's due right now, give loop() another go. But not forever.
+			if (++spins < SIM_SPINS) {
+				continue;
+			}
+			target = now + 1;
+		}
+		spins = 0;
+		account(target - now);
+		mock_advanceMillis(target - now);
+		now = target;
+		sim_jumps++;
+
+	}
+
+	// Anything still on counts up to the end.
+	for (byte ch = 0; ch < VOP_CHANNELS; ch++) {
+		simChannel &channel = sim_channels[ch];
+		if (channel.relay) {
+			channel.relay_total += now - channel.relay_since;
+		}
+	}
+	return now;
+
+}
+
+// -- simPrintSummary : What each channel made of it, two lines each: what vOP did, and how that
+// went for the driver.
+
+void simPrintSummary(unsigned long ran) {
+
+	printf("-- ");
+	printDuration(ran);
+	printf(" simulated\n");
+	for (byte ch = 0; ch < VOP_CHANNELS; ch++) {
+		simChannel &channel = sim_channels[ch];
+		printf("ch%u relay on ", ch);
+		printDuration(channel.relay_total);
+		printf(" (%.1f%%), %u power ups, %u requested shutdowns, %u halted early, %u watchdog cuts, %u failed boots\n",
+			ran ? channel.relay_total * 100.0 / ran : 0.0, channel.power_ups, channel.shutdowns, channel.halts,
+			channel.watchdog_cuts, channel.boot_failures);
+		printf("ch%u down ", ch);
+		printDuration(channel.downtime);
+		printf(" with the ignition on, on the battery ");
+		printDuration(channel.battery_time);
+		printf(", %u needless cuts, worst latency %lums ignition, %lums hang\n",
+			channel.needless_cuts, channel.ignition_latency, channel.hang_latency);
+	}
+
+}
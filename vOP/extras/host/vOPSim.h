@@ -0,0 +1,86 @@
+#ifndef vOPSim_h
+#define vOPSim_h
+
+// --------------------------------------------------------------------------
+// -- vOPSim: Replays days of a vehicle's life through vOP, in a blink. (vop_sim and vop_sweep.)
+// Runs vOP.cpp against the mock HAL, driven by a trace: when the ignition goes on and off,
+// what the Raspberry Pi does, and any i2c you want to script (or play back from a recording.)
+// Nothing ticks: the clock jumps straight to whatever's next, the next line of the trace, the
+// next thing a Pi does, or vOP's own next deadline (see vOP::nextDeadline), so a week of
+// commuting is over in a fraction of a second.
+//
+// vOP and the mock are globals, like the micro they stand in for, so it's one run per process.
+// (vop_sweep forks one for each.)
+//
+// -- The trace.
+// One thing per line: when, what, and what with. # to the end of the line is a comment.
+// When is from the start of the run, or with a + in front, from the line before. It's millis,
+// or numbers with units run together, d h m s ms: 1d7h30m, 45s, 250ms.
+//
+//   ignition on|off           Drive the ignition pin (PIN_IGNITION.)
+//   pin <pin> <0|1>           Drive any other pin.
+//   cmd <op> [p0 [p1]]        Send a command and its end-of-command, and read the reply back.
+//   write <byte>...           Or just write these bytes...
+//   read <count>              ...and read this many. (Bytes are decimal, or hex with 0x.)
+//   tune <name> <value>       vOP::setTuning, by name (see sim_tunings in vOPSim.cpp), in the
+//                             TUNE_'s own units: watchdog_timeout 30, debounce_interval 20.
+//   pi [ch<n>] <setting> <time>...
+//                             How the Pi on a channel behaves (defaults in brackets): how long
+//                             it takes to boot [30s], how often it pats the watchdog and polls
+//                             the ignition [10s], how long after the ignition goes off it asks for
+//                             a shutdown (0 never) [60s], and how long it takes to halt once
+//                             the shutdown's due (0 if it doesn't tell us) [0]. e.g.
+//                             pi boot 45s pat 5s shutdown 2m halt 8s
+//   pi [ch<n>] off|on         Take the Pi out altogether (nothing pats), or put it back.
+//   pi [ch<n>] hang           It hangs where it is, until the power's cut.
+//   mark <text>               Put a line in the timeline.
+//   repeat <count> every <time>
+//   ...
+//   end                       The lines in between, count times, every so often. Their times
+//                             are from the start of each repeat, and a + after the end is from
+//                             the end of the last one.
+//
+// The run ends at the last line, so finish with a mark if you want it to carry on past the last change.
+
+#include <stdio.h>
+
+#include "vOP.h"
+
+// -- What happened to each channel, by the end of the run.
+// The driver's side of it (downtime, battery, latency) is measured against the ignition lines
+// of the trace, as they were, not as vOP saw them.
+
+struct simChannel {
+	// What vOP did.
+	unsigned long relay_total;			// How long the relay was on, all told (millis.)
+	unsigned int power_ups;
+	unsigned int shutdowns;				// Requested shutdowns that came due.
+	unsigned int halts;					// And Pis that halted first.
+	unsigned int watchdog_cuts;			// The watchdog took the power away.
+	unsigned int boot_failures;			// It never patted after a power up.
+	// And how that went for the driver.
+	unsigned long downtime;				// The ignition was on, and the Pi wasn't up (millis.)
+	unsigned long battery_time;			// The relay was on, with the ignition off (millis.)
+	unsigned int needless_cuts;			// Watchdog cuts (and failed boots) of a Pi that hadn't hung.
+	unsigned long ignition_latency;		// The longest from the ignition changing, to vOP latching it (millis.)
+	unsigned long hang_latency;			// The longest from a Pi hanging, to its power being cut (millis.)
+
+	// Keeping track, along the way.
+	unsigned long relay_since;			// When the relay last went on, while it's on.
+	bool relay;
+	byte watchdog_state;
+	bool latched;						// The ignition, as vOP last latched it.
+	bool latch_pending;					// The ignition's changed, and vOP hasn't latched it yet...
+	unsigned long changed_at;			// ...since.
+};
+
+extern simChannel sim_channels[VOP_CHANNELS];
+extern unsigned long sim_loops;			// loop() calls, in the last run.
+extern unsigned long sim_jumps;			// And how often the clock jumped.
+
+void simReadTrace(const char *name, FILE *in);
+bool simTune(const char *name, unsigned int value);
+unsigned long simRun(bool quiet, bool verbose);
+void simPrintSummary(unsigned long ran);
+
+#endif
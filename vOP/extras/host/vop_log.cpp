@@ -0,0 +1,133 @@
+// --------------------------------------------------------------------------
+// -- vop_log: Turns vOP's binary log (see vOPLog.h) back into words.
+// Feed it the bytes exactly as they came out of the serial port, or out of the CMD_READ_LOG
+// reads with their 4 byte headers taken off, and it prints a line for each record.
+// The times are millis() on the micro, put back together from the LOG_TIME records. If you
+// started listening after the last one, they're worked out from the first record instead, and
+// are only right if no two records are more than 65 seconds apart, until the next LOG_TIME.
+//
+// Usage: ./vop_log [file]   (stdin if there's no file, so: cat /dev/ttyUSB0 | ./vop_log)
+
+#include <stdio.h>
+#include <string.h>
+
+#include "vOPLog.h"
+
+// -- The words for each message. %u for each of its numbers, in order.
+// Keep these in step with the LOG_ IDs in vOPLog.h.
+
+struct logFormat {
+	byte id;
+	const char *format;
+};
+
+static const logFormat log_formats[] = {
+	{LOG_DROPPED, "%u records didn't fit in the log"},
+	{LOG_STARTED, "Application started (reset kind %u)"},
+	{LOG_POWER_ON, "Channel %u: turning raspberry pi on!"},
+	{LOG_POWER_OFF, "Channel %u: shutting down raspberry pi"},
+	{LOG_SHUTDOWN_EXECUTED, "Channel %u: performing requested shutdown"},
+	{LOG_HALT_CUT, "Channel %u: pi halted, cutting the power"},
+	{LOG_WATCHDOG_CHECK, "Channel %u: checking watchdog, state %u"},
+	{LOG_WATCHDOG_FAILED, "Channel %u: watchdog pats failed, moving into shutdown mode"},
+	{LOG_WATCHDOG_SHUTDOWN, "Channel %u: issuing shutdown due to watchdog pats"},
+	{LOG_BOOT_FAILED, "Channel %u: boot failed, no watchdog pats in %us, reboot starting (if ignition up)"},
+	{LOG_SUPPLY_LOW, "Channel %u: supply's low (%umV), shutting down"},
+	{LOG_IGNITION, "Channel %u: ignition %u"},
+	{LOG_IGNITION_DIP, "Channel %u: ignition dipped for %ums"},
+};
+
+#define LOG_FORMATS (sizeof(log_formats) / sizeof(log_formats[0]))
+
+static const char *formatFor(byte id) {
+
+	for (unsigned int i = 0; i < LOG_FORMATS; i++) {
+		if (log_formats[i].id == id) {
+			return log_formats[i].format;
+		}
+	}
+	return 0;
+
+}
+
+// -- printRecord : One record, and when it was (in seconds of millis(), as far as we could work it out.)
+
+static void printRecord(const byte *record, unsigned long millis) {
+
+	byte id = record[0] & LOG_ID_MASK;
+	byte args = record[0] >> LOG_ARGS_SHIFT;
+	unsigned int values[3] = {0, 0, 0};
+	for (byte i = 0; i < args; i++) {
+		values[i] = (record[LOG_HEADER_SIZE + i * 2] << 8) | record[LOG_HEADER_SIZE + i * 2 + 1];
+	}
+
+	printf("%8lu.%03lu  ", millis / 1000, millis % 1000);
+	const char *format = formatFor(id);
+	if (format) {
+		printf(format, values[0], values[1], values[2]);
+	} else {
+		printf("Unknown message %u:", id);
+		for (byte i = 0; i < args; i++) {
+			printf(" %u", values[i]);
+		}
+	}
+	printf("\n");
+
+}
+
+int main(int argc, char **argv) {
+
+	FILE *in = stdin;
+	if (argc > 1) {
+		in = fopen(argv[1], "rb");
+		if (!in) {
+			perror(argv[1]);
+			return 1;
+		}
+	}
+
+	byte record[LOG_HEADER_SIZE + 6];
+	unsigned int have = 0;
+	bool started = false;
+	unsigned int last_stamp = 0;
+	unsigned long millis = 0;
+	int c;
+
+	while ((c = fgetc(in)) != EOF) {
+		record[have++] = c;
+		if (have < LOG_HEADER_SIZE || have < (unsigned int)LOG_RECORD_SIZE(record[0])) {
+			continue;
+		}
+
+		unsigned int stamp = (record[1] << 8) | record[2];
+		have = 0;
+
+		// The high half of the time, which only the decoder needs to see.
+		if ((record[0] & LOG_ID_MASK) == LOG_TIME && (record[0] >> LOG_ARGS_SHIFT) == 1) {
+			millis = ((unsigned long)((record[3] << 8) | record[4]) << 16) | stamp;
+			started = true;
+			last_stamp = stamp;
+			continue;
+		}
+
+		// Otherwise, unwrap the 16 bit millis, assuming it hasn't gone all the way round since the last one.
+		if (!started) {
+			millis = stamp;
+			started = true;
+		} else {
+			millis += (unsigned int)((stamp - last_stamp) & 0xFFFF);
+		}
+		last_stamp = stamp;
+
+		printRecord(record, millis);
+	}
+
+	if (have) {
+		fprintf(stderr, "vop_log: %u bytes of a record left over at the end\n", have);
+	}
+	if (in != stdin) {
+		fclose(in);
+	}
+	return 0;
+
+}
@@ -12,10 +12,7 @@
 // ------------------------------------------ -
 // -- Pin Definitions!                   --- -
 // ---------------------------------------- -
-
-#define PIN_RASPI_RELAY 3
-#define PIN_IGNITION 2
-#define PIN_DEBUG_LED 13
+// PIN_RASPI_RELAY, PIN_IGNITION and PIN_DEBUG_LED live in vOPConfig.h, with the rest of the build settings.
 
 // ------------------------------------------ -
 // -- Command Buffer & Command variables --- -
@@ -31,6 +28,15 @@
 #define MAX_COMMAND_PARAMETERS 3
 #define END_OF_COMMAND 10
 
+// -- Batched commands.
+// To save round trips, several commands can go in one write, and all of their results come back in one read.
+// 1st Byte: CMD_BATCH
+// 2nd Byte: N, the number of commands (up to BATCH_MAX_COMMANDS)
+// Then N times: the command, and its two parameter bytes.
+// And then the 0x0A, same as always.
+// The read returns N results of 4 bytes each (error, command, result, result), in order.
+// BATCH_MAX_COMMANDS keeps both the write and the read inside the 32 byte Wire buffer.
+
 // ------------------------------------------ -
 // -- Command definitions ------------------ -
 // ---------------------------------------- -
@@ -49,6 +55,34 @@
 #define CMD_REQUEST_SHUTDOWN_MINUTES 19
 #define CMD_GET_SHUTDOWN_STATE 20
 #define CMD_CANCEL_SHUTDOWN 21
+#define CMD_SET_SLEEP 22
+#define CMD_GET_SLEEP_MINUTES 23
+#define CMD_GET_AWAKE_MINUTES 24
+#define CMD_GET_INPUTS 25
+#define CMD_BATCH 26
+#define CMD_READ_REGISTERS 27
+#define CMD_SET_DEFERRED 28
+#define CMD_GET_QUEUE_STATS 29
+#define CMD_GET_ISR_MICROS 30
+#define CMD_TAGGED 31
+#define CMD_FETCH_TAG 32
+#define CMD_GET_EVENTS 33
+#define CMD_READ_JOURNAL 34
+#define CMD_SET_ATTENTION 35
+#define CMD_READ_STATS 36
+#define CMD_SELECT_CHANNEL 37
+#define CMD_GET_TUNING 38
+#define CMD_SET_TUNING 39
+#define CMD_RESET_TUNING 40
+#define CMD_GET_BOOT_STATS 41
+#define CMD_RESET_BOOT_STATS 42
+#define CMD_HALTING 43
+#define CMD_HALTED 44
+#define CMD_GET_DIP_STATS 45
+#define CMD_GET_RESET_STATS 46
+#define CMD_GET_SUPPLY 47
+#define CMD_READ_SUPPLY 48
+#define CMD_READ_LOG 49
 
 #define CMD_DEBUG_SET_IGN_DETECT 100
 #define CMD_DEBUG_SET_IGN_STATE 101
@@ -56,6 +90,151 @@
 #define CMD_DEBUG_GET_TEST_VALUE 103
 #define CMD_DEBUG_GET_WDT_STATE 104
 
+// -- Tagged commands.
+// So several processes on the Pi can share the bus, a command can carry a tag of your choosing.
+// 1st Byte: CMD_TAGGED
+// 2nd Byte: The tag.
+// 3rd Byte: The command.
+// 4th, 5th Bytes: Its two parameters.
+// And then the 0x0A. The result is kept under the tag: write CMD_FETCH_TAG with the tag as
+// the first parameter (or just read straight after the CMD_TAGGED), and read 5 bytes back:
+// the tag, then the error, command and two result bytes, as usual.
+
+// -- The event feed.
+// Rather than polling for changes, the Pi can ask for everything that happened since the last
+// event it saw. Write CMD_GET_EVENTS with the last sequence number you have as the parameter
+// (first byte low, 0 to start), and read back up to 28 bytes:
+// 1st Byte: The error, as usual.
+// 2nd Byte: CMD_GET_EVENTS
+// 3rd Byte: How many events follow (up to EVENTS_PER_READ.)
+// 4th Byte: Flags. EVENTS_MISSED if some fell out of the ring before you asked (or we restarted),
+//           EVENTS_MORE if there are more after these.
+// Then each event, 8 bytes: sequence (2), type, argument, and the millis() it happened (4), high bytes first.
+
+#define EVENTS_PER_READ 3
+#define EVENTS_MISSED 1
+#define EVENTS_MORE 2
+
+// -- The journal.
+// Every power cycle of the Pi, and why, is kept in EEPROM (see vOPJournal.h, and VOP_JOURNAL.) To dump it, write
+// CMD_READ_JOURNAL (no parameters), then keep reading 32 bytes at a time. Each read is up to 4 whole
+// records, oldest first, and the end is a record of all 0xFF (which never passes the check byte.)
+// Writes to the EEPROM wait while a dump is going, so what you read doesn't move under you.
+
+// -- The attention line.
+// If the sketch gives us a pin with setAttentionPin(), we pull it low (open drain, the Pi provides
+// the pull-up) whenever an event in the attention mask lands in the feed, and let it go again
+// once the Pi has read the feed up to the newest event. So the Pi can wait on the falling edge
+// instead of polling. CMD_SET_ATTENTION sets the mask (first parameter, ATTENTION_ bits below)
+// and returns the one it had.
+
+// -- The stats.
+// Only when built with VOP_INSTRUMENT (see vOPInstrument.h), otherwise it's ERR_COMMAND_UNKNOWN.
+// Write CMD_READ_STATS (first parameter 1 to zero everything as it's read), then keep reading
+// 32 bytes at a time, 16 bit values high byte first:
+// A header of 6 bytes: STATS_VERSION, STATS_HISTOGRAMS, HISTOGRAM_BUCKETS, STATS_ERRORS, STATS_COMMANDS, CMD_FIRST.
+// Then the buckets of each histogram (STATS_ in vOP.h), the error counters by code, and the
+// command counters by opcode from CMD_FIRST. Reads past the end come back empty.
+
+#define STATS_VERSION 1
+#define STATS_HEADER_SIZE 6
+
+// -- Channels.
+// With VOP_CHANNELS above 1, write CMD_SELECT_CHANNEL with the channel as the first parameter,
+// and every command after it acts on that channel (it sends back the one that was selected.)
+// Commands that aren't about a computer (sleep, inputs, stats and so on) don't care.
+// The selection sticks, so if more than one process on the Pi talks to us, put the select and
+// its commands in one CMD_BATCH, which runs in one go.
+
+// -- Tuning.
+// The timings (TUNE_ in vOP.h) can be changed on the fly, and they're saved in EEPROM, so they
+// come back after a reset. Write CMD_GET_TUNING with the TUNE_ as the first parameter, and it
+// sends back its value, and selects it. Then CMD_SET_TUNING (value first byte low) sets the selected
+// one, and sends back what it is now. Anything outside its tuning_bounds (below) is ERR_TUNING_RANGE, and
+// a timing built in with VOP_FIXED_TIMING is ERR_TUNING_FIXED. CMD_RESET_TUNING puts them all back
+// to the defaults. Like the channel, put a get and its set in one CMD_BATCH if anyone else is talking.
+
+#define TUNING_VERSION 3
+
+// -- Boot learning.
+// We time every boot, from the relay going on to the first pat, and keep a smoothed mean and
+// deviation of them for each channel (see learnBootTime.) Once we've seen a few, a boot that
+// runs past the mean plus BOOT_LEARN_DEVIATIONS deviations (and BOOT_LEARN_MARGIN) is taken as
+// hung, instead of waiting out all of watchdog_boot_interval, which becomes the ceiling.
+// They're saved in EEPROM, so they outlive a reset. CMD_GET_BOOT_STATS with a BOOT_STAT_ (vOP.h)
+// as the first parameter sends one back for the selected channel, and CMD_RESET_BOOT_STATS
+// forgets that channel's, and starts learning again.
+
+#define BOOT_STATS_VERSION 1
+
+// -- Halting.
+// A shutdown (requested, or from the watchdog) waits out its full delay, though the Pi is usually
+// down long before. So the Pi can tell us: CMD_HALTING when it starts shutting down, and
+// CMD_HALTED as the very last thing it does (from a systemd-shutdown hook, say, once the disks are
+// read only.) We cut the power HALT_GRACE_INTERVAL after CMD_HALTED. Or give the channel a pin with
+// setHaltPin() (a gpio-poweroff pin, or the Pi's TX going quiet) and once it's announced halting,
+// or a shutdown is on the way, we cut the power as soon as that pin has shown the halt for long enough.
+// The timeouts stay, as the longest we'll wait. Both act on the selected channel.
+
+// -- Ignition dips.
+// With a hold-off (TUNE_IGNITION_HOLDOFF), an ignition that comes back before the hold-off is up
+// never turns off as far as the rest of vOP is concerned: it's an EVENT_IGNITION_DIP, and counted.
+// CMD_GET_DIP_STATS sends them back for the selected channel: the first parameter is the DIP_STAT_
+// (vOP.h) you want, and a second parameter of 1 zeroes them all after reading.
+
+// -- Resets.
+// If the micro resets (a brown out, or the AVR's watchdog), the relay pin lets go and setup() used
+// to start everything from scratch, which cut the Pi's power. Now loop() keeps the warm state
+// (vOP.h) in RAM that a reset leaves alone, with WARM_STATE_MAGIC and a CRC on it, and setup()
+// picks up from there: the relay stays as it was, and so do the watchdog, the shutdown requests and
+// the halts. If RAM didn't survive, the EEPROM knows which channels were on, and those that still
+// have their ignition on are kept on (their watchdog starts over, as if they'd just booted.)
+// CMD_GET_RESET_STATS sends back a RESET_STAT_ (vOP.h, first parameter), and a second parameter
+// of 1 zeroes the counts after reading.
+
+#define WARM_STATE_MAGIC 0x7E5A
+#define RESET_STATS_VERSION 1
+
+// -- The supply.
+// Only when built with VOP_SUPPLY (see vOPSupply.h), and given a pin with setSupplyPin(), otherwise
+// it's ERR_COMMAND_UNKNOWN. CMD_GET_SUPPLY sends back a SUPPLY_STAT_ (vOP.h, first parameter) in
+// millivolts, and a second parameter of 1 starts the minimum over. It's in the status block too.
+// If it stays under TUNE_SUPPLY_CUTOFF for VOP_SUPPLY_HOLD, every Pi that's on gets a shutdown request
+// SUPPLY_SHUTDOWN_DELAY out (unless it has a sooner one), the same as if it had asked, and none come
+// back on until it's SUPPLY_HYSTERESIS over the cutoff again.
+// To stream the readings (one every SUPPLY_INTERVAL), write CMD_READ_SUPPLY with the last sequence
+// number you have (first byte low, 0 to start), like the event feed, and read back:
+// 1st Byte: The error, as usual.
+// 2nd Byte: CMD_READ_SUPPLY
+// 3rd Byte: How many readings follow (up to SUPPLY_PER_READ.)
+// 4th Byte: Flags, SUPPLY_MISSED and SUPPLY_MORE (vOPSupply.h.)
+// 5th, 6th Bytes: The sequence number of the newest reading.
+// Then the readings, two bytes each, in millivolts, high byte first.
+
+#define SUPPLY_PER_READ 13
+
+// -- The log.
+// Only when built with VOP_LOG (see vOPLog.h), otherwise it's ERR_COMMAND_UNKNOWN. What we're doing
+// goes into a ring as binary records (a message ID and its numbers, the words are on the host), and
+// from there out of the serial port once the sketch calls setLogSerial(). Or over i2c: write
+// CMD_READ_LOG (no parameters), and read back up to 32 bytes, which takes them off the ring:
+// 1st Byte: The error, as usual.
+// 2nd Byte: CMD_READ_LOG
+// 3rd Byte: How many bytes of records follow (only whole records, up to LOG_PER_READ.)
+// 4th Byte: Flags, LOG_MORE if there are more after these.
+// Then the records, just as they'd have gone out of the serial port. extras/host/vop_log decodes them.
+
+#define LOG_PER_READ 28
+#define LOG_MORE 1
+
+// The ends of each block of commands, for the dispatch table.
+#define CMD_FIRST CMD_GET_IGNITION_STATE
+#define CMD_LAST CMD_READ_LOG
+#define CMD_DEBUG_FIRST CMD_DEBUG_SET_IGN_DETECT
+#define CMD_DEBUG_LAST CMD_DEBUG_GET_WDT_STATE
+
+// Commands CMD_USER_FIRST to CMD_USER_LAST are for your sketch. (see vOPCommands.h)
+
 // ------------------------------------------ -
 // -- Error Definitions -------------------- -
 // ---------------------------------------- -
@@ -65,7 +244,80 @@
 #define ERR_BUFFER_OVERFLOW 1
 #define ERR_COMMAND_UNKNOWN 2
 #define ERR_COMMAND_INCOMPLETE 3
+#define ERR_REGISTER_RANGE 4
+#define ERR_QUEUE_FULL 5
+#define ERR_RESULT_PENDING 6
+#define ERR_TAG_UNKNOWN 7
+#define ERR_CHANNEL_RANGE 8
+#define ERR_TUNING_RANGE 9
+#define ERR_TUNING_FIXED 10
+#define ERR_SHUTDOWN_RANGE 11
+
+
+// ------------------------------------------ -
+// -- Status Registers --------------------- -
+// ---------------------------------------- -
+// Everything the Pi usually polls for, mirrored into one block it can read in one go.
+// Write CMD_READ_REGISTERS with the register to start at and how many bytes each read gets (0 for all),
+// then every read returns that many bytes and moves the pointer along (wrapping at the end.)
+// Two byte registers are high byte first, like the command results.
+// The block is rebuilt by loop() and swapped in whole, so a read never sees half an update.
+// The single registers are for the first channel, the channel ones have a bit for every channel.
+
+#define STATUS_BLOCK_VERSION 4
+
+#define REG_VERSION 0
+#define REG_SEQUENCE 1 					// Bumped on every refresh.
+#define REG_IGNITION_STATE 2
+#define REG_WATCHDOG_MODE 3
+#define REG_WATCHDOG_STATE 4
+#define REG_SHUTDOWN_STATE 5
+#define REG_POWER_STATE 6 				// Is the raspberry pi relay on?
+#define REG_INPUTS 7 					// The debounced inputs, as CMD_GET_INPUTS.
+#define REG_IGNITION_CHANGE_SECONDS 8 	// (2 bytes) As CMD_GET_LAST_IGNITION_CHANGE_SECONDS.
+#define REG_SHUTDOWN_SECONDS 10 		// (2 bytes) Seconds left on a requested shutdown, 0 if none.
+#define REG_WATCHDOG_PAT_SECONDS 12 	// (2 bytes) Seconds since the last watchdog pat.
+#define REG_EVENT_SEQUENCE 14 			// (2 bytes) The newest event's sequence number.
+#define REG_CHANNEL_POWER 16 			// Which channels' relays are on.
+#define REG_CHANNEL_IGNITION 17 		// Which channels' ignitions are on.
+#define REG_SUPPLY_MILLIVOLTS 18 		// (2 bytes) The supply voltage, filtered. (0 if we're not measuring it.)
+
+#define STATUS_REFRESH_INTERVAL 1000 	// Seconds tick over, so we refresh at least this often (millis.)
+
+// ------------------------------------------ -
+// -- Event Definitions -------------------- -
+// ---------------------------------------- -
+// The EVENT_ types are in vOP.h, so the sketch can see them too (see setEventHook.)
+// The type goes in the low nibble of the type byte, and the channel in the high one.
+
+#define SHUTDOWN_WARNING_INTERVAL 10000 // How long before a requested shutdown we warn the Pi (millis.)
+#define SHUTDOWN_MAX_DELAY 0x7FFFFFFFUL // The furthest off a shutdown can be (millis, 24.8 days), or the scheduler takes it for overdue.
+#define SLEEP_MAX_NAP 60000UL			// The longest we nap in one go (millis), micros() would roll over in 71 minutes.
+
+// Which events assert the attention line.
+#define ATTENTION_IGNITION 1 			// The ignition latched.
+#define ATTENTION_SHUTDOWN_DUE 2 		// A requested shutdown is due soon.
+#define ATTENTION_WATCHDOG_SHUTDOWN 4 	// The watchdog missed its pats, and is counting down to a shutdown.
+#define ATTENTION_RELAY 8 				// The raspberry pi relay switched.
+#define ATTENTION_SUPPLY 16 			// The supply went under the cutoff, or came back.
+#define ATTENTION_DEFAULT (ATTENTION_IGNITION | ATTENTION_SHUTDOWN_DUE | ATTENTION_WATCHDOG_SHUTDOWN | ATTENTION_SUPPLY)
+
+// ------------------------------------------ -
+// -- Journal Definitions ------------------ -
+// ---------------------------------------- -
+// The causes a journal record can have.
+
+#define JOURNAL_RESET 1 				// We (the micro) started up.
+#define JOURNAL_POWER_ON 2 				// We turned the raspberry pi on.
+#define JOURNAL_SHUTDOWN_REQUESTED 3 	// A requested shutdown came due, and we cut the power.
+#define JOURNAL_WATCHDOG_TIMEOUT 4 		// The watchdog pats stopped, and we cut the power.
+#define JOURNAL_BOOT_FAILED 5 			// It never patted the watchdog after booting, and we cut the power.
+#define JOURNAL_IGNITION_OFF 6 			// The ignition went off.
+#define JOURNAL_HALTED 7 				// The Pi halted, and we cut the power early.
+#define JOURNAL_WARM_RESET 8 			// We (the micro) restarted, and kept the raspberry pi on.
+#define JOURNAL_SUPPLY_LOW 9 			// The supply ran low, so we asked the raspberry pi to shut down.
 
+#define EEPROM_WRITE_INTERVAL 4 		// An EEPROM byte takes 3.3ms to write, so we look back this often (millis.)
 
 // ----------------------------------------- -
 // -- Ignition Debounce Definition -------- -
@@ -73,8 +325,9 @@
 // used in debounceIgnition()
 // defines the retry interval, and sequential successes to consider a digital pin change
 
-#define CHECK_IGNITION_INTERVAL 50 				// We check for the ignition this many millis.
+#define CHECK_IGNITION_INTERVAL 50 				// We check for the ignition this many millis. (until it's tuned)
 #define CHECK_IGNITION_RETRIES 3 				// How many times in a row does the ignition have to match?
+#define CHECK_IGNITION_DEPTH (CHECK_IGNITION_RETRIES + 1)	// The first differing sample, plus the matches after it.
 
 // ----------------------------------------- -
 // -- WdT State Definitions --------------- -
@@ -85,14 +338,91 @@
 #define WATCHDOG_STATE_BOOTING 2
 #define WATCHDOG_STATE_IDLE 3
 
-#define SERIAL_ON 0
+// ----------------------------------------- -
+// -- Boot Learning Definitions ----------- -
+// --------------------------------------- -
+
+#define BOOT_LEARN_MIN_SAMPLES 3 		// How many boots we see before we trust what we've learned.
+#define BOOT_LEARN_DEVIATIONS 4 		// How many deviations past the mean a boot can run.
+#define BOOT_LEARN_MARGIN 5000 			// And a little more on top, for luck (millis.)
+#define BOOT_LEARN_FLOOR 10000 			// However quick they've been, never less than this (millis.)
+
+// ----------------------------------------- -
+// -- Halt Definitions -------------------- -
+// --------------------------------------- -
+
+#define HALT_GRACE_INTERVAL 2000 		// After CMD_HALTED, how long the Pi has to finish halting (millis.)
+#define HALT_POLL_INTERVAL 50 			// How often we look at the halt pins, while we're waiting on them (millis.)
+
+// ----------------------------------------- -
+// -- Supply Definitions ------------------ -
+// --------------------------------------- -
+
+#define SUPPLY_INTERVAL 250 			// How often we take a reading (millis.)
+#define SUPPLY_HYSTERESIS 500 			// How far over the cutoff it has to get back to, before the Pis can come on again (millivolts.)
+#define SUPPLY_SHUTDOWN_DELAY 30000UL 	// How long the Pis get to shut down, when it runs low (millis.)
+
+// The instrumentation hooks, which vanish when VOP_INSTRUMENT is off.
+#if VOP_INSTRUMENT
+#define STATS_START(var) uint32_t var = vop_hal_micros()
+#define STATS_TIME(histogram, var) stats_histograms[histogram].add(vop_hal_micros() - var)
+#define STATS_ERROR(error) countError(error)
+#define STATS_COMMAND(cmd) countCommand(cmd)
+#else
+#define STATS_START(var)
+#define STATS_TIME(histogram, var)
+#define STATS_ERROR(error)
+#define STATS_COMMAND(cmd)
+#endif
 
 // --------------------------------------------------------------------------
 // vOP::vOP : The constructor.
 
 #include "vOP.h"
-#include "Arduino.h"
-#include <Wire.h>
+#include "vOPHal.h"
+
+// ----------------------------------------- -
+// -- Tuning Bounds ----------------------- -
+// --------------------------------------- -
+// The least and most each TUNE_ can be set to, in its own units.
+
+static const unsigned int tuning_bounds[TUNE_COUNT][2] PROGMEM = {
+	{ 5, 3600 },			// TUNE_WATCHDOG_TIMEOUT
+	{ 1, 3600 },			// TUNE_WATCHDOG_TURNOFF
+	{ 1, 60 },				// TUNE_WATCHDOG_RUN
+	{ 10, 3600 },			// TUNE_WATCHDOG_BOOT
+	{ 1, 600 },				// TUNE_POWER_MINIMUM_OFF
+	{ 0, 60000 },			// TUNE_POWER_ON_STAGGER
+	{ 5, 1000 },			// TUNE_DEBOUNCE_INTERVAL
+	{ 1, DEBOUNCE_MAX_DEPTH },	// TUNE_DEBOUNCE_ON_DEPTH
+	{ 0, 60000 },			// TUNE_IGNITION_HOLDOFF
+	{ 1, DEBOUNCE_MAX_DEPTH },	// TUNE_DEBOUNCE_OFF_DEPTH
+	{ 0, 30000 }			// TUNE_SUPPLY_CUTOFF
+};
+
+// Who the ignition pin interrupts tell, so a sleeping loop() knows to start debouncing.
+// (The pins are the micro's, so there's only one of these.)
+static vOP *ignition_sink = 0;
+
+void vOP::ignitionEdge() {
+	ignition_sink->ignition_edge = 1;
+	ignition_sink->sleep_woken = 1;
+}
+
+#if VOP_SUPPLY
+// Where the ADC interrupt adds its results. (There's only one ADC, so there's only one of these.)
+static vOPSupply *supply_sink = 0;
+
+static void supplySample(unsigned int value) {
+	supply_sink->add(value);
+}
+#endif
+
+// Who the i2c events go to. (There's only one bus, so there's only one of these.)
+static vOP *i2c_sink = 0;
+
+// What we carry through a reset. (See saveWarmState.)
+vOPWarmState vop_warm_state VOP_NOINIT;
 
 
 vOP::vOP() {
@@ -105,6 +435,9 @@ vOP::vOP() {
 	
 	debug_ign_debounce = 1;			// Turns off ignition detection, only useful for debugging.
 	test = 1;						// I keep a test variable around for development.
+#if VOP_LOG
+	log_drain = 0;					// The log stays in the ring until setLogSerial(), or it's read over i2c.
+#endif
 
 	// -- Error variables --------------------------------------------------------------
 	error_flag = 0; 	// Denotes an error
@@ -112,17 +445,149 @@ vOP::vOP() {
 
 	// -- Command and buffer variables -------------------------------------------------
 	command = 1;			// The issued command.
-	param_buffer[2];		// The two posible bytes for the command parameters.
+	param_buffer[0] = 0;	// The two posible bytes for the command parameters.
+	param_buffer[1] = 0;
 	command_complete = 1;	// Did we finish getting the command?
+	batch_count = 0;		// How many commands are in the batch?
+	batch_length = 0;		// And how many of their bytes did we get?
 
-	// -- Stateful Device Information ---------------------------------------------------
-	ignition_state = false; 			// 0 = off, 1 = on.
-	ignition_delta_time = 0;			// The time when the ignition was last changed.
-	raspberry_power = false;			// State of Raspberry Pi Power (0 = off, 1 = on)
+	// -- Status register variables ----------------------------------------------------
+	for (byte i = 0; i < STATUS_BLOCK_SIZE; i++) {
+		status_block[0][i] = 0;
+		status_block[1][i] = 0;
+	}
+	status_front = 0;		// Which copy of the block the Pi reads from.
+	status_sequence = 0;	// Bumped on every refresh.
+	register_pointer = 0;	// Where the next register read starts.
+	register_length = 0;	// And how many bytes it gets.
+
+	// -- Deferred command variables ---------------------------------------------------
+	deferred_mode = false;	// Off, commands run in the i2c interrupt like they always have.
+	queue_head = 0;			// Where receiveData() puts the next command.
+	queue_tail = 0;			// Where loop() takes the next one from.
+	queued_frame = 0;		// Numbers each command (or batch) we queue.
+	queue_high_water = 0;	// The deepest the ring has been.
+	queue_overflows = 0;	// Commands turned away because it was full.
+	response_front = 0;		// Which response slot is published.
+	for (byte i = 0; i < 2; i++) {
+		responses[i].frame = 0;
+		responses[i].length = 0;
+	}
+	isr_max_micros = 0;		// The longest we've spent in an i2c event.
+
+	// -- Tagged command variables -----------------------------------------------------
+	for (byte i = 0; i < TAGGED_RESULTS; i++) {
+		tagged_results[i].state = TAG_EMPTY;
+	}
+	tagged_next = 0;		// The slot we hand out next, oldest first.
+
+	// -- Event feed variables ---------------------------------------------------------
+	event_sequence = 0;		// The newest event's number (the first is 1.)
+	event_head = 0;			// Where the next event goes.
+	event_count = 0;		// How many the ring holds.
+	event_hook = 0;			// Nobody's listening, until setEventHook.
+
+	// -- Attention line variables -----------------------------------------------------
+	attention_pin = ATTENTION_PIN_NONE;	// None, until the sketch gives us one.
+	attention_mask = ATTENTION_DEFAULT;	// The events that pull it.
+	attention_asserted = false;			// Is it pulled right now?
+
+	// -- Tuning variables -------------------------------------------------------------
+	for (byte i = 0; i < TUNE_COUNT * 2; i++) {
+		tuning_block[i] = 0;		// Filled in when it's loaded, or saved.
+	}
+	tuning_selected = 0;			// The first one, until CMD_GET_TUNING picks another.
+
+	// -- Boot learning variables ------------------------------------------------------
+	for (byte i = 0; i < VOP_CHANNELS * BOOT_STAT_BYTES; i++) {
+		boot_stats_block[i] = 0;	// Filled in when it's loaded, or saved.
+	}
+	for (byte ch = 0; ch < VOP_CHANNELS; ch++) {
+		boot_mean[ch] = 0;			// Nothing learned yet.
+		boot_deviation[ch] = 0;
+		boot_samples[ch] = 0;
+		boot_last[ch] = 0;
+		boot_backoff[ch] = false;
+		boot_unknown[ch] = false;
+	}
 
-	// -- Shutdown request variables ---------------------------------------------------
-	shutdown_request_mode = false;
-	shutdown_request_at = 0;
+	// -- Reset variables --------------------------------------------------------------
+	for (byte i = 0; i < RESET_STAT_BYTES; i++) {
+		reset_stats_block[i] = 0;	// Filled in when it's loaded, or saved.
+	}
+	reset_kind = RESET_COLD;		// Until setup() finds out otherwise.
+	warm_resets = 0;
+	fallback_resets = 0;
+
+#if VOP_INSTRUMENT
+	// -- Instrumentation variables ----------------------------------------------------
+	for (byte i = 0; i < STATS_ERRORS; i++) {
+		stats_errors[i] = 0;
+	}
+	for (byte i = 0; i < STATS_COMMANDS; i++) {
+		stats_commands[i] = 0;
+	}
+	stats_last_loop = 0;		// When loop() last ran (micros.)
+	stats_last_sample = 0;		// When the debouncer last sampled (micros.)
+	stats_offset = 0;			// Where the next CMD_READ_STATS read starts.
+	stats_reset = false;		// Zero the counters as they're read?
+#endif
+
+	// -- Stateful Device Information ---------------------------------------------------
+	// Only the first channel has pins to start with.
+	selected_channel = 0;				// Commands act on the first channel, until told otherwise.
+	for (byte ch = 0; ch < VOP_CHANNELS; ch++) {
+		relay_pin[ch] = ch ? PIN_NONE : PIN_RASPI_RELAY;
+		ignition_pin[ch] = ch ? PIN_NONE : PIN_IGNITION;
+		ignition_state[ch] = false; 			// 0 = off, 1 = on.
+		ignition_delta_time[ch] = 0;			// The time when the ignition was last changed.
+		raspberry_power[ch] = false;			// State of Raspberry Pi Power (0 = off, 1 = on)
+		ignition_bit[ch] = 0;					// Set in setup(), where the port is known.
+
+		// -- Shutdown request variables -----------------------------------------------
+		shutdown_request_mode[ch] = false;
+		shutdown_request_at[ch] = 0;
+
+		// -- Halt variables -----------------------------------------------------------
+		halt_state[ch] = HALT_NONE;
+		halt_by[ch] = HALT_BY_COMMAND;
+		halt_cut_at[ch] = 0;
+		halt_pin[ch] = PIN_NONE;			// None, until the sketch gives it one.
+		halt_level[ch] = HIGH;
+		halt_hold[ch] = 0;
+		halt_seen[ch] = false;
+		halt_seen_at[ch] = 0;
+
+		// -- Watchdog and power variables (explained below) ----------------------------
+		watchdog_state[ch] = WATCHDOG_STATE_IDLE;
+		watchdog_mode[ch] = true;
+		watchdog_last_pat[ch] = 0;
+		watchdog_turnoff_time[ch] = 0;
+		watchdog_boot_time[ch] = 0;
+		power_minimum_off_time[ch] = 0;
+	}
+#if VOP_SUPPLY
+	// -- Supply monitor variables -----------------------------------------------------
+	supply_pin = PIN_NONE;				// None, until the sketch gives us one.
+	supply_full_scale = 0;
+	supply_dipped = false;
+	supply_dipped_at = 0;
+#endif
+	supply_cutoff = VOP_SUPPLY_CUTOFF;
+	supply_low = false;					// Nothing's low until we've seen it.
+
+	wake_bits = 0;						// Set in setup(), as the ignition interrupts are attached.
+	debounce_interval = CHECK_IGNITION_INTERVAL;	// Until it's tuned.
+	debounce_on_depth = CHECK_IGNITION_DEPTH;
+	debounce_off_depth = CHECK_IGNITION_DEPTH;
+	ignition_holdoff = VOP_IGNITION_HOLDOFF;		// Believe it straight away, unless it's set.
+	for (byte ch = 0; ch < VOP_CHANNELS; ch++) {
+		ignition_dipping[ch] = false;
+		ignition_dip_at[ch] = 0;
+		dip_count[ch] = 0;
+		dip_longest[ch] = 0;
+		dip_last[ch] = 0;
+	}
 
 	// ----------------------------------------
 	// -- Watchdog Timer (WdT) Variables ------
@@ -132,113 +597,458 @@ vOP::vOP() {
 	// In the negative case, the ignition is still on, but no WdT pat is received -- it will just turn it off for a moment, and then back on.
 	// I chose the term pat, as opposed to kick. It's just more polite: http://en.wikipedia.org/wiki/Watchdog_timer#Watchdog_restart
 
-	watchdog_state = WATCHDOG_STATE_IDLE;		// This is the current state of the watchdog.
+	// watchdog_state: This is the current state of the watchdog. (IDLE to start.)
 
-	watchdog_mode = true;						// When not in watchdog mode, turns off by request only.
+	// watchdog_mode: When not in watchdog mode, turns off by request only. (On to start.)
 	watchdog_shutdown_initiated = false;		// Are we going to shutdown? If we're in this mode, we're waiting to shutdown (interruptible by a pat)
 
-	watchdog_last_pat = 0;						// When's the last time they pet the dog?
-	watchdog_timeout_interval = 20;				// How long can we wait between pats? (SECONDS) If we don't see a pat in this long, we begin to shutdown power.
+	// watchdog_last_pat: When's the last time they pet the dog?
+	// watchdog_turnoff_time: And the next time we turn off (set when it fails.)
+	// watchdog_boot_time: When's the time we mark a boot initiated?
 
-	watchdog_turnoff_interval = 30; 			// How long after the watchdog fails to turn it off?
-	watchdog_turnoff_time = 0;					// And the next time we turn off (set when it fails.)
+#if !VOP_FIXED_TIMING
+	watchdog_timeout_interval = VOP_WATCHDOG_TIMEOUT;		// How long can we wait between pats? If we don't see a pat in this long, we begin to shutdown power.
+	watchdog_turnoff_interval = VOP_WATCHDOG_TURNOFF;		// How long after the watchdog fails to turn it off?
+	watchdog_run_interval = VOP_WATCHDOG_RUN;				// And this is how often it runs.
+	watchdog_boot_interval = VOP_WATCHDOG_BOOT;				// How long do we give the raspberry pi to boot?
+	power_minimum_off_interval = VOP_POWER_MINIMUM_OFF;		// Minimum time the pi can be off (in order to reboot.)
+#endif
 
-	watchdog_next_run = 0;						// When's the next time the watchdog will run?
-	watchdog_run_interval = 5;					// And this is how often it runs. (SECONDS)
+	// ------------------------------------------ -
+	// -- Power Timer Variables ---------------- -
+	// ---------------------------------------- -
 
-	watchdog_boot_time = 0;						// When's the time we mark a boot initiated?
-	watchdog_boot_interval = 60;				// How long do we give the raspberry pi to boot? (SECONDS)
+	// power_minimum_off_time: The time we turned it off.
+	power_on_stagger = 0;			// Turn channels on as soon as they're ready.
+	power_on_last = 0;				// When we last turned one on.
+	power_on_any = false;			// And we haven't, yet.
 
 	// ------------------------------------------ -
-	// -- Power Timer Variables ---------------- -
+	// -- Deadline Scheduler Variables --------- -
+	// ---------------------------------------- -
+	// Nothing runs until setup() arms the timers.
+
+	for (byte i = 0; i < VOP_TIMER_COUNT; i++) {
+		timer_deadline[i] = 0;
+	}
+	timer_armed = 0;
+	timer_next = 0;
+
+	// ------------------------------------------ -
+	// -- Sleep Mode Variables ----------------- -
 	// ---------------------------------------- -
 
-	power_minimum_off_interval = 5;	// Minimum number of seconds the pi can be off (in order to reboot) (SECONDS)
-	power_minimum_off_time = 0;		// The time we turned it off.
+	sleep_mode = false;			// Opt-in, off by default.
+	sleep_millis = 0;			// How long we've spent asleep, in total.
+	sleep_micros = 0;			// And the part of a milli we haven't counted yet.
+	sleep_stats_since = 0;		// When we started counting (setup).
+	ignition_edge = 0;			// No edge yet.
+	sleep_woken = 0;			// Nor anything to wake us.
 
 }
 
 void vOP::setup() {
 
-	// initialize the pin to turn the relay on, as an output.
-	pinMode(PIN_RASPI_RELAY, OUTPUT);
-	digitalWrite(PIN_RASPI_RELAY, HIGH);
+	// Here's our debug LED, it's an output.
+	vop_hal_pinMode(PIN_DEBUG_LED, OUTPUT);
 
+	// Bring back the tuning, if it was saved. (What's saved wins over what the sketch set.)
+	if (tuning.begin(EEPROM_TUNING, TUNING_VERSION, tuning_block, sizeof(tuning_block))) {
+		for (byte id = 0; id < TUNE_COUNT; id++) {
+			applyTuning(id, ((unsigned int)tuning_block[id * 2] << 8) | tuning_block[id * 2 + 1]);
+		}
+	}
 
-	// Here's our debug LED, it's an output.
-	pinMode(PIN_DEBUG_LED, OUTPUT);
+	// And what we learned about how long they take to boot.
+	if (boot_stats.begin(EEPROM_BOOT_STATS, BOOT_STATS_VERSION, boot_stats_block, sizeof(boot_stats_block))) {
+		for (byte ch = 0; ch < VOP_CHANNELS; ch++) {
+			byte *saved = &boot_stats_block[ch * BOOT_STAT_BYTES];
+			boot_mean[ch] = ((unsigned int)saved[0] << 8) | saved[1];
+			boot_deviation[ch] = ((unsigned int)saved[2] << 8) | saved[3];
+			boot_samples[ch] = saved[4];
+		}
+	}
 
-	// listen on the ignition, as input
-	pinMode(PIN_IGNITION, INPUT);
+#if VOP_JOURNAL
+	// Find our place in the journal.
+	journal.begin(EEPROM_JOURNAL, vop_hal_eepromSize() - 1);
+#endif
 
-	// Initialize i2c, give it the address, and the methods to call on it's events.
+	uint32_t now = vop_hal_millis();
 
-	/*
-	Wire.begin(i2c_address);	
-	Wire.onReceive(receiveData_wrapper);
-	Wire.onRequest(fillRequest_wrapper);
-	*/
+	// Was that a reset, with the Pi still running? Then carry on where we were.
+	bool saved = reset_stats.begin(EEPROM_RESET_STATS, RESET_STATS_VERSION, reset_stats_block, sizeof(reset_stats_block));
+	if (saved) {
+		warm_resets = ((unsigned int)reset_stats_block[1] << 8) | reset_stats_block[2];
+		fallback_resets = ((unsigned int)reset_stats_block[3] << 8) | reset_stats_block[4];
+	}
+	if (warmStateValid()) {
+		restoreWarmState(now);
+		reset_kind = RESET_WARM;
+		if (warm_resets < 0xFFFF) {
+			warm_resets++;
+		}
+	} else if (saved && restoreFallback(now)) {
+		reset_kind = RESET_FALLBACK;
+		if (fallback_resets < 0xFFFF) {
+			fallback_resets++;
+		}
+	}
+	if (reset_kind != RESET_COLD) {
+		saveResetStats();
+	}
+
+	for (byte ch = 0; ch < VOP_CHANNELS; ch++) {
+
+		// initialize the pin to turn the relay on, as an output. The level goes first, so
+		// it never drives the wrong way (a fresh pin would go LOW, and that's on.)
+		if (relay_pin[ch] != PIN_NONE) {
+			setRelay(ch, raspberry_power[ch]);
+			vop_hal_pinMode(relay_pin[ch], OUTPUT);
+		}
+
+		if (ignition_pin[ch] != PIN_NONE) {
+			// listen on the ignition, as input
+			vop_hal_pinMode(ignition_pin[ch], INPUT);
+
+			// And debounce it, along with whatever else is on its port that you watchInput().
+			ignition_bit[ch] = vop_hal_pinBit(ignition_pin[ch]);
+			debouncer.watch(ignition_bit[ch], debounce_on_depth, debounce_off_depth);
+			debouncer.latch(ignition_bit[ch], ignition_state[ch] ? ignition_bit[ch] : 0);
+
+			// Any edge on the ignition wakes us up, in case we're sleeping. (If the pin can.)
+			ignition_sink = this;
+			if (vop_hal_attachWake(ignition_pin[ch], ignitionEdge)) {
+				wake_bits |= ignition_bit[ch];
+			}
+		}
+
+		// The pin that shows it's halted, if it has one.
+		if (halt_pin[ch] != PIN_NONE) {
+			vop_hal_pinMode(halt_pin[ch], INPUT);
+		}
+
+		// Note that we've (re)started.
+		journalLog(ch, reset_kind != RESET_COLD && raspberry_power[ch] ? JOURNAL_WARM_RESET : JOURNAL_RESET);
+
+		// Kick off the scheduler, everything gets a look on the first loop.
+		if (watchdog_mode[ch]) {
+			armTimer(VOP_TIMER_WATCHDOG(ch), now);
+		}
+		armTimer(VOP_TIMER_BOOTUP(ch), now);
+
+		// And pick up anything that was going on before the reset. (A request is never more than
+		// SHUTDOWN_MAX_DELAY off, so if there's more left than that, it's overdue.)
+		if (shutdown_request_mode[ch]) {
+			uint32_t left = shutdown_request_at[ch] - now;
+			armTimer(VOP_TIMER_SHUTDOWN_REQUEST(ch), (int32_t)left > SHUTDOWN_WARNING_INTERVAL ? shutdown_request_at[ch] - SHUTDOWN_WARNING_INTERVAL : shutdown_request_at[ch]);
+		}
+		if (halt_state[ch] != HALT_NONE || watchdog_state[ch] == WATCHDOG_STATE_SHUTDOWN) {
+			watchHalt();
+		}
+
+	}
 
+	sleep_stats_since = now;
+	armTimer(VOP_TIMER_DEBOUNCE, now);
+	armTimer(VOP_TIMER_STATUS, now);
 
-#if SERIAL_ON > 0
-	  Serial.begin(9600);
-	  debugIt("Application started.");
+#if VOP_SUPPLY
+	// Start measuring the supply, if there's one to measure.
+	if (supply_pin != PIN_NONE) {
+		supply_sink = &supply;
+		if (vop_hal_adcStart(supply_pin, supplySample)) {
+			armTimer(VOP_TIMER_SUPPLY, now + SUPPLY_INTERVAL);
+		} else {
+			supply_pin = PIN_NONE;
+		}
+	}
 #endif
 
+	// i2c waits for beginI2c(), so the sketch can get everything else ready first.
+
+	logIt(LOG_STARTED, reset_kind);
+
 }
 
+// -- shutdownRequestHandler : Look at every channel's shutdown request.
+
 void vOP::shutdownRequestHandler() {
 
-	if (shutdown_request_mode) {
+	for (byte ch = 0; ch < VOP_CHANNELS; ch++) {
+		shutdownRequestChannel(ch);
+	}
+
+}
+
+void vOP::shutdownRequestChannel(byte ch) {
+
+	// The timer is only armed while a request is pending, and it's rollover safe.
+	if (!shutdown_request_mode[ch] || !timerDue(VOP_TIMER_SHUTDOWN_REQUEST(ch))) {
+		return;
+	}
+
+	// Not there yet? Then it's time for the warning.
+	if ((int32_t)(vop_hal_millis() - shutdown_request_at[ch]) < 0) {
+		recordEvent(EVENT_SHUTDOWN_DUE, 0, ch);
+		armTimer(VOP_TIMER_SHUTDOWN_REQUEST(ch), shutdown_request_at[ch]);
+	} else {
+		// Perform a shutdown.
+		logIt(LOG_SHUTDOWN_EXECUTED, ch);
+		shutdown_request_mode[ch] = false;
+		shutdown_request_at[ch] = 0;
+		disarmTimer(VOP_TIMER_SHUTDOWN_REQUEST(ch));
+		recordEvent(EVENT_SHUTDOWN_EXECUTED, 0, ch);
+		journalLog(ch, JOURNAL_SHUTDOWN_REQUESTED);
+		shutDownHandler(ch);
+	}
+
+}
+
+// -- requestShutdown : Schedule a shutdown, and its warning.
+
+void vOP::requestShutdown(byte ch, uint32_t delay) {
+
+	// The scheduler can't see any further ahead than this.
+	if (delay > SHUTDOWN_MAX_DELAY) {
+		delay = SHUTDOWN_MAX_DELAY;
+	}
+	uint32_t now = vop_hal_millis();
+	shutdown_request_at[ch] = now + delay;
+	shutdown_request_mode[ch] = true;
+	recordEvent(EVENT_SHUTDOWN_REQUESTED, 0, ch);
+	// Too soon for a warning? Then it goes out straight away.
+	armTimer(VOP_TIMER_SHUTDOWN_REQUEST(ch), delay > SHUTDOWN_WARNING_INTERVAL ? shutdown_request_at[ch] - SHUTDOWN_WARNING_INTERVAL : now);
+	// And it might halt before then.
+	watchHalt();
+
+}
+
+// --------------------------------------------------------------------------
+// -- haltHandler: Cut the power to a Pi that's halted, without waiting out the timeouts.
+// Only runs while a channel is on its way down, polling the halt pins.
+
+void vOP::haltHandler() {
+
+	if (!timerDue(VOP_TIMER_HALT)) {
+		return;
+	}
+
+	bool waiting = false;
+	for (byte ch = 0; ch < VOP_CHANNELS; ch++) {
+		if (haltChannel(ch)) {
+			waiting = true;
+		}
+	}
+
+	if (waiting) {
+		rearmTimer(VOP_TIMER_HALT, HALT_POLL_INTERVAL);
+	} else {
+		disarmTimer(VOP_TIMER_HALT);
+	}
+
+}
+
+// -- haltChannel : Look for a channel's halt. Returns true if we have to keep looking.
+
+bool vOP::haltChannel(byte ch) {
+
+	// Nothing to cut.
+	if (!raspberry_power[ch]) {
+		halt_state[ch] = HALT_NONE;
+		return false;
+	}
+
+	uint32_t now = vop_hal_millis();
+
+	// Halted, and its time is up? Off it goes.
+	if (halt_state[ch] == HALT_CONFIRMED) {
+		if ((int32_t)(now - halt_cut_at[ch]) < 0) {
+			return true;
+		}
+		logIt(LOG_HALT_CUT, ch);
+		halt_state[ch] = HALT_NONE;
+		if (shutdown_request_mode[ch]) {
+			// It's done what the request wanted.
+			shutdown_request_mode[ch] = false;
+			shutdown_request_at[ch] = 0;
+			disarmTimer(VOP_TIMER_SHUTDOWN_REQUEST(ch));
+		}
+		recordEvent(EVENT_HALTED, halt_by[ch], ch);
+		journalLog(ch, JOURNAL_HALTED);
+		shutDownHandler(ch);
+		return false;
+	}
 
-		if (millis() > shutdown_request_at) {
-			// Perform a shutdown.
-			debugIt("Performing requested shutdown.");
-			shutdown_request_mode = false;
-			shutdown_request_at = false;
-			shutDownHandler();
+	// We only believe the pin once we know it's going down, it could be anything while it runs.
+	bool going_down = halt_state[ch] == HALT_ANNOUNCED || shutdown_request_mode[ch] || watchdog_state[ch] == WATCHDOG_STATE_SHUTDOWN;
+	if (!going_down || halt_pin[ch] == PIN_NONE) {
+		halt_seen[ch] = false;
+		return false;
+	}
+
+	// Has it shown the halt for long enough?
+	if (vop_hal_digitalRead(halt_pin[ch]) == halt_level[ch]) {
+		if (!halt_seen[ch]) {
+			halt_seen[ch] = true;
+			halt_seen_at[ch] = now;
 		}
+		if ((uint32_t)(now - halt_seen_at[ch]) >= halt_hold[ch]) {
+			confirmHalt(ch, HALT_BY_PIN, now);
+		}
+	} else {
+		halt_seen[ch] = false;
+	}
+	return true;
+
+}
+
+// -- confirmHalt : The Pi's halted (or about to), cut its power at cut_at.
+
+void vOP::confirmHalt(byte ch, byte by, uint32_t cut_at) {
+
+	if (!raspberry_power[ch]) {
+		return;
+	}
+	halt_state[ch] = HALT_CONFIRMED;
+	halt_by[ch] = by;
+	halt_cut_at[ch] = cut_at;
+	watchHalt();
+
+}
+
+// -- watchHalt : Something's on its way down, have the halt handler look.
+
+void vOP::watchHalt() {
+
+	armTimer(VOP_TIMER_HALT, vop_hal_millis());
 
+}
+
+// -- setHaltPin : Give a channel a pin that shows its Pi has halted, once it reads level for hold millis.
+// Call it before setup().
+
+void vOP::setHaltPin(byte ch, byte pin, byte level, unsigned int hold) {
+
+	if (ch < VOP_CHANNELS) {
+		halt_pin[ch] = pin;
+		halt_level[ch] = level;
+		halt_hold[ch] = hold;
 	}
 
 }
 
 // --------------------------------------------------------------------------
-// -- bootUpHandler: Turns on the raspberry pi when necessary.
+// -- bootUpHandler: Turns on the raspberry pis when necessary.
 
 void vOP::bootUpHandler() {
 
+	for (byte ch = 0; ch < VOP_CHANNELS; ch++) {
+		bootUpChannel(ch);
+	}
+
+}
+
+void vOP::bootUpChannel(byte ch) {
+
+	// We're woken up whenever the power or the ignition changes.
+	if (!timerDue(VOP_TIMER_BOOTUP(ch))) {
+		return;
+	}
+	disarmTimer(VOP_TIMER_BOOTUP(ch));
+
 	// If the raspberry pi is off...
-	if (!raspberry_power) {
-		// And the ignition is on...
-		if (ignition_state) {
+	if (!raspberry_power[ch]) {
+		// And the ignition is on (and the battery can take it)...
+		if (ignition_state[ch] && !supply_low) {
 			// If we've been off for long enough (in the case of a reboot scenario, this is important.)
-			if ((unsigned long)(millis() - power_minimum_off_time) >= (power_minimum_off_interval*1000)) {
+			// These are elapsed times, not deadlines: a car can be parked for longer than a signed
+			// difference of millis() can count, and then it's long past due, not weeks away.
+			uint32_t now = vop_hal_millis();
+			uint32_t off_for = now - power_minimum_off_time[ch];
+			uint32_t wait = off_for < power_minimum_off_interval ? power_minimum_off_interval - off_for : 0;
+			// And the last channel we turned on has had its moment.
+			if (power_on_any && power_on_stagger) {
+				uint32_t since_last = now - power_on_last;
+				if (since_last < power_on_stagger && power_on_stagger - since_last > wait) {
+					wait = power_on_stagger - since_last;
+				}
+			}
+			if (wait) {
+				// Not yet, come back when it's been off long enough.
+				armTimer(VOP_TIMER_BOOTUP(ch), now + wait);
+			} else {
 				// Then we need to turn the raspberry pi on!
-				debugIt("Turning raspberry pi on!");
+				logIt(LOG_POWER_ON, ch);
 				// Set the pin state, and turn on the relay.
-				digitalWrite(PIN_RASPI_RELAY, LOW);
+				setRelay(ch, true);
 				// And save it in our stateful variable.
-				raspberry_power = true;
+				raspberry_power[ch] = true;
+				power_on_last = vop_hal_millis();
+				power_on_any = true;
+				recordEvent(EVENT_RELAY, 1, ch);
+				journalLog(ch, JOURNAL_POWER_ON);
 				// Now we tell the watchdog we're in a booting state.
-				watchdog_state = WATCHDOG_STATE_BOOTING;
+				setWatchdogState(ch, WATCHDOG_STATE_BOOTING);
 				// And we give it a grace period.
-				watchdog_boot_time = millis();
+				watchdog_boot_time[ch] = vop_hal_millis();
 			}
 		}
 	}
 
 }
 
-void vOP::shutDownHandler() {
+void vOP::shutDownHandler(byte ch) {
 
-	debugIt("Shutting down raspberry pi.");
+	logIt(LOG_POWER_OFF, ch);
 	// Turn the raspberry pi off, at the relay.
-	digitalWrite(PIN_RASPI_RELAY, HIGH);
+	setRelay(ch, false);
 	// Note when we turned it off (in case we're rebooting, so we can have it off for a set period)
-	power_minimum_off_time = millis();
+	power_minimum_off_time[ch] = vop_hal_millis();
+	// Whatever it was doing, it's not halting any more.
+	halt_state[ch] = HALT_NONE;
+	halt_seen[ch] = false;
+	// And the next boot is one we see from the start.
+	boot_unknown[ch] = false;
 	// And we note that we've turned it off in our stateful variables.
-	raspberry_power = false;
+	if (raspberry_power[ch]) {
+		recordEvent(EVENT_RELAY, 0, ch);
+	}
+	raspberry_power[ch] = false;
+	// Let the boot up handler decide when it can come back on.
+	armTimer(VOP_TIMER_BOOTUP(ch), power_minimum_off_time[ch]);
+	// Whoever turned it off, the watchdog has nothing left to watch until it boots again. (Left
+	// watching, it'd miss the pats of a Pi with no power, and "cut" a relay that's already off.)
+	setWatchdogState(ch, WATCHDOG_STATE_IDLE);
+
+}
+
+// -- setRelay : Switch a channel's relay. (It's active low.)
+
+void vOP::setRelay(byte ch, bool on) {
+
+	if (relay_pin[ch] != PIN_NONE) {
+		vop_hal_digitalWrite(relay_pin[ch], on ? LOW : HIGH);
+	}
+
+}
+
+// -- setChannelPins : Give a channel its relay and ignition. Call it before setup().
+
+void vOP::setChannelPins(byte ch, byte relay, byte ignition) {
+
+	if (ch < VOP_CHANNELS) {
+		relay_pin[ch] = relay;
+		ignition_pin[ch] = ignition;
+	}
+
+}
+
+// -- setPowerOnStagger : Leave at least this long (millis) between turning channels on.
+
+void vOP::setPowerOnStagger(unsigned int interval) {
+
+	power_on_stagger = interval;
 
 }
 
@@ -248,42 +1058,53 @@ void vOP::shutDownHandler() {
 
 void vOP::watchDog() {
 
+	for (byte ch = 0; ch < VOP_CHANNELS; ch++) {
+		watchDogChannel(ch);
+	}
+
+}
+
+void vOP::watchDogChannel(byte ch) {
+
 	// Only when watchdog mode is active.
-	if (watchdog_mode) {
+	if (watchdog_mode[ch]) {
 
 		// Let's only check this on an interval.
-		if ((unsigned long)(millis() - watchdog_next_run) >= (watchdog_run_interval*1000)) {
+		if (timerDue(VOP_TIMER_WATCHDOG(ch))) {
 
 			/*
-			debugIt("checkin state.");
-			debugItDEC(watchdog_state);
+			logIt(LOG_WATCHDOG_CHECK, ch, watchdog_state[ch]);
 			*/
 		
 			// Depending on the state of the watchdog timer, we behave differently.
-			switch(watchdog_state) {
+			switch(watchdog_state[ch]) {
 
 				case WATCHDOG_STATE_WATCHING:
-					// So now, we see if we've missed a watchdog pat.
-					if ((unsigned long)(millis() - watchdog_last_pat) >= (watchdog_timeout_interval*1000)) {
+					// So now, we see if we've missed a watchdog pat. (A Pi with no power can't pat, and there's nothing to cut.)
+					if (raspberry_power[ch] && (uint32_t)(vop_hal_millis() - watchdog_last_pat[ch]) >= watchdog_timeout_interval) {
 						// That looks like a missed watchdog pat.
-						debugIt("Watch dog pats failed, moving into shutdown mode.");
+						logIt(LOG_WATCHDOG_FAILED, ch);
 						// Now that we're missing watchdog timers. We need to know how long until we're going to shut 'er down.
 						// So we'll cascade another timer here, the shutdown timer.
 						test++;
-						watchdog_state = WATCHDOG_STATE_SHUTDOWN;
+						setWatchdogState(ch, WATCHDOG_STATE_SHUTDOWN);
 						// Set the time that timer will run, now.
-						watchdog_turnoff_time = millis(); // + (watchdog_turnoff_interval*1000);
+						watchdog_turnoff_time[ch] = vop_hal_millis(); // + watchdog_turnoff_interval;
 					}
 					break;
 
 				case WATCHDOG_STATE_SHUTDOWN:
-					if ((unsigned long)(millis() - watchdog_turnoff_time) >= (watchdog_turnoff_interval*1000)) {
+					if ((uint32_t)(vop_hal_millis() - watchdog_turnoff_time[ch]) >= watchdog_turnoff_interval) {
 						test++;
 						// It's time to shut 'er down.
-						// So first we issue a shutdown, and set the watchdog state to be idle.
-						debugIt("Issuing shutdown due to watchdog pats.");
-						shutDownHandler();
-						watchdog_state = WATCHDOG_STATE_IDLE;
+						// So we issue a shutdown (which sets the watchdog state to be idle.) If something else
+						// beat us to it, the power's already off, and there's nothing to put in the journal.
+						if (raspberry_power[ch]) {
+							logIt(LOG_WATCHDOG_SHUTDOWN, ch);
+							journalLog(ch, JOURNAL_WATCHDOG_TIMEOUT);
+							shutDownHandler(ch);
+						}
+						setWatchdogState(ch, WATCHDOG_STATE_IDLE);
 					}
 					break;
 
@@ -291,13 +1112,14 @@ void vOP::watchDog() {
 					// If the watchdog is booting.... we just stick around here.
 					// Waiting for a pat. When the pat is received, the watchdog is reset, and we're put into the "watching" state.
 					// But, eventually we have to timeout, and reset this mother.
-					if ((unsigned long)(millis() - watchdog_boot_time) >= (watchdog_boot_interval*1000)) {
+					if ((uint32_t)(vop_hal_millis() - watchdog_boot_time[ch]) >= bootTimeout(ch)) {
 						// If we hit this, we haven't gotten a pat in the allowed boot time.
-						debugIt("Boot failed, no watch dog pats before allowed time, reboot starting (if ignition up)");
-						// So we issue a shutdown.
-						shutDownHandler();
-						// And we go idle.
-						watchdog_state = WATCHDOG_STATE_IDLE;
+						logIt(LOG_BOOT_FAILED, ch, bootTimeout(ch) / 1000);
+						// If that was on a learned timeout, maybe it was just slow. The next one gets the full interval.
+						boot_backoff[ch] = bootTimeout(ch) < watchdog_boot_interval;
+						// So we issue a shutdown. (And we go idle.)
+						journalLog(ch, JOURNAL_BOOT_FAILED);
+						shutDownHandler(ch);
 					}
 					break;
 
@@ -308,7 +1130,7 @@ void vOP::watchDog() {
 			}
 
 			// And set the next time we'll look for this.
-			watchdog_next_run += watchdog_run_interval*1000;
+			rearmTimer(VOP_TIMER_WATCHDOG(ch), watchdog_run_interval);
 
 		}
 		
@@ -316,12 +1138,33 @@ void vOP::watchDog() {
 
 }
 
-void vOP::resetWatchDog() {
+// -- setWatchdogState : Move a channel's watchdog to a new state, and tell the event feed if it changed.
+
+void vOP::setWatchdogState(byte ch, byte state) {
+
+	if (watchdog_state[ch] != state) {
+		watchdog_state[ch] = state;
+		recordEvent(EVENT_WATCHDOG, state, ch);
+		// The watchdog's shutting it down, so it might halt before the turnoff.
+		if (state == WATCHDOG_STATE_SHUTDOWN) {
+			watchHalt();
+		}
+	}
+
+}
+
+void vOP::resetWatchDog(byte ch) {
 
 	// Set the time we expect the next pat.
-	watchdog_last_pat = millis();
+	watchdog_last_pat[ch] = vop_hal_millis();
+	// The first pat after the relay went on tells us how long it took to boot.
+	// (Unless it was on all along, through a reset, then we don't know when it went on.)
+	if (watchdog_state[ch] == WATCHDOG_STATE_BOOTING && !boot_unknown[ch]) {
+		learnBootTime(ch, watchdog_last_pat[ch] - watchdog_boot_time[ch]);
+	}
+	boot_unknown[ch] = false;
 	// And since the watchdog has been pat, we also reset the watchdog state (so that we either enable it now [in the case of booting], or cancel a shutdown [in the case of, yep, a shutdown])
-	watchdog_state = WATCHDOG_STATE_WATCHING;
+	setWatchdogState(ch, WATCHDOG_STATE_WATCHING);
 
 }
 
@@ -331,154 +1174,1815 @@ void vOP::resetWatchDog() {
 
 void vOP::fillRequest() {
 
-	// We return result data depending on the command. 
-	// Sometimes we result in an int, we default this as true. If not, we set the bytes directly.
-	bool use_int = true;
-	unsigned int result_data = 0;
+	// We're in the i2c interrupt, so keep track of how long we hold it.
+	uint32_t started = vop_hal_micros();
+	fillResponse();
+	noteIsrTime(started);
+	STATS_TIME(STATS_FILL_REQUEST, started);
 
-	// Here's the two bytes we return (we pack the int in these if true above, otherwise, set them yourself.)
-	byte return_buffer[2];
+}
 
-	// An integer for processing param data, should you to keep an int value from the passed parameters.
-	unsigned int param_data = 0;
+// --------------------------------------------------------------------------
+// -- beginI2c : Join the bus as a slave at address, with our handlers on its events.
+// Through Wire, or with VOP_TWI, our own driver (see vOPHal.cpp.) Either way, no wrappers needed in the sketch.
 
-	
-	if (command_complete == 1) {
-		// -- Command handler.
-		if (error_flag == 0) {
+void vOP::beginI2c(byte address) {
 
-			// No error at this point.
-			switch (command) {
-				case CMD_GET_IGNITION_STATE:
-					// Simple, send them the latched ignition state.
-					result_data = ignition_state;
-					break;
+	i2c_address = address;
+	i2c_sink = this;
+#if VOP_TWI
+	vop_hal_twiBegin(address, i2cReceivedByte, i2cRequested);
+#else
+	vop_hal_i2cBegin(address, i2cReceived, i2cRequested);
+#endif
 
-				case CMD_GET_LAST_IGNITION_CHANGE_SECONDS:
-					// This is simple too, we just want how long ago we changed the ignition.
-					// Get it in seconds here.
-					result_data = ignitionChangedLast(true);
-					break;
+}
 
-				case CMD_GET_LAST_IGNITION_CHANGE_MINUTES:
-					// And we send false to get minutes here.
-					result_data = ignitionChangedLast(false);
-					break;
+// -- i2cReceived, i2cReceivedByte, i2cRequested : The bus's events, handed on to i2c_sink.
 
-				case CMD_ECHO:
-					// Simply echo back the bytes that were send in the parameters.
-					use_int = false;
-					return_buffer[0] = param_buffer[0];
-					return_buffer[1] = param_buffer[1];
-					break;
+void vOP::i2cReceived(int count) {
 
-				case CMD_PAT_WATCHDOG:
-					// We just pat the dog, let's set his next runtime.
-					resetWatchDog();
-					break;
+	i2c_sink->sleep_woken = 1;
+	i2c_sink->receiveData(count);
 
-				case CMD_SET_WATCHDOG:
-					// Set the watchdog on or off.
-					watchdog_mode = param_buffer[1];
-					break;
+}
 
-				case CMD_GET_WATCHDOG:
-					// Return the watchdog MODE.
-					result_data = watchdog_mode;
-					break;
+void vOP::i2cReceivedByte(byte value, byte index) {
 
-				case CMD_REQUEST_SHUTDOWN_SECONDS:
-					// Request a shutdown in N seconds.
-					param_data = paramsToInt(param_buffer[0],param_buffer[1]);
-					shutdown_request_at = millis() + (unsigned long)((unsigned long)param_data*1000);
-					shutdown_request_mode = true;
-					break;
+	// Each byte is its own interrupt, so each is timed on its own.
+	uint32_t started = vop_hal_micros();
+	i2c_sink->sleep_woken = 1;
+	i2c_sink->receiveByte(value, index);
+	i2c_sink->noteIsrTime(started);
+#if VOP_INSTRUMENT
+	i2c_sink->stats_histograms[STATS_RECEIVE_DATA].add(vop_hal_micros() - started);
+#endif
 
-				case CMD_REQUEST_SHUTDOWN_MINUTES:
-					// Request a shutdown in N minutes.
-					param_data = paramsToInt(param_buffer[0],param_buffer[1]);
-					shutdown_request_at = millis() + (unsigned long)(((unsigned long)param_data*60)*1000);
-					// Serial.println(shutdown_request_at,DEC);
-					shutdown_request_mode = true;
-					break;
+}
 
-				case CMD_GET_SHUTDOWN_STATE:
-					// Simply return the state of the shutdown.
-					result_data = shutdown_request_mode;
-					break;
+void vOP::i2cRequested() {
 
-				case CMD_CANCEL_SHUTDOWN:
-					// Cancel a shutdown that's in progress.
-					shutdown_request_mode = false;
-					shutdown_request_at = 0;
-					break;
+	i2c_sink->sleep_woken = 1;
+	i2c_sink->fillRequest();
 
-				// --------------------- DEBUG METHODS
+}
 
-					// Set the ignition detect according to the first param
-					case CMD_DEBUG_SET_IGN_DETECT:
-						debug_ign_debounce = param_buffer[0];
-						break;
+// --------------------------------------------------------------------------
+// -- fillResponse: Send back the result of the command, or an error.
 
-					// Set the ignition detect according to the first param
-					case CMD_DEBUG_SET_IGN_STATE:
-						if (ignition_state != param_buffer[0]) {
-							ignition_state = param_buffer[0];
-							ignition_delta_time = millis();
-						}
-						break;
-
-					// Set the ignition detect according to the first param
-					case CMD_DEBUG_GET_IGN_DETECT:
-						result_data = debug_ign_debounce;
-						break;
-
-					// Get the test value, usefully for debugging discrete values.
-					case CMD_DEBUG_GET_TEST_VALUE:
-						result_data = test;
-						break;
-
-					case CMD_DEBUG_GET_WDT_STATE:
-						result_data = watchdog_state;
-						break;
-					
-				// --------------------- end DEBUG METHODS
-
-				default:
-					// Command is unknown.
-					result_data = 0;
-					error_flag = ERR_COMMAND_UNKNOWN;
-					break;
-			}
+void vOP::fillResponse() {
 
-		} else {
-			// Ok, there's an error here. We won't try to handle the command.
-			// Let's set the result_data to 0.
-			result_data = 0;
-		}
-	} else {
+	// Here's the two bytes we return (zero, unless the command fills them.)
+	byte return_buffer[2] = {0, 0};
 
-		// We never completely got that command.
-		// Chances are you'll see the byte that's wrong as the "command" byte in the return. 
-		error_flag = ERR_COMMAND_INCOMPLETE;
+	if (command_complete == 1) {
+		// -- Command handler.
+		if (error_flag == 0) {
 
-	}
+			// Reading the status block? It's just bytes, no header.
+			if (command == CMD_READ_REGISTERS) {
+				fillRegisterRequest();
+				return;
+			}
 
-	// Go ahead and convert that integer result_data down into a byte array. (if we're saying we're using an int)
-	// http://stackoverflow.com/questions/3784263/converting-an-int-into-a-4-byte-char-array-c
-	if (use_int) {
-		return_buffer[0] = (result_data >> 8) & 0xFF;
-		return_buffer[1] = result_data & 0xFF;
-	}
+#if VOP_INSTRUMENT
+			// So do the stats.
+			if (command == CMD_READ_STATS) {
+				fillStatsRequest();
+				return;
+			}
+#endif
 
-	// Gather together the instructions to send...
-	byte writer[] = {error_flag,command,return_buffer[0],return_buffer[1]};
+#if VOP_JOURNAL
+			// The journal comes straight out of the EEPROM.
+			if (command == CMD_READ_JOURNAL) {
+				fillJournalRequest();
+				return;
+			}
+#endif
+
+			// Events come straight out of the ring.
+			if (command == CMD_GET_EVENTS) {
+				fillEventsRequest();
+				return;
+			}
+
+#if VOP_LOG
+			// And the log.
+			if (command == CMD_READ_LOG) {
+				fillLogRequest();
+				return;
+			}
+#endif
+
+#if VOP_SUPPLY
+			// So do the supply readings, if we're taking them.
+			if (command == CMD_READ_SUPPLY && supply_pin != PIN_NONE) {
+				fillSupplyRequest();
+				return;
+			}
+#endif
+
+			// Tagged results come out of their own table.
+			if (command == CMD_TAGGED || command == CMD_FETCH_TAG) {
+				fillTaggedRequest();
+				return;
+			}
+
+			// In deferred mode, loop() runs the command (or batch), we just hand over what it published.
+			if (deferred_mode) {
+				fillDeferredRequest();
+				return;
+			}
+
+			// A batch gets all of its results back in this one read.
+			if (command == CMD_BATCH) {
+				fillBatchRequest();
+				return;
+			}
+
+			// No error at this point.
+			error_flag = runCommand(command, param_buffer, return_buffer);
+
+			// Whatever that did, get it into the status block soon.
+			armTimer(VOP_TIMER_STATUS, vop_hal_millis());
+
+		}
+		// Otherwise, there's an error here. We won't try to handle the command, and send back zeros.
+	} else {
+
+		// We never completely got that command.
+		// Chances are you'll see the byte that's wrong as the "command" byte in the return. 
+		error_flag = ERR_COMMAND_INCOMPLETE;
+		STATS_ERROR(error_flag);
+
+	}
+
+	// Gather together the instructions to send...
+	byte writer[] = {error_flag,command,return_buffer[0],return_buffer[1]};
 
 	// And send it over the wire!	
-	Wire.write(writer,4);
+	vop_hal_i2cWrite(writer,4);
+
+	// Now we have to reset errors, otherwise, we can get stuck.
+	error_flag = 0;
+
+}
+
+// --------------------------------------------------------------------------
+// -- fillBatchRequest: Run every command in a batch, and send back every result in one go.
+// Each result is the usual 4 bytes (error, command, result, result), so errors are per command.
+// If the batch itself didn't arrive whole, we send back a single result for CMD_BATCH with the error.
+
+void vOP::fillBatchRequest() {
+
+	byte writer[BATCH_MAX_COMMANDS * 4];
+
+	if (batch_length != batch_count * 3) {
+		// The count doesn't match what was sent, we can't trust any of it.
+		byte error_writer[] = {ERR_COMMAND_INCOMPLETE,CMD_BATCH,0,0};
+		STATS_ERROR(ERR_COMMAND_INCOMPLETE);
+		vop_hal_i2cWrite(error_writer,4);
+		return;
+	}
+
+	for (byte i = 0; i < batch_count; i++) {
+
+		byte *in = &batch_buffer[i * 3];
+		byte *out = &writer[i * 4];
+
+		out[1] = in[0];
+		out[2] = 0;
+		out[3] = 0;
+		out[0] = runCommand(in[0], &in[1], &out[2]);
+
+	}
+
+	// And send them all over the wire, at once.
+	vop_hal_i2cWrite(writer,batch_count * 4);
+
+	// Whatever they did, get it into the status block soon.
+	armTimer(VOP_TIMER_STATUS, vop_hal_millis());
+
+}
+
+// --------------------------------------------------------------------------
+// -- The command handlers.
+// One small function per command, listed in the dispatch table below.
+// They live in a friend class, so they can reach into vOP, while vOP.h stays tidy.
+// The ones about a computer act on the selected channel.
+
+class vOPCommands {
+  public:
+
+	static unsigned int getIgnitionState(vOP &vop, unsigned int param, byte *error) {
+		// Simple, send them the latched ignition state.
+		return vop.ignition_state[vop.selected_channel];
+	}
+
+	static unsigned int getLastIgnitionChangeSeconds(vOP &vop, unsigned int param, byte *error) {
+		// This is simple too, we just want how long ago we changed the ignition.
+		// Get it in seconds here.
+		return vop.ignitionChangedLast(true);
+	}
+
+	static unsigned int getLastIgnitionChangeMinutes(vOP &vop, unsigned int param, byte *error) {
+		// And we send false to get minutes here.
+		return vop.ignitionChangedLast(false);
+	}
+
+	static unsigned int echo(vOP &vop, unsigned int param, byte *error) {
+		// Simply echo back the bytes that were send in the parameters.
+		return param;
+	}
+
+	static unsigned int patWatchdog(vOP &vop, unsigned int param, byte *error) {
+		// We just pat the dog, let's set his next runtime.
+		vop.resetWatchDog(vop.selected_channel);
+		return 0;
+	}
+
+	static unsigned int setWatchdog(vOP &vop, unsigned int param, byte *error) {
+		// Set the watchdog on or off.
+		byte ch = vop.selected_channel;
+		vop.watchdog_mode[ch] = param;
+		if (vop.watchdog_mode[ch]) {
+			vop.armTimer(VOP_TIMER_WATCHDOG(ch), vop_hal_millis());
+		} else {
+			vop.disarmTimer(VOP_TIMER_WATCHDOG(ch));
+		}
+		return 0;
+	}
+
+	static unsigned int getWatchdog(vOP &vop, unsigned int param, byte *error) {
+		// Return the watchdog MODE.
+		return vop.watchdog_mode[vop.selected_channel];
+	}
+
+	static unsigned int requestShutdownSeconds(vOP &vop, unsigned int param, byte *error) {
+		// Request a shutdown in N seconds.
+		vop.requestShutdown(vop.selected_channel, (uint32_t)param*1000);
+		return 0;
+	}
+
+	static unsigned int requestShutdownMinutes(vOP &vop, unsigned int param, byte *error) {
+		// Request a shutdown in N minutes. (Up to 35791 of them, see SHUTDOWN_MAX_DELAY.)
+		if (param > SHUTDOWN_MAX_DELAY / 60000UL) {
+			*error = ERR_SHUTDOWN_RANGE;
+			return 0;
+		}
+		vop.requestShutdown(vop.selected_channel, ((uint32_t)param*60)*1000);
+		return 0;
+	}
+
+	static unsigned int getShutdownState(vOP &vop, unsigned int param, byte *error) {
+		// Simply return the state of the shutdown.
+		return vop.shutdown_request_mode[vop.selected_channel];
+	}
+
+	static unsigned int cancelShutdown(vOP &vop, unsigned int param, byte *error) {
+		// Cancel a shutdown that's in progress.
+		byte ch = vop.selected_channel;
+		if (vop.shutdown_request_mode[ch]) {
+			vop.recordEvent(EVENT_SHUTDOWN_CANCELLED, 0, ch);
+		}
+		vop.shutdown_request_mode[ch] = false;
+		vop.shutdown_request_at[ch] = 0;
+		vop.disarmTimer(VOP_TIMER_SHUTDOWN_REQUEST(ch));
+		return 0;
+	}
+
+	static unsigned int setSleep(vOP &vop, unsigned int param, byte *error) {
+		// Turn sleep mode on or off.
+		vop.setSleepMode(param);
+		return 0;
+	}
+
+	static unsigned int getSleepMinutes(vOP &vop, unsigned int param, byte *error) {
+		// How long have we been asleep?
+		return vop.sleepMillis() / 60000UL;
+	}
+
+	static unsigned int getAwakeMinutes(vOP &vop, unsigned int param, byte *error) {
+		// And how long have we been awake?
+		return vop.awakeMillis() / 60000UL;
+	}
+
+	static unsigned int getInputs(vOP &vop, unsigned int param, byte *error) {
+		// The debounced state of every watched input, as the bits of the port.
+		return vop.debouncer.state();
+	}
+
+	static unsigned int setDeferred(vOP &vop, unsigned int param, byte *error) {
+		// Run commands from loop() instead of the interrupt (takes effect from the next command.)
+		vop.setDeferredMode(param);
+		return 0;
+	}
+
+	static unsigned int getQueueStats(vOP &vop, unsigned int param, byte *error) {
+		// The deepest the command ring has been, and how many commands it had to turn away.
+		return ((unsigned int)vop.queue_high_water << 8) | vop.queue_overflows;
+	}
+
+	static unsigned int getIsrMicros(vOP &vop, unsigned int param, byte *error) {
+		// The longest we've spent in an i2c event. A first param of 1 resets it (after reading.)
+		unsigned int result = vop.isr_max_micros;
+		if (param) {
+			vop.isr_max_micros = 0;
+		}
+		return result;
+	}
+
+	static unsigned int setAttention(vOP &vop, unsigned int param, byte *error) {
+		// Choose which events pull the attention line, and send back the old choice.
+		byte old = vop.attention_mask;
+		vop.attention_mask = param;
+		return old;
+	}
+
+	static unsigned int selectChannel(vOP &vop, unsigned int param, byte *error) {
+		// Point the commands after this one at another channel, and send back the one it was.
+		byte old = vop.selected_channel;
+		if (param >= VOP_CHANNELS) {
+			*error = ERR_CHANNEL_RANGE;
+		} else {
+			vop.selected_channel = param;
+		}
+		return old;
+	}
+
+	static unsigned int getTuning(vOP &vop, unsigned int param, byte *error) {
+		// Send back one of the timings, and select it for CMD_SET_TUNING.
+		if (param >= TUNE_COUNT) {
+			*error = ERR_TUNING_RANGE;
+			return 0;
+		}
+		vop.tuning_selected = param;
+		return vop.getTuning(param);
+	}
+
+	static unsigned int setTuning(vOP &vop, unsigned int param, byte *error) {
+		// Set the selected timing, and send back what it is now.
+		*error = vop.setTuning(vop.tuning_selected, param);
+		return vop.getTuning(vop.tuning_selected);
+	}
+
+	static unsigned int resetTuning(vOP &vop, unsigned int param, byte *error) {
+		// Back to how we were built.
+		vop.resetTuning();
+		return 0;
+	}
+
+	static unsigned int getBootStats(vOP &vop, unsigned int param, byte *error) {
+		// What we've learned about how long the selected channel takes to boot.
+		byte ch = vop.selected_channel;
+		switch (param) {
+			case BOOT_STAT_MEAN: return vop.boot_mean[ch];
+			case BOOT_STAT_DEVIATION: return vop.boot_deviation[ch];
+			case BOOT_STAT_SAMPLES: return vop.boot_samples[ch];
+			case BOOT_STAT_LAST: return vop.boot_last[ch];
+			case BOOT_STAT_TIMEOUT: return (vop.bootTimeout(ch) + 999) / 1000;
+		}
+		*error = ERR_TUNING_RANGE;
+		return 0;
+	}
+
+	static unsigned int resetBootStats(vOP &vop, unsigned int param, byte *error) {
+		// Forget them, and start learning again.
+		vop.resetBootStats(vop.selected_channel);
+		return 0;
+	}
+
+	static unsigned int getDipStats(vOP &vop, unsigned int param, byte *error) {
+		// How the selected channel's ignition has been dipping. A second param of 1 zeroes them (after reading.)
+		byte ch = vop.selected_channel;
+		unsigned int result = 0;
+		switch (param >> 8) {
+			case DIP_STAT_COUNT: result = vop.dip_count[ch]; break;
+			case DIP_STAT_LONGEST: result = vop.dip_longest[ch]; break;
+			case DIP_STAT_LAST: result = vop.dip_last[ch]; break;
+			default: *error = ERR_TUNING_RANGE; return 0;
+		}
+		if (param & 0xFF) {
+			vop.dip_count[ch] = 0;
+			vop.dip_longest[ch] = 0;
+			vop.dip_last[ch] = 0;
+		}
+		return result;
+	}
+
+	static unsigned int getResetStats(vOP &vop, unsigned int param, byte *error) {
+		// How often we've kept the power on through a reset. A second param of 1 zeroes the counts (after reading.)
+		unsigned int result = 0;
+		switch (param >> 8) {
+			case RESET_STAT_WARM: result = vop.warm_resets; break;
+			case RESET_STAT_FALLBACK: result = vop.fallback_resets; break;
+			case RESET_STAT_LAST: result = vop.reset_kind; break;
+			default: *error = ERR_TUNING_RANGE; return 0;
+		}
+		if (param & 0xFF) {
+			vop.warm_resets = 0;
+			vop.fallback_resets = 0;
+			vop.saveResetStats();
+		}
+		return result;
+	}
+
+#if VOP_SUPPLY
+	static unsigned int getSupply(vOP &vop, unsigned int param, byte *error) {
+		// The supply voltage (millivolts.) A second param of 1 starts the minimum over (after reading.)
+		if (vop.supply_pin == PIN_NONE) {
+			*error = ERR_COMMAND_UNKNOWN;
+			return 0;
+		}
+		unsigned int result = 0;
+		switch (param >> 8) {
+			case SUPPLY_STAT_MILLIVOLTS: result = vop.supply.millivolts(); break;
+			case SUPPLY_STAT_READING: result = vop.supply.reading(); break;
+			case SUPPLY_STAT_MINIMUM: result = vop.supply.minimum(); break;
+			case SUPPLY_STAT_LOW: result = vop.supply_low; break;
+			default: *error = ERR_TUNING_RANGE; return 0;
+		}
+		if (param & 0xFF) {
+			vop.supply.resetMinimum();
+		}
+		return result;
+	}
+#endif
+
+	static unsigned int halting(vOP &vop, unsigned int param, byte *error) {
+		// The Pi's shutting down, watch for it to finish.
+		byte ch = vop.selected_channel;
+		if (vop.raspberry_power[ch] && vop.halt_state[ch] == HALT_NONE) {
+			vop.halt_state[ch] = HALT_ANNOUNCED;
+			vop.watchHalt();
+		}
+		return 0;
+	}
+
+	static unsigned int halted(vOP &vop, unsigned int param, byte *error) {
+		// Its last words. Give it a moment to finish, then cut the power.
+		byte ch = vop.selected_channel;
+		if (vop.halt_state[ch] != HALT_CONFIRMED) {
+			vop.confirmHalt(ch, HALT_BY_COMMAND, vop_hal_millis() + HALT_GRACE_INTERVAL);
+		}
+		return 0;
+	}
+
+	// --------------------- DEBUG METHODS
+
+	static unsigned int debugSetIgnDetect(vOP &vop, unsigned int param, byte *error) {
+		// Set the ignition detect according to the first param
+		vop.debug_ign_debounce = param;
+		if (vop.debug_ign_debounce) {
+			vop.armTimer(VOP_TIMER_DEBOUNCE, vop_hal_millis());
+		} else {
+			vop.disarmTimer(VOP_TIMER_DEBOUNCE);
+		}
+		return 0;
+	}
+
+	static unsigned int debugSetIgnState(vOP &vop, unsigned int param, byte *error) {
+		// Set the ignition state according to the first param
+		byte ch = vop.selected_channel;
+		vop.ignition_dipping[ch] = false;
+		if (vop.ignition_state[ch] != param) {
+			vop.debouncer.latch(vop.ignition_bit[ch], param ? vop.ignition_bit[ch] : 0);
+			vop.latchIgnition(ch, param, vop_hal_millis());
+		}
+		return 0;
+	}
+
+	static unsigned int debugGetIgnDetect(vOP &vop, unsigned int param, byte *error) {
+		// Get the ignition detect
+		return vop.debug_ign_debounce;
+	}
+
+	static unsigned int debugGetTestValue(vOP &vop, unsigned int param, byte *error) {
+		// Get the test value, usefully for debugging discrete values.
+		return vop.test;
+	}
+
+	static unsigned int debugGetWdtState(vOP &vop, unsigned int param, byte *error) {
+		return vop.watchdog_state[vop.selected_channel];
+	}
+
+	// --------------------- end DEBUG METHODS
+
+};
+
+// --------------------------------------------------------------------------
+// -- The dispatch table.
+// In opcode order, CMD_FIRST to CMD_LAST and then CMD_DEBUG_FIRST to CMD_DEBUG_LAST, so
+// finding a command is just arithmetic. CMD_BATCH and CMD_READ_REGISTERS shape the whole
+// exchange, so fillRequest() handles those, and they have no handler here.
+
+static const vOPCommand vop_commands[] PROGMEM = {
+	VOP_COMMAND(CMD_GET_IGNITION_STATE, PARAM_NONE, RESPONSE_INT, vOPCommands::getIgnitionState),
+	VOP_COMMAND(CMD_GET_LAST_IGNITION_CHANGE_SECONDS, PARAM_NONE, RESPONSE_INT, vOPCommands::getLastIgnitionChangeSeconds),
+	VOP_COMMAND(CMD_GET_LAST_IGNITION_CHANGE_MINUTES, PARAM_NONE, RESPONSE_INT, vOPCommands::getLastIgnitionChangeMinutes),
+	VOP_COMMAND(CMD_ECHO, PARAM_WORD, RESPONSE_INT, vOPCommands::echo),
+	VOP_COMMAND(CMD_PAT_WATCHDOG, PARAM_NONE, RESPONSE_NONE, vOPCommands::patWatchdog),
+	VOP_COMMAND(CMD_SET_WATCHDOG, PARAM_SECOND, RESPONSE_NONE, vOPCommands::setWatchdog),
+	VOP_COMMAND(CMD_GET_WATCHDOG, PARAM_NONE, RESPONSE_INT, vOPCommands::getWatchdog),
+	VOP_COMMAND(CMD_REQUEST_SHUTDOWN_SECONDS, PARAM_INT, RESPONSE_NONE, vOPCommands::requestShutdownSeconds),
+	VOP_COMMAND(CMD_REQUEST_SHUTDOWN_MINUTES, PARAM_INT, RESPONSE_NONE, vOPCommands::requestShutdownMinutes),
+	VOP_COMMAND(CMD_GET_SHUTDOWN_STATE, PARAM_NONE, RESPONSE_INT, vOPCommands::getShutdownState),
+	VOP_COMMAND(CMD_CANCEL_SHUTDOWN, PARAM_NONE, RESPONSE_NONE, vOPCommands::cancelShutdown),
+	VOP_COMMAND(CMD_SET_SLEEP, PARAM_SECOND, RESPONSE_NONE, vOPCommands::setSleep),
+	VOP_COMMAND(CMD_GET_SLEEP_MINUTES, PARAM_NONE, RESPONSE_INT, vOPCommands::getSleepMinutes),
+	VOP_COMMAND(CMD_GET_AWAKE_MINUTES, PARAM_NONE, RESPONSE_INT, vOPCommands::getAwakeMinutes),
+	VOP_COMMAND(CMD_GET_INPUTS, PARAM_NONE, RESPONSE_INT, vOPCommands::getInputs),
+	VOP_COMMAND_NONE(CMD_BATCH),
+	VOP_COMMAND_NONE(CMD_READ_REGISTERS),
+	VOP_COMMAND(CMD_SET_DEFERRED, PARAM_SECOND, RESPONSE_NONE, vOPCommands::setDeferred),
+	VOP_COMMAND(CMD_GET_QUEUE_STATS, PARAM_NONE, RESPONSE_INT, vOPCommands::getQueueStats),
+	VOP_COMMAND(CMD_GET_ISR_MICROS, PARAM_FIRST, RESPONSE_INT, vOPCommands::getIsrMicros),
+	VOP_COMMAND_NONE(CMD_TAGGED),
+	VOP_COMMAND_NONE(CMD_FETCH_TAG),
+	VOP_COMMAND_NONE(CMD_GET_EVENTS),
+	VOP_COMMAND_NONE(CMD_READ_JOURNAL),
+	VOP_COMMAND(CMD_SET_ATTENTION, PARAM_FIRST, RESPONSE_INT, vOPCommands::setAttention),
+	VOP_COMMAND_NONE(CMD_READ_STATS),
+	VOP_COMMAND(CMD_SELECT_CHANNEL, PARAM_FIRST, RESPONSE_INT, vOPCommands::selectChannel),
+	VOP_COMMAND(CMD_GET_TUNING, PARAM_FIRST, RESPONSE_INT, vOPCommands::getTuning),
+	VOP_COMMAND(CMD_SET_TUNING, PARAM_INT, RESPONSE_INT, vOPCommands::setTuning),
+	VOP_COMMAND(CMD_RESET_TUNING, PARAM_NONE, RESPONSE_NONE, vOPCommands::resetTuning),
+	VOP_COMMAND(CMD_GET_BOOT_STATS, PARAM_FIRST, RESPONSE_INT, vOPCommands::getBootStats),
+	VOP_COMMAND(CMD_RESET_BOOT_STATS, PARAM_NONE, RESPONSE_NONE, vOPCommands::resetBootStats),
+	VOP_COMMAND(CMD_HALTING, PARAM_NONE, RESPONSE_NONE, vOPCommands::halting),
+	VOP_COMMAND(CMD_HALTED, PARAM_NONE, RESPONSE_NONE, vOPCommands::halted),
+	VOP_COMMAND(CMD_GET_DIP_STATS, PARAM_WORD, RESPONSE_INT, vOPCommands::getDipStats),
+	VOP_COMMAND(CMD_GET_RESET_STATS, PARAM_WORD, RESPONSE_INT, vOPCommands::getResetStats),
+#if VOP_SUPPLY
+	VOP_COMMAND(CMD_GET_SUPPLY, PARAM_WORD, RESPONSE_INT, vOPCommands::getSupply),
+#else
+	VOP_COMMAND_NONE(CMD_GET_SUPPLY),
+#endif
+	VOP_COMMAND_NONE(CMD_READ_SUPPLY),
+	VOP_COMMAND_NONE(CMD_READ_LOG),
+
+	VOP_COMMAND(CMD_DEBUG_SET_IGN_DETECT, PARAM_FIRST, RESPONSE_NONE, vOPCommands::debugSetIgnDetect),
+	VOP_COMMAND(CMD_DEBUG_SET_IGN_STATE, PARAM_FIRST, RESPONSE_NONE, vOPCommands::debugSetIgnState),
+	VOP_COMMAND(CMD_DEBUG_GET_IGN_DETECT, PARAM_NONE, RESPONSE_INT, vOPCommands::debugGetIgnDetect),
+	VOP_COMMAND(CMD_DEBUG_GET_TEST_VALUE, PARAM_NONE, RESPONSE_INT, vOPCommands::debugGetTestValue),
+	VOP_COMMAND(CMD_DEBUG_GET_WDT_STATE, PARAM_NONE, RESPONSE_INT, vOPCommands::debugGetWdtState)
+};
+
+// findCommand() indexes straight in, so a missing (or extra) row would have it reading past the end.
+static_assert(sizeof(vop_commands) / sizeof(vop_commands[0]) == (CMD_LAST - CMD_FIRST + 1) + (CMD_DEBUG_LAST - CMD_DEBUG_FIRST + 1),
+	"vop_commands needs exactly one row for every opcode, CMD_FIRST to CMD_LAST and CMD_DEBUG_FIRST to CMD_DEBUG_LAST");
+
+// The sketch's own commands, if it has any. (Weak, so they're simply null when it doesn't.)
+extern const vOPCommand vop_user_commands[] __attribute__((weak));
+extern const byte vop_user_command_count __attribute__((weak));
+
+// -- findCommand : Copy the table row for an opcode out of flash. False if there isn't one.
+
+static bool findCommand(byte cmd, vOPCommand *entry) {
+
+	const vOPCommand *row;
+
+	if (cmd >= CMD_FIRST && cmd <= CMD_LAST) {
+		row = &vop_commands[cmd - CMD_FIRST];
+	} else if (cmd >= CMD_DEBUG_FIRST && cmd <= CMD_DEBUG_LAST) {
+		row = &vop_commands[cmd - CMD_DEBUG_FIRST + (CMD_LAST - CMD_FIRST + 1)];
+	} else if (cmd >= CMD_USER_FIRST && cmd <= CMD_USER_LAST && &vop_user_command_count && cmd - CMD_USER_FIRST < vop_user_command_count) {
+		row = &vop_user_commands[cmd - CMD_USER_FIRST];
+	} else {
+		return false;
+	}
+
+	memcpy_P(entry, row, sizeof(vOPCommand));
+	return entry->opcode == cmd && entry->handler;
+
+}
+
+// --------------------------------------------------------------------------
+// -- runCommand: Execute a single command, with its two parameter bytes.
+// Fills in the two bytes to return, and returns the error (0 if it went fine.)
+
+byte vOP::runCommand(byte cmd, byte *params, byte *return_buffer) {
+
+	vOPCommand entry;
+	byte error = 0;
+	unsigned int result_data = 0;
+
+	return_buffer[0] = 0;
+	return_buffer[1] = 0;
+
+	if (!findCommand(cmd, &entry)) {
+		// Command is unknown.
+		STATS_ERROR(ERR_COMMAND_UNKNOWN);
+		return ERR_COMMAND_UNKNOWN;
+	}
+
+	// Unpack the parameters the way this command wants them.
+	unsigned int param_data = 0;
+	switch (entry.params) {
+		case PARAM_FIRST:
+			param_data = params[0];
+			break;
+		case PARAM_SECOND:
+			param_data = params[1];
+			break;
+		case PARAM_INT:
+			param_data = paramsToInt(params[0],params[1]);
+			break;
+		case PARAM_WORD:
+			param_data = ((unsigned int)params[0] << 8) | params[1];
+			break;
+	}
+
+	result_data = entry.handler(*this, param_data, &error);
+	if (error) {
+		STATS_ERROR(error);
+	}
+
+	// Go ahead and convert that integer result_data down into a byte array. (if the command returns one)
+	// http://stackoverflow.com/questions/3784263/converting-an-int-into-a-4-byte-char-array-c
+	if (entry.response == RESPONSE_INT) {
+		return_buffer[0] = (result_data >> 8) & 0xFF;
+		return_buffer[1] = result_data & 0xFF;
+	}
+
+	return error;
+
+}
+
+// --------------------------------------------------------------------------
+// -- Deferred commands.
+// Instead of running commands inside the i2c interrupt, receiveData() parses them into a
+// ring (the interrupt is its only writer, and loop() its only reader, so no locks needed.)
+// loop() runs them, builds the results into the spare response slot, and flips it in.
+// fillRequest() then only has to copy the published slot out. Until the result for the
+// latest command is published, a read gets ERR_RESULT_PENDING, and the Pi reads again.
+
+void vOP::setDeferredMode(bool enabled) {
+
+	deferred_mode = enabled;
+
+}
+
+// -- queueCommand : Put the command we just received into the ring. (from receiveData)
+
+void vOP::queueCommand() {
+
+	// A batch goes in as one entry per command, a single command as just the one.
+	byte count = 1;
+	byte *params = param_buffer;
+	if (command == CMD_TAGGED) {
+		params = &batch_buffer[2];
+	} else if (command == CMD_BATCH) {
+		if (batch_length != batch_count * 3 || batch_count == 0) {
+			error_flag = ERR_COMMAND_INCOMPLETE;
+			return;
+		}
+		count = batch_count;
+	}
+
+	// Is there room for all of it?
+	byte used = (queue_head - queue_tail) & (COMMAND_QUEUE_SIZE - 1);
+	if (used + count > COMMAND_QUEUE_SIZE - 1) {
+		error_flag = ERR_QUEUE_FULL;
+		if (queue_overflows < 0xFF) {
+			queue_overflows++;
+		}
+		return;
+	}
+
+	// Tagged commands have their own results table, so they don't count as the latest frame.
+	if (command != CMD_TAGGED) {
+		queued_frame++;
+	}
+	byte head = queue_head;
+	for (byte i = 0; i < count; i++) {
+
+		vOPQueuedCommand *entry = &command_queue[head];
+		if (command == CMD_TAGGED) {
+			entry->command = batch_buffer[1];
+			entry->frame = batch_buffer[0];
+			entry->flags = QUEUED_TAGGED;
+		} else {
+			if (command == CMD_BATCH) {
+				entry->command = batch_buffer[i * 3];
+				params = &batch_buffer[i * 3 + 1];
+			} else {
+				entry->command = command;
+			}
+			entry->frame = queued_frame;
+			entry->flags = (i == 0 ? QUEUED_FIRST : 0) | (i == count - 1 ? QUEUED_LAST : 0);
+		}
+		entry->params[0] = params[0];
+		entry->params[1] = params[1];
+
+		head = (head + 1) & (COMMAND_QUEUE_SIZE - 1);
+
+	}
+
+	// Only now does loop() get to see them, all at once.
+	queue_head = head;
+
+	used += count;
+	if (used > queue_high_water) {
+		queue_high_water = used;
+	}
+
+}
+
+// -- runQueuedCommands : Run everything in the ring, and publish the results. (from loop)
+
+void vOP::runQueuedCommands() {
+
+	while (queue_tail != queue_head) {
+
+		vOPQueuedCommand *entry = &command_queue[queue_tail];
+		vOPResponse *slot = &responses[response_front ^ 1];
+
+		// Tagged commands file their result under their tag, instead.
+		if (entry->flags & QUEUED_TAGGED) {
+			byte result[4];
+			result[1] = entry->command;
+			result[0] = runCommand(entry->command, entry->params, &result[2]);
+			completeTagged(entry->frame, result);
+			armTimer(VOP_TIMER_STATUS, vop_hal_millis());
+			queue_tail = (queue_tail + 1) & (COMMAND_QUEUE_SIZE - 1);
+			continue;
+		}
+
+		if (entry->flags & QUEUED_FIRST) {
+			slot->length = 0;
+		}
+
+		byte *out = &slot->data[slot->length];
+		out[1] = entry->command;
+		out[0] = runCommand(entry->command, entry->params, &out[2]);
+		slot->length += 4;
+
+		// That's the whole frame? Then the Pi can have it.
+		if (entry->flags & QUEUED_LAST) {
+			slot->frame = entry->frame;
+			response_front ^= 1;
+			armTimer(VOP_TIMER_STATUS, vop_hal_millis());
+		}
+
+		queue_tail = (queue_tail + 1) & (COMMAND_QUEUE_SIZE - 1);
+
+	}
+
+}
+
+// --------------------------------------------------------------------------
+// -- Tagged commands.
+// Each tagged command carries a tag byte the Pi picks, and its result is kept under that tag
+// until the slot is needed again. So several processes can have commands in flight, and each
+// fetches its own result, however the writes and reads on the bus interleave.
+// Results are 5 bytes: the tag, then the usual error, command, result, result. Check the tag:
+// if another process's fetch got in between your write and read, you'll see theirs, so fetch again.
+// (A combined write and read, like I2C_RDWR, can't be split up that way.)
+
+// -- submitTagged : Claim a slot for the tag we just received, and run (or queue) it. (from receiveData)
+
+void vOP::submitTagged() {
+
+	if (batch_length != 4) {
+		error_flag = ERR_COMMAND_INCOMPLETE;
+		return;
+	}
+
+	byte tag = batch_buffer[0];
+
+	// Reuse the tag's slot if it has one, otherwise take the oldest.
+	vOPTaggedResult *slot = findTagged(tag);
+	if (!slot) {
+		slot = &tagged_results[tagged_next];
+		tagged_next = (tagged_next + 1) % TAGGED_RESULTS;
+	}
+	slot->tag = tag;
+	slot->state = TAG_PENDING;
+
+	if (deferred_mode) {
+		queueCommand();
+		if (error_flag) {
+			slot->state = TAG_EMPTY;
+		}
+	} else {
+		byte result[4];
+		result[1] = batch_buffer[1];
+		result[0] = runCommand(batch_buffer[1], &batch_buffer[2], &result[2]);
+		completeTagged(tag, result);
+	}
+
+}
+
+// -- completeTagged : File a result under its tag, if the tag still has a slot waiting.
+
+void vOP::completeTagged(byte tag, byte *result) {
+
+	byte state = vop_hal_interruptsOff();
+	vOPTaggedResult *slot = findTagged(tag);
+	if (slot && slot->state == TAG_PENDING) {
+		for (byte i = 0; i < 4; i++) {
+			slot->result[i] = result[i];
+		}
+		slot->state = TAG_DONE;
+	}
+	vop_hal_interruptsRestore(state);
+
+}
+
+vOPTaggedResult *vOP::findTagged(byte tag) {
+
+	for (byte i = 0; i < TAGGED_RESULTS; i++) {
+		if (tagged_results[i].state != TAG_EMPTY && tagged_results[i].tag == tag) {
+			return &tagged_results[i];
+		}
+	}
+	return 0;
+
+}
+
+// -- fillTaggedRequest : Send the result for a tag. (after CMD_TAGGED, or CMD_FETCH_TAG)
+
+void vOP::fillTaggedRequest() {
+
+	byte tag = (command == CMD_TAGGED) ? batch_buffer[0] : param_buffer[0];
+	vOPTaggedResult *slot = findTagged(tag);
+
+	byte writer[] = {tag,0,command,0,0};
+	if (!slot) {
+		writer[1] = ERR_TAG_UNKNOWN;
+		STATS_ERROR(ERR_TAG_UNKNOWN);
+	} else if (slot->state != TAG_DONE) {
+		writer[1] = ERR_RESULT_PENDING;
+		STATS_ERROR(ERR_RESULT_PENDING);
+	} else {
+		for (byte i = 0; i < 4; i++) {
+			writer[i + 1] = slot->result[i];
+		}
+	}
+	vop_hal_i2cWrite(writer,5);
+
+}
+
+// --------------------------------------------------------------------------
+// -- The event feed.
+// A ring of the last EVENT_RING_SIZE state changes, each numbered in sequence, so the Pi
+// can ask for what it hasn't seen yet instead of polling state that hasn't changed.
+
+// -- recordEvent : Add an event to the ring, pushing out the oldest if it's full.
+// The channel goes in the high nibble of the type.
+
+void vOP::recordEvent(byte type, byte arg, byte ch) {
+
+	// Commands record events from the i2c interrupt, too.
+	byte state = vop_hal_interruptsOff();
+
+	vOPEvent *event = &events[event_head];
+	event->sequence = ++event_sequence;
+	event->type = type | (ch << 4);
+	event->arg = arg;
+	event->time = vop_hal_millis();
+
+	event_head = (event_head + 1) % EVENT_RING_SIZE;
+	if (event_count < EVENT_RING_SIZE) {
+		event_count++;
+	}
+
+	// Should the Pi come and look?
+	if (attention_mask & attentionBit(type, arg)) {
+		setAttention(true);
+	}
+
+	vop_hal_interruptsRestore(state);
+
+	// Let the status block know there's something new.
+	armTimer(VOP_TIMER_STATUS, event->time);
+
+	// And the sketch, if it asked.
+	if (event_hook) {
+		event_hook(type, arg, ch);
+	}
+
+}
+
+// -- fillEventsRequest : Send the events after the sequence number in the parameters.
+
+void vOP::fillEventsRequest() {
+
+	byte writer[4 + EVENTS_PER_READ * 8];
+	byte flags = 0;
+	byte count = 0;
+
+	// Sequence numbers wrap, so everything's compared by difference.
+	unsigned int since = paramsToInt(param_buffer[0],param_buffer[1]);
+	unsigned int oldest = event_sequence - event_count + 1;
+	unsigned int next = since + 1;
+
+	if ((int)(next - oldest) < 0 || (int)(since - event_sequence) > 0) {
+		// They've fallen behind the ring (or we've restarted), so start from what we have.
+		if (event_count && since != 0) {
+			flags |= EVENTS_MISSED;
+		}
+		next = oldest;
+	}
+
+	while (count < EVENTS_PER_READ && event_count && (int)(next - event_sequence) <= 0) {
+
+		// How far back from the newest is it?
+		byte back = event_sequence - next;
+		vOPEvent *event = &events[(event_head + EVENT_RING_SIZE - 1 - back) % EVENT_RING_SIZE];
+
+		byte *out = &writer[4 + count * 8];
+		out[0] = event->sequence >> 8;
+		out[1] = event->sequence & 0xFF;
+		out[2] = event->type;
+		out[3] = event->arg;
+		out[4] = (event->time >> 24) & 0xFF;
+		out[5] = (event->time >> 16) & 0xFF;
+		out[6] = (event->time >> 8) & 0xFF;
+		out[7] = event->time & 0xFF;
+
+		count++;
+		next++;
+
+	}
+
+	if (event_count && (int)(next - event_sequence) <= 0) {
+		flags |= EVENTS_MORE;
+	} else {
+		// They've seen everything, so they don't need poking any more.
+		setAttention(false);
+	}
+
+	writer[0] = 0;
+	writer[1] = CMD_GET_EVENTS;
+	writer[2] = count;
+	writer[3] = flags;
+	vop_hal_i2cWrite(writer,4 + count * 8);
+
+}
+
+unsigned int vOP::eventSequence() {
+
+	return event_sequence;
+
+}
+
+// -- setEventHook : Have hook called with every event, as it's recorded, for the sketch to act on.
+// Some come from commands, so it can be called in the i2c interrupt: keep it short. 0 to stop.
+
+void vOP::setEventHook(void (*hook)(byte type, byte arg, byte ch)) {
+
+	event_hook = hook;
+
+}
+
+#if VOP_INSTRUMENT
+// --------------------------------------------------------------------------
+// -- The instrumentation.
+// Only built with VOP_INSTRUMENT, see vOPInstrument.h and CMD_READ_STATS.
+
+// -- countError : Count an error code being raised.
+
+void vOP::countError(byte error) {
+
+	if (error >= STATS_ERRORS) {
+		error = STATS_ERRORS - 1;
+	}
+	if (stats_errors[error] != 0xFFFF) {
+		stats_errors[error]++;
+	}
+
+}
+
+// -- countCommand : Count a command arriving, by opcode.
+
+void vOP::countCommand(byte cmd) {
+
+	byte slot = STATS_COMMANDS - 1;
+	if (cmd >= CMD_FIRST && cmd - CMD_FIRST < STATS_COMMANDS - 1) {
+		slot = cmd - CMD_FIRST;
+	}
+	if (stats_commands[slot] != 0xFFFF) {
+		stats_commands[slot]++;
+	}
+
+}
+
+// -- statsWord : Find the 16 bit value at an index, after the header. Null past the end.
+
+unsigned int *vOP::statsWord(unsigned int index) {
+
+	if (index < STATS_HISTOGRAMS * HISTOGRAM_BUCKETS) {
+		return &stats_histograms[index / HISTOGRAM_BUCKETS].buckets[index % HISTOGRAM_BUCKETS];
+	}
+	index -= STATS_HISTOGRAMS * HISTOGRAM_BUCKETS;
+	if (index < STATS_ERRORS) {
+		return &stats_errors[index];
+	}
+	index -= STATS_ERRORS;
+	if (index < STATS_COMMANDS) {
+		return &stats_commands[index];
+	}
+	return 0;
+
+}
+
+// -- fillStatsRequest : Send the next 32 bytes of the stats, zeroing each value as it goes if asked.
+
+void vOP::fillStatsRequest() {
+
+	byte writer[32];
+	byte length = 0;
+
+	while (length < sizeof(writer)) {
+
+		if (stats_offset < STATS_HEADER_SIZE) {
+			byte header[STATS_HEADER_SIZE] = {STATS_VERSION, STATS_HISTOGRAMS, HISTOGRAM_BUCKETS, STATS_ERRORS, STATS_COMMANDS, CMD_FIRST};
+			writer[length++] = header[stats_offset++];
+			continue;
+		}
+
+		unsigned int *word = statsWord((stats_offset - STATS_HEADER_SIZE) / 2);
+		if (!word) {
+			break;
+		}
+
+		// The header and the reads are both even, so a value is never split across reads.
+		writer[length++] = *word >> 8;
+		writer[length++] = *word & 0xFF;
+		if (stats_reset) {
+			*word = 0;
+		}
+		stats_offset += 2;
+
+	}
+
+	vop_hal_i2cWrite(writer, length);
+
+}
+#endif
+
+// --------------------------------------------------------------------------
+// -- The attention line.
+
+// -- setAttentionPin : Drive the attention line on this pin. It's open drain, the Pi pulls it up.
+
+void vOP::setAttentionPin(byte pin) {
+
+	attention_pin = pin;
+	attention_asserted = false;
+	vop_hal_pinMode(pin, INPUT);
+
+}
+
+// -- attentionBit : Which ATTENTION_ bit an event falls under, if any.
+
+byte vOP::attentionBit(byte type, byte arg) {
+
+	switch (type) {
+		case EVENT_IGNITION:
+			return ATTENTION_IGNITION;
+		case EVENT_SHUTDOWN_DUE:
+			return ATTENTION_SHUTDOWN_DUE;
+		case EVENT_WATCHDOG:
+			return arg == WATCHDOG_STATE_SHUTDOWN ? ATTENTION_WATCHDOG_SHUTDOWN : 0;
+		case EVENT_RELAY:
+			return ATTENTION_RELAY;
+		case EVENT_SUPPLY:
+			return ATTENTION_SUPPLY;
+	}
+	return 0;
+
+}
+
+// -- setAttention : Pull the line low, or let it go.
+// Open drain: the pin's low whenever it's an output, and floats as an input.
+
+void vOP::setAttention(bool asserted) {
+
+	if (attention_pin == ATTENTION_PIN_NONE || attention_asserted == asserted) {
+		return;
+	}
+	attention_asserted = asserted;
+	if (asserted) {
+		vop_hal_digitalWrite(attention_pin, LOW);
+		vop_hal_pinMode(attention_pin, OUTPUT);
+	} else {
+		vop_hal_pinMode(attention_pin, INPUT);
+	}
+
+}
+
+// --------------------------------------------------------------------------
+// -- The journal.
+// Records are queued straight away, and written to the EEPROM a byte at a time from loop().
+// Built without VOP_JOURNAL, journalLog() does nothing and the rest isn't there.
+
+// -- journalLog : Note a power cycle (or why), with the state of things right now.
+
+void vOP::journalLog(byte ch, byte cause) {
+
+#if VOP_JOURNAL
+	byte state = (watchdog_state[ch] & 0x07) | (ignition_state[ch] ? 0x10 : 0) | (raspberry_power[ch] ? 0x20 : 0) | (ch << 6);
+	uint32_t now = vop_hal_millis();
+	journal.log(cause, state, now / 1000);
+	armTimer(VOP_TIMER_EEPROM, now);
+#else
+	(void)ch;
+	(void)cause;
+#endif
+
+}
+
+#if VOP_JOURNAL
+
+// -- fillJournalRequest : Send the next records of a dump.
+
+void vOP::fillJournalRequest() {
+
+	byte writer[4 * JOURNAL_RECORD_SIZE];
+	vop_hal_i2cWrite(writer, journal.read(writer, sizeof(writer), vop_hal_millis()));
+
+}
+#endif
+
+// -- eepromHandler : Write the next byte of whatever's waiting, and come back when the EEPROM's ready for another.
+// The settings go first, they're what we want back after a reset.
+
+void vOP::eepromHandler() {
+
+	bool more = tuning.service();
+	if (!more) {
+		more = reset_stats.service();
+	}
+	if (!more) {
+		more = boot_stats.service();
+	}
+#if VOP_JOURNAL
+	if (!more) {
+		more = journal.service(vop_hal_millis());
+	}
+#endif
+	if (more) {
+		rearmTimer(VOP_TIMER_EEPROM, EEPROM_WRITE_INTERVAL);
+	} else {
+		disarmTimer(VOP_TIMER_EEPROM);
+	}
+
+}
+
+// --------------------------------------------------------------------------
+// -- Tuning.
+// Every timing in its TUNE_ units, checked against its bounds, and saved to the EEPROM when it's set.
+
+// -- getTuning : What one of them is now.
+
+unsigned int vOP::getTuning(byte id) {
+
+	switch (id) {
+		case TUNE_WATCHDOG_TIMEOUT: return watchdog_timeout_interval / 1000;
+		case TUNE_WATCHDOG_TURNOFF: return watchdog_turnoff_interval / 1000;
+		case TUNE_WATCHDOG_RUN: return watchdog_run_interval / 1000;
+		case TUNE_WATCHDOG_BOOT: return watchdog_boot_interval / 1000;
+		case TUNE_POWER_MINIMUM_OFF: return power_minimum_off_interval / 1000;
+		case TUNE_POWER_ON_STAGGER: return power_on_stagger;
+		case TUNE_DEBOUNCE_INTERVAL: return debounce_interval;
+		case TUNE_DEBOUNCE_ON_DEPTH: return debounce_on_depth;
+		case TUNE_IGNITION_HOLDOFF: return ignition_holdoff;
+		case TUNE_DEBOUNCE_OFF_DEPTH: return debounce_off_depth;
+		case TUNE_SUPPLY_CUTOFF: return supply_cutoff;
+	}
+	return 0;
+
+}
+
+// -- setTuning : Change one of them, save it, and have the timers take it up straight away.
+// Returns the error, or 0 if it's set.
+
+byte vOP::setTuning(byte id, unsigned int value) {
+
+	if (id >= TUNE_COUNT) {
+		return ERR_TUNING_RANGE;
+	}
+
+	unsigned int bounds[2];
+	memcpy_P(bounds, tuning_bounds[id], sizeof(bounds));
+	if (value < bounds[0] || value > bounds[1]) {
+		return ERR_TUNING_RANGE;
+	}
+
+	if (!applyTuning(id, value)) {
+		return ERR_TUNING_FIXED;
+	}
+	saveTuning();
+	rebaseTimers();
+	return 0;
+
+}
+
+// -- resetTuning : Put every one back to how we were built, and save that.
+
+void vOP::resetTuning() {
+
+	applyTuning(TUNE_WATCHDOG_TIMEOUT, VOP_WATCHDOG_TIMEOUT / 1000);
+	applyTuning(TUNE_WATCHDOG_TURNOFF, VOP_WATCHDOG_TURNOFF / 1000);
+	applyTuning(TUNE_WATCHDOG_RUN, VOP_WATCHDOG_RUN / 1000);
+	applyTuning(TUNE_WATCHDOG_BOOT, VOP_WATCHDOG_BOOT / 1000);
+	applyTuning(TUNE_POWER_MINIMUM_OFF, VOP_POWER_MINIMUM_OFF / 1000);
+	applyTuning(TUNE_POWER_ON_STAGGER, 0);
+	applyTuning(TUNE_DEBOUNCE_INTERVAL, CHECK_IGNITION_INTERVAL);
+	applyTuning(TUNE_DEBOUNCE_ON_DEPTH, CHECK_IGNITION_DEPTH);
+	applyTuning(TUNE_IGNITION_HOLDOFF, VOP_IGNITION_HOLDOFF);
+	applyTuning(TUNE_DEBOUNCE_OFF_DEPTH, CHECK_IGNITION_DEPTH);
+	applyTuning(TUNE_SUPPLY_CUTOFF, VOP_SUPPLY_CUTOFF);
+	saveTuning();
+	rebaseTimers();
+
+}
+
+// -- applyTuning : Put a value where it's used. False if it's out of bounds, or one we can't change.
+
+bool vOP::applyTuning(byte id, unsigned int value) {
+
+	if (id >= TUNE_COUNT) {
+		return false;
+	}
+	unsigned int bounds[2];
+	memcpy_P(bounds, tuning_bounds[id], sizeof(bounds));
+	if (value < bounds[0] || value > bounds[1]) {
+		return false;
+	}
+
+	switch (id) {
+#if VOP_FIXED_TIMING
+		case TUNE_WATCHDOG_TIMEOUT:
+		case TUNE_WATCHDOG_TURNOFF:
+		case TUNE_WATCHDOG_RUN:
+		case TUNE_WATCHDOG_BOOT:
+		case TUNE_POWER_MINIMUM_OFF:
+			return false;
+#else
+		case TUNE_WATCHDOG_TIMEOUT: watchdog_timeout_interval = value * 1000UL; break;
+		case TUNE_WATCHDOG_TURNOFF: watchdog_turnoff_interval = value * 1000UL; break;
+		case TUNE_WATCHDOG_RUN: watchdog_run_interval = value * 1000UL; break;
+		case TUNE_WATCHDOG_BOOT: watchdog_boot_interval = value * 1000UL; break;
+		case TUNE_POWER_MINIMUM_OFF: power_minimum_off_interval = value * 1000UL; break;
+#endif
+		case TUNE_POWER_ON_STAGGER: power_on_stagger = value; break;
+		case TUNE_DEBOUNCE_INTERVAL: debounce_interval = value; break;
+		case TUNE_DEBOUNCE_ON_DEPTH:
+			debounce_on_depth = value;
+			watchIgnitions();
+			break;
+		case TUNE_IGNITION_HOLDOFF: ignition_holdoff = value; break;
+		case TUNE_DEBOUNCE_OFF_DEPTH:
+			debounce_off_depth = value;
+			watchIgnitions();
+			break;
+		case TUNE_SUPPLY_CUTOFF: supply_cutoff = value; break;
+	}
+	return true;
+
+}
+
+// -- watchIgnitions : Watch the ignitions again at the depths we have now.
+// (Before setup() their bits are 0, and this does nothing.)
+
+void vOP::watchIgnitions() {
+
+	for (byte ch = 0; ch < VOP_CHANNELS; ch++) {
+		debouncer.watch(ignition_bit[ch], debounce_on_depth, debounce_off_depth);
+	}
+
+}
+
+// -- saveTuning : Write every one out, as they are now.
+
+void vOP::saveTuning() {
+
+	for (byte id = 0; id < TUNE_COUNT; id++) {
+		unsigned int value = getTuning(id);
+		tuning_block[id * 2] = value >> 8;
+		tuning_block[id * 2 + 1] = value & 0xFF;
+	}
+	tuning.save();
+	armTimer(VOP_TIMER_EEPROM, vop_hal_millis());
+
+}
+
+// -- rebaseTimers : Have everything that runs off a timing look again now.
+// Each handler works its own deadline out from the intervals, so bringing them forward is enough.
+
+void vOP::rebaseTimers() {
+
+	uint32_t now = vop_hal_millis();
+	byte state = vop_hal_interruptsOff();
+	vOPTimerMask armed = timer_armed;
+	vop_hal_interruptsRestore(state);
+
+	for (byte ch = 0; ch < VOP_CHANNELS; ch++) {
+		if (armed & VOP_TIMER_BIT(VOP_TIMER_WATCHDOG(ch))) {
+			armTimer(VOP_TIMER_WATCHDOG(ch), now);
+		}
+		if (armed & VOP_TIMER_BIT(VOP_TIMER_BOOTUP(ch))) {
+			armTimer(VOP_TIMER_BOOTUP(ch), now);
+		}
+	}
+	if (armed & VOP_TIMER_BIT(VOP_TIMER_DEBOUNCE)) {
+		armTimer(VOP_TIMER_DEBOUNCE, now);
+	}
+
+}
+
+// --------------------------------------------------------------------------
+// -- Boot learning.
+// The same smoothing TCP uses for its round trip times (Jacobson's): the mean moves an eighth
+// of the way to each new boot time, and the deviation a quarter of the way to how far that boot
+// was from the mean. Shifts, not multiplies, and no squares to overflow an int.
+
+// -- learnBootTime : Fold one boot (relay on to first pat, millis) into a channel's estimate.
+
+void vOP::learnBootTime(byte ch, uint32_t sample) {
+
+	if (sample > 0xFFFF) {
+		sample = 0xFFFF;
+	}
+	boot_last[ch] = sample;
+	boot_backoff[ch] = false;
+
+	if (!boot_samples[ch]) {
+		// The first one's all we know.
+		boot_mean[ch] = sample;
+		boot_deviation[ch] = sample / 2;
+	} else {
+		int32_t error = (int32_t)sample - boot_mean[ch];
+		boot_mean[ch] += error / 8;
+		if (error < 0) {
+			error = -error;
+		}
+		boot_deviation[ch] += (error - (int32_t)boot_deviation[ch]) / 4;
+	}
+	if (boot_samples[ch] < 255) {
+		boot_samples[ch]++;
+	}
+
+	saveBootStats();
+
+}
+
+// -- bootTimeout : How long we give a channel to boot. (millis)
+// What we've learned, between BOOT_LEARN_FLOOR and watchdog_boot_interval, once we trust it.
+
+uint32_t vOP::bootTimeout(byte ch) {
+
+	if (boot_samples[ch] < BOOT_LEARN_MIN_SAMPLES || boot_backoff[ch]) {
+		return watchdog_boot_interval;
+	}
+
+	uint32_t timeout = boot_mean[ch] + (uint32_t)boot_deviation[ch] * BOOT_LEARN_DEVIATIONS + BOOT_LEARN_MARGIN;
+	if (timeout < BOOT_LEARN_FLOOR) {
+		timeout = BOOT_LEARN_FLOOR;
+	}
+	if (timeout > watchdog_boot_interval) {
+		timeout = watchdog_boot_interval;
+	}
+	return timeout;
+
+}
+
+// -- resetBootStats : Forget what a channel's taught us.
+
+void vOP::resetBootStats(byte ch) {
+
+	boot_mean[ch] = 0;
+	boot_deviation[ch] = 0;
+	boot_samples[ch] = 0;
+	boot_last[ch] = 0;
+	boot_backoff[ch] = false;
+	saveBootStats();
+
+}
+
+// -- saveBootStats : Write every channel's out, as they are now.
+
+void vOP::saveBootStats() {
+
+	for (byte ch = 0; ch < VOP_CHANNELS; ch++) {
+		byte *saved = &boot_stats_block[ch * BOOT_STAT_BYTES];
+		saved[0] = boot_mean[ch] >> 8;
+		saved[1] = boot_mean[ch] & 0xFF;
+		saved[2] = boot_deviation[ch] >> 8;
+		saved[3] = boot_deviation[ch] & 0xFF;
+		saved[4] = boot_samples[ch];
+	}
+	boot_stats.save();
+	armTimer(VOP_TIMER_EEPROM, vop_hal_millis());
+
+}
+
+// --------------------------------------------------------------------------
+// -- Warm resets.
+// See "Resets" at the top, and the warm state in vOP.h.
+
+// -- warmStateValid : Is what's in the warm state ours, and whole?
+
+bool vOP::warmStateValid() {
+
+	if (vop_warm_state.magic != WARM_STATE_MAGIC || vop_warm_state.length != sizeof(vOPWarmState)) {
+		return false;
+	}
+	if (vop_warm_state.crc != warmStateCrc()) {
+		return false;
+	}
+	for (byte ch = 0; ch < VOP_CHANNELS; ch++) {
+		vOPWarmChannel *saved = &vop_warm_state.channels[ch];
+		if (saved->watchdog_state > WATCHDOG_STATE_IDLE || saved->halt_state > HALT_CONFIRMED) {
+			return false;
+		}
+	}
+	return true;
+
+}
+
+// -- warmStateCrc : The CRC of the warm state, up to its crc. (A channel at a time, the whole lot can be more than a byte long.)
+
+byte vOP::warmStateCrc() {
+
+	const byte *bytes = (const byte *)&vop_warm_state;
+	byte crc = vOPSettings::crc8(bytes, (const byte *)vop_warm_state.channels - bytes, 0);
+	for (byte ch = 0; ch < VOP_CHANNELS; ch++) {
+		crc = vOPSettings::crc8((const byte *)&vop_warm_state.channels[ch], sizeof(vOPWarmChannel), crc);
+	}
+	return crc;
+
+}
+
+// -- saveWarmState : Copy everything a reset would lose into the warm state.
+// And if which channels are on (or watched) changed, that goes to the EEPROM too, for when RAM doesn't make it.
+// A channel counts as on while its ignition is, even between a watchdog's power cut and the boot after it
+// (it's only a few seconds, and it's coming back on anyway), so a Pi that keeps failing doesn't wear the EEPROM.
+
+void vOP::saveWarmState() {
+
+	byte powered = 0;
+	byte state = vop_hal_interruptsOff();
+	vop_warm_state.magic = WARM_STATE_MAGIC;
+	vop_warm_state.length = sizeof(vOPWarmState);
+	vop_warm_state.saved_at = vop_hal_millis();
+	for (byte ch = 0; ch < VOP_CHANNELS; ch++) {
+		vOPWarmChannel *saved = &vop_warm_state.channels[ch];
+		saved->flags = (raspberry_power[ch] ? WARM_POWER : 0) | (ignition_state[ch] ? WARM_IGNITION : 0) |
+			(watchdog_mode[ch] ? WARM_WATCHDOG_MODE : 0) | (shutdown_request_mode[ch] ? WARM_SHUTDOWN_REQUEST : 0);
+		saved->watchdog_state = watchdog_state[ch];
+		saved->halt_state = halt_state[ch];
+		saved->halt_by = halt_by[ch];
+		saved->ignition_delta_time = ignition_delta_time[ch];
+		saved->watchdog_last_pat = watchdog_last_pat[ch];
+		saved->watchdog_turnoff_time = watchdog_turnoff_time[ch];
+		saved->watchdog_boot_time = watchdog_boot_time[ch];
+		saved->shutdown_request_at = shutdown_request_at[ch];
+		saved->halt_cut_at = halt_cut_at[ch];
+		saved->power_minimum_off_time = power_minimum_off_time[ch];
+		powered |= (raspberry_power[ch] || ignition_state[ch] ? 0x01 : 0) << ch;
+		powered |= (watchdog_mode[ch] ? 0x10 : 0) << ch;
+	}
+	vop_hal_interruptsRestore(state);
+	// Nothing but us touches the copy, so the CRC can wait until the i2c interrupt's allowed back.
+	vop_warm_state.crc = warmStateCrc();
+
+	if (powered != reset_stats_block[0]) {
+		saveResetStats();
+	}
+
+}
+
+// -- restoreWarmState : Put everything back as it was when the warm state was saved.
+// The times move up by however long ago that was, so nothing jumps.
+
+void vOP::restoreWarmState(uint32_t now) {
+
+	uint32_t shift = now - vop_warm_state.saved_at;
+	for (byte ch = 0; ch < VOP_CHANNELS; ch++) {
+		vOPWarmChannel *saved = &vop_warm_state.channels[ch];
+		raspberry_power[ch] = (saved->flags & WARM_POWER) != 0;
+		ignition_state[ch] = (saved->flags & WARM_IGNITION) != 0;
+		watchdog_mode[ch] = (saved->flags & WARM_WATCHDOG_MODE) != 0;
+		shutdown_request_mode[ch] = (saved->flags & WARM_SHUTDOWN_REQUEST) != 0;
+		watchdog_state[ch] = saved->watchdog_state;
+		halt_state[ch] = saved->halt_state;
+		halt_by[ch] = saved->halt_by;
+		ignition_delta_time[ch] = saved->ignition_delta_time + shift;
+		watchdog_last_pat[ch] = saved->watchdog_last_pat + shift;
+		watchdog_turnoff_time[ch] = saved->watchdog_turnoff_time + shift;
+		watchdog_boot_time[ch] = saved->watchdog_boot_time + shift;
+		shutdown_request_at[ch] = saved->shutdown_request_at + shift;
+		halt_cut_at[ch] = saved->halt_cut_at + shift;
+		power_minimum_off_time[ch] = saved->power_minimum_off_time + shift;
+	}
+
+}
+
+// -- restoreFallback : Keep on the channels the EEPROM says were on, if their ignition still is.
+// (If it's off, they might have been off for hours, and powering them now would only start a boot
+// that it'd have to shut down again.) Returns true if any were.
+
+bool vOP::restoreFallback(uint32_t now) {
+
+	bool restored = false;
+	for (byte ch = 0; ch < VOP_CHANNELS; ch++) {
+		if (!(reset_stats_block[0] & (0x01 << ch)) || ignition_pin[ch] == PIN_NONE) {
+			continue;
+		}
+		vop_hal_pinMode(ignition_pin[ch], INPUT);
+		if (vop_hal_digitalRead(ignition_pin[ch]) != HIGH) {
+			continue;
+		}
+		raspberry_power[ch] = true;
+		ignition_state[ch] = true;
+		ignition_delta_time[ch] = now;
+		watchdog_mode[ch] = (reset_stats_block[0] & (0x10 << ch)) != 0;
+		if (watchdog_mode[ch]) {
+			// We don't know where it is, so it gets as long as any boot, and we don't learn from it.
+			watchdog_state[ch] = WATCHDOG_STATE_BOOTING;
+			watchdog_boot_time[ch] = now;
+			boot_backoff[ch] = true;
+			boot_unknown[ch] = true;
+		}
+		restored = true;
+	}
+	return restored;
+
+}
+
+// -- resetKind : How we came back from the last reset. (RESET_ in vOP.h)
+
+byte vOP::resetKind() {
+
+	return reset_kind;
+
+}
+
+// -- saveResetStats : Write which channels are on (see saveWarmState), and the counts, out as they are now.
+
+void vOP::saveResetStats() {
+
+	byte powered = 0;
+	for (byte ch = 0; ch < VOP_CHANNELS; ch++) {
+		powered |= (raspberry_power[ch] || ignition_state[ch] ? 0x01 : 0) << ch;
+		powered |= (watchdog_mode[ch] ? 0x10 : 0) << ch;
+	}
+	reset_stats_block[0] = powered;
+	reset_stats_block[1] = warm_resets >> 8;
+	reset_stats_block[2] = warm_resets & 0xFF;
+	reset_stats_block[3] = fallback_resets >> 8;
+	reset_stats_block[4] = fallback_resets & 0xFF;
+	reset_stats.save();
+	armTimer(VOP_TIMER_EEPROM, vop_hal_millis());
+
+}
+
+// --------------------------------------------------------------------------
+// -- The supply.
+// See "The supply" at the top, and vOPSupply.h.
+
+// -- setSupplyPin : Measure the supply on this analog pin. full_scale is the millivolts at the supply
+// that would read as 1024, through the divider (5000 times the divider's ratio, on a 5V board.) Call it before setup().
+
+void vOP::setSupplyPin(byte pin, unsigned int full_scale) {
+
+#if VOP_SUPPLY
+	supply_pin = pin;
+	supply_full_scale = full_scale;
+#else
+	(void)pin;
+	(void)full_scale;
+#endif
+
+}
+
+// -- supplyMillivolts : The supply voltage, filtered. (0 if we're not measuring it.)
+
+unsigned int vOP::supplyMillivolts() {
+
+#if VOP_SUPPLY
+	return supply.millivolts();
+#else
+	return 0;
+#endif
+
+}
+
+#if VOP_SUPPLY
 
-	// Now we have to reset errors, otherwise, we can get stuck.
-	error_flag = 0;
+// -- supplyHandler : Take a reading, and shut down if it's been under the cutoff for too long.
+
+void vOP::supplyHandler() {
+
+	rearmTimer(VOP_TIMER_SUPPLY, SUPPLY_INTERVAL);
+	if (!supply.update(supply_full_scale)) {
+		return;
+	}
+
+	unsigned int millivolts = supply.millivolts();
+	uint32_t now = vop_hal_millis();
+
+	if (supply_cutoff && millivolts < supply_cutoff) {
+		// Under it. Cranking does that for a few seconds, so it has to stay there.
+		if (!supply_dipped) {
+			supply_dipped = true;
+			supply_dipped_at = now;
+		}
+		if (!supply_low && (uint32_t)(now - supply_dipped_at) >= VOP_SUPPLY_HOLD) {
+			supplyLow(true);
+		}
+	} else {
+		supply_dipped = false;
+		// And it has to get properly back before anything comes on again.
+		if (supply_low && (!supply_cutoff || millivolts >= supply_cutoff + SUPPLY_HYSTERESIS)) {
+			supplyLow(false);
+		}
+	}
+
+}
+
+// -- supplyLow : The supply's run low (shut everything down), or come back (let them come on again.)
+
+void vOP::supplyLow(bool low) {
+
+	uint32_t now = vop_hal_millis();
+	supply_low = low;
+	recordEvent(EVENT_SUPPLY, low);
+
+	for (byte ch = 0; ch < VOP_CHANNELS; ch++) {
+		if (!low) {
+			armTimer(VOP_TIMER_BOOTUP(ch), now);
+			continue;
+		}
+		// A shutdown, the same as if it had asked. Unless it's already asked for a sooner one.
+		if (raspberry_power[ch] && (!shutdown_request_mode[ch] || (int32_t)(shutdown_request_at[ch] - now) > (int32_t)SUPPLY_SHUTDOWN_DELAY)) {
+			logIt(LOG_SUPPLY_LOW, ch, supply.millivolts());
+			journalLog(ch, JOURNAL_SUPPLY_LOW);
+			requestShutdown(ch, SUPPLY_SHUTDOWN_DELAY);
+		}
+	}
+
+}
+
+// -- fillSupplyRequest : Send the readings after the sequence number in the parameters.
+
+void vOP::fillSupplyRequest() {
+
+	byte writer[6 + SUPPLY_PER_READ * 2];
+	byte flags = 0;
+
+	unsigned int since = paramsToInt(param_buffer[0],param_buffer[1]);
+	byte count = supply.read(since, &writer[6], SUPPLY_PER_READ, &flags);
+	unsigned int newest = supply.sequence();
+
+	writer[0] = 0;
+	writer[1] = CMD_READ_SUPPLY;
+	writer[2] = count;
+	writer[3] = flags;
+	writer[4] = newest >> 8;
+	writer[5] = newest & 0xFF;
+	vop_hal_i2cWrite(writer, 6 + count * 2);
+
+}
+
+#endif
+
+// -- fillDeferredRequest : Copy out the published result, if it's for the latest command.
+
+void vOP::fillDeferredRequest() {
+
+	vOPResponse *slot = &responses[response_front];
+
+	// loop() won't touch the published slot until the next command, which can't come until this read's over.
+	if (slot->frame == queued_frame && slot->length) {
+		vop_hal_i2cSend(slot->data, slot->length);
+	} else {
+		byte writer[] = {ERR_RESULT_PENDING,command,0,0};
+		STATS_ERROR(ERR_RESULT_PENDING);
+		vop_hal_i2cWrite(writer,4);
+	}
+
+}
+
+// -- noteIsrTime : Keep the longest we've spent in an i2c event.
+
+void vOP::noteIsrTime(uint32_t started) {
+
+	uint32_t spent = vop_hal_micros() - started;
+	if (spent > isr_max_micros) {
+		isr_max_micros = spent > 0xFFFF ? 0xFFFF : spent;
+	}
+
+}
+
+byte vOP::queueHighWater() {
+
+	return queue_high_water;
+
+}
+
+unsigned int vOP::isrMaxMicros() {
+
+	return isr_max_micros;
+
+}
+
+// --------------------------------------------------------------------------
+// -- fillRegisterRequest: Send the next bytes of the status block, and move the pointer along.
+
+void vOP::fillRegisterRequest() {
+
+	// The swap in refreshStatus() can't happen while we're in here, so this is one whole snapshot.
+	const byte *block = status_block[status_front];
+
+	byte length = register_length;
+	if (length == 0 || length > STATUS_BLOCK_SIZE) {
+		length = STATUS_BLOCK_SIZE;
+	}
+
+	// Straight out of the block, in up to two pieces if we wrap around the end.
+	// (The block stays put, so the first can go out in place. See refreshStatus.)
+	byte first = STATUS_BLOCK_SIZE - register_pointer;
+	if (first > length) {
+		first = length;
+	}
+	vop_hal_i2cSend(&block[register_pointer], first);
+	if (length > first) {
+		vop_hal_i2cWrite(block, length - first);
+	}
+
+	register_pointer = (register_pointer + length) % STATUS_BLOCK_SIZE;
+
+}
+
+// --------------------------------------------------------------------------
+// -- refreshStatus: Mirror our state into the status block.
+// We build the copy the Pi isn't reading, then flip to it with a single byte write.
+
+void vOP::refreshStatus() {
+
+	uint32_t now = vop_hal_millis();
+
+	// A read can still be going out of the block in place (see VOP_TWI), and the copy we'd write
+	// might be the one it started on, so leave it until the read's over.
+	if (vop_hal_i2cSending()) {
+		armTimer(VOP_TIMER_STATUS, now + 1);
+		return;
+	}
+
+	byte back = status_front ^ 1;
+	byte *block = status_block[back];
+
+	block[REG_VERSION] = STATUS_BLOCK_VERSION;
+	block[REG_SEQUENCE] = ++status_sequence;
+	block[REG_IGNITION_STATE] = ignition_state[0];
+	block[REG_WATCHDOG_MODE] = watchdog_mode[0];
+	block[REG_WATCHDOG_STATE] = watchdog_state[0];
+	block[REG_SHUTDOWN_STATE] = shutdown_request_mode[0];
+	block[REG_POWER_STATE] = raspberry_power[0];
+	block[REG_INPUTS] = debouncer.state();
+
+	unsigned int seconds = (now - ignition_delta_time[0]) / 1000;
+	block[REG_IGNITION_CHANGE_SECONDS] = seconds >> 8;
+	block[REG_IGNITION_CHANGE_SECONDS + 1] = seconds & 0xFF;
+
+	seconds = 0;
+	if (shutdown_request_mode[0] && (int32_t)(shutdown_request_at[0] - now) > 0) {
+		uint32_t left = (shutdown_request_at[0] - now) / 1000;
+		seconds = left > 0xFFFF ? 0xFFFF : left;
+	}
+	block[REG_SHUTDOWN_SECONDS] = seconds >> 8;
+	block[REG_SHUTDOWN_SECONDS + 1] = seconds & 0xFF;
+
+	uint32_t since_pat = (now - watchdog_last_pat[0]) / 1000;
+	seconds = since_pat > 0xFFFF ? 0xFFFF : since_pat;
+	block[REG_WATCHDOG_PAT_SECONDS] = seconds >> 8;
+	block[REG_WATCHDOG_PAT_SECONDS + 1] = seconds & 0xFF;
+
+	block[REG_EVENT_SEQUENCE] = event_sequence >> 8;
+	block[REG_EVENT_SEQUENCE + 1] = event_sequence & 0xFF;
+
+	block[REG_CHANNEL_POWER] = 0;
+	block[REG_CHANNEL_IGNITION] = 0;
+	for (byte ch = 0; ch < VOP_CHANNELS; ch++) {
+		block[REG_CHANNEL_POWER] |= raspberry_power[ch] << ch;
+		block[REG_CHANNEL_IGNITION] |= ignition_state[ch] << ch;
+	}
+
+	unsigned int millivolts = supplyMillivolts();
+	block[REG_SUPPLY_MILLIVOLTS] = millivolts >> 8;
+	block[REG_SUPPLY_MILLIVOLTS + 1] = millivolts & 0xFF;
+
+	// And flip. One byte, so it's atomic.
+	status_front = back;
+
+	rearmTimer(VOP_TIMER_STATUS, STATUS_REFRESH_INTERVAL);
 
 }
 
@@ -499,61 +3003,132 @@ unsigned int vOP::paramsToInt(byte a,byte b) {
 
 void vOP::receiveData(int byteCount){
 
+	// We're in the i2c interrupt, so keep track of how long we hold it.
+	uint32_t started = vop_hal_micros();
+
 	byte buffer_index = 0;	// The Index for writing to the buffer
 
-	while(Wire.available()) {
+	while(vop_hal_i2cAvailable()) {
 
-		// Let's get that byte.
-		byte inbyte = Wire.read();
-		
-		// Always assume command is incomplete, mark complete only on receipt of end of command
-		command_complete = 0;
-		
-		// debugIt("over set");
-		// debugIt(command_complete);
-		
-		// What index are we reading?
-		switch (buffer_index) {
-
-			case 0:
-				// Ok, this is the first index. If it's end-of-line, it's the end of the command.
-				if (inbyte != END_OF_COMMAND) {
-					// It's a command, store that.
-					command = inbyte;
+		// Let's get that byte, and parse it.
+		receiveByte(vop_hal_i2cRead(), buffer_index);
+
+		// We're done processing that byte, increment in the parameter index.
+		buffer_index++;
+
+	}
+
+	noteIsrTime(started);
+	STATS_TIME(STATS_RECEIVE_DATA, started);
+
+}
+
+// -- receiveByte : Parse one byte of a write, the one at buffer_index (the command is 0.)
+// receiveData() feeds it from Wire's buffer, and with VOP_TWI it's straight off the bus, a byte at a time.
+
+void vOP::receiveByte(byte inbyte, byte buffer_index) {
+
+	byte error_before = error_flag;
+
+	// Always assume command is incomplete, mark complete only on receipt of end of command
+	command_complete = 0;
+	
+	// debugIt("over set");
+	// debugIt(command_complete);
+	
+	// What index are we reading?
+	switch (buffer_index) {
+
+		case 0:
+			// Ok, this is the first index. If it's end-of-line, it's the end of the command.
+			if (inbyte != END_OF_COMMAND) {
+				// It's a command, store that.
+				command = inbyte;
+				batch_count = 0;
+				batch_length = 0;
+			} else {
+				// That's good, it's the end of the command.
+				// Let's note that we completely got the command.
+				command_complete = 1;
+				STATS_COMMAND(command);
+
+				// Selecting a register? Point at it now, so the reads can walk along from there.
+				if (command == CMD_READ_REGISTERS) {
+					register_pointer = param_buffer[0];
+					register_length = param_buffer[1];
+					if (register_pointer >= STATUS_BLOCK_SIZE) {
+						error_flag = ERR_REGISTER_RANGE;
+					}
+#if VOP_JOURNAL
+				} else if (command == CMD_READ_JOURNAL) {
+					// Start the dump from the oldest record.
+					journal.rewind(vop_hal_millis());
+#endif
+#if VOP_INSTRUMENT
+				} else if (command == CMD_READ_STATS) {
+					// Start from the header.
+					stats_offset = 0;
+					stats_reset = param_buffer[0];
+#endif
+				} else if (command == CMD_TAGGED && error_flag == 0) {
+					// Tagged, so it gets a results slot of its own.
+					submitTagged();
+				} else if (deferred_mode && error_flag == 0) {
+					// Leave the running of it to loop().
+					queueCommand();
+				}
+				
+				// debugIt("inner set");
+				// debugIt(command_complete);
+				
+			}
+			break;
+
+		default:
+			// A batch: the count, then three bytes for each command.
+			if (command == CMD_BATCH) {
+
+				if (buffer_index == 1) {
+					batch_count = inbyte;
+					if (batch_count > BATCH_MAX_COMMANDS) {
+						error_flag = ERR_BUFFER_OVERFLOW;
+					}
+				} else if (buffer_index - 2 < BATCH_MAX_COMMANDS * 3) {
+					batch_buffer[buffer_index - 2] = inbyte;
+					batch_length = buffer_index - 1;
 				} else {
-					// That's good, it's the end of the command.
-					// Let's note that we completely got the command.
-					command_complete = 1;
-					
-					// debugIt("inner set");
-					// debugIt(command_complete);
-					
+					error_flag = ERR_BUFFER_OVERFLOW;
 				}
-				break;
 
-			default:
-				// If the buffer is not yet full, we're going to populate it.
-				if (buffer_index < MAX_COMMAND_PARAMETERS) {
+			// Tagged: the tag, the command, and its two parameters.
+			} else if (command == CMD_TAGGED) {
 
-					// Place a byte into the buffer with each read, and increment the index at which it is placed.
-					// We subtract one to account for the command at position 0.
-					param_buffer[buffer_index-1] = inbyte;
-					
+				if (buffer_index <= 4) {
+					batch_buffer[buffer_index - 1] = inbyte;
+					batch_length = buffer_index;
 				} else {
-					// Not bueno. That's a buffer overflow.
 					error_flag = ERR_BUFFER_OVERFLOW;
 				}
-				break;
 
-		}
+			// If the buffer is not yet full, we're going to populate it.
+			} else if (buffer_index < MAX_COMMAND_PARAMETERS) {
 
-		// We're done processing that byte, increment in the parameter index.
-		buffer_index++;
+				// Place a byte into the buffer with each read, and increment the index at which it is placed.
+				// We subtract one to account for the command at position 0.
+				param_buffer[buffer_index-1] = inbyte;
+				
+			} else {
+				// Not bueno. That's a buffer overflow.
+				error_flag = ERR_BUFFER_OVERFLOW;
+			}
+			break;
 
 	}
 
-	// No more bytes available, we'll reset the buffer index (redundant)
-	buffer_index = 0;
+	// Count an error once, on the byte that raised it.
+	if (error_flag && !error_before) {
+		STATS_ERROR(error_flag);
+	}
 
 }
 
@@ -572,19 +3147,101 @@ void vOP::loop() {
 	delay(750);
 	*/
 
-	// Let's run our ignition debounce routine.
-	if (debug_ign_debounce) {
-		debounceIgnition();
+#if VOP_INSTRUMENT
+	// How long since the last time round?
+	uint32_t loop_started = vop_hal_micros();
+	if (stats_last_loop) {
+		stats_histograms[STATS_LOOP_PERIOD].add(loop_started - stats_last_loop);
+	}
+	stats_last_loop = loop_started;
+#endif
+
+#if VOP_LOG
+	// Hand the serial port as much of the log as it has room for. It sends it on its own.
+	if (log_drain) {
+		log_drain(debug_log);
+	}
+#endif
+
+	// Anything the Pi sent in deferred mode gets run here, outside the interrupt.
+	if (queue_tail != queue_head) {
+		STATS_START(queued_started);
+		runQueuedCommands();
+		STATS_TIME(STATS_QUEUED, queued_started);
 	}
 
-	// Fire off the watchdog. (Method knows if it's active or not.)
-	watchDog();
+	// Did the ignition move while the debouncer was parked? Start sampling it again.
+	if (ignition_edge) {
+		ignition_edge = 0;
+		if (debug_ign_debounce && !(timer_armed & VOP_TIMER_BIT(VOP_TIMER_DEBOUNCE))) {
+			armTimer(VOP_TIMER_DEBOUNCE, vop_hal_millis());
+		}
+	}
+
+	// Only run the handlers once the earliest deadline has passed. The i2c interrupt arms timers too,
+	// so we ask nextDeadline(), which takes the mask and the deadline with interrupts held off.
+	if (nextDeadline() == 0) {
+
+		STATS_START(handler_started);
+
+		// Let's run our ignition debounce routine.
+		if (debug_ign_debounce) {
+			debounceIgnition();
+		}
+		STATS_TIME(STATS_DEBOUNCE, handler_started);
+
+		// Fire off the watchdog. (Method knows if it's active or not.)
+		STATS_START(watchdog_started);
+		watchDog();
+		STATS_TIME(STATS_WATCHDOG, watchdog_started);
+
+		// Process the shutdown requests, if necessary (it knows if it's active or not, too)
+		STATS_START(shutdown_started);
+		shutdownRequestHandler();
+		STATS_TIME(STATS_SHUTDOWN_REQUEST, shutdown_started);
+
+		// Cut the power to anything that's halted early.
+		STATS_START(halt_started);
+		haltHandler();
+		STATS_TIME(STATS_HALT, halt_started);
+
+#if VOP_SUPPLY
+		// Take a reading of the supply, and see if it's running low.
+		if (timerDue(VOP_TIMER_SUPPLY)) {
+			STATS_START(supply_started);
+			supplyHandler();
+			STATS_TIME(STATS_SUPPLY, supply_started);
+		}
+#endif
+
+		// Turn on the raspberry pi if application
+		STATS_START(bootup_started);
+		bootUpHandler();
+		STATS_TIME(STATS_BOOTUP, bootup_started);
+
+		// And mirror whatever changed into the status block.
+		if (timerDue(VOP_TIMER_STATUS)) {
+			STATS_START(status_started);
+			refreshStatus();
+			STATS_TIME(STATS_STATUS, status_started);
+		}
+
+		// Get the next byte of the settings or the journal on its way to the EEPROM.
+		if (timerDue(VOP_TIMER_EEPROM)) {
+			STATS_START(eeprom_started);
+			eepromHandler();
+			STATS_TIME(STATS_EEPROM, eeprom_started);
+		}
+
+		// And keep what we'd need after a reset up to date.
+		saveWarmState();
 
-	// Process the shutdown requests, if necessary (it knows if it's active or not, too)
-	shutdownRequestHandler();
+	}
 
-	// Turn on the raspberry pi if application
-	bootUpHandler();
+	// And if we're allowed, nap until there's something to do.
+	if (sleep_mode) {
+		idle();
+	}
 
 
 	// boolean ignition = digitalRead(PIN_IGNITION);
@@ -596,70 +3253,141 @@ void vOP::loop() {
 
 void vOP::debounceIgnition() {
 
-	static unsigned long debounce_next_ignition_time = 0; 	// The last time we checked the ignition.
-	static byte debounce_last_ignition_state = 0;			// Our last ignition state
-	static byte debounce_counter_ignition = 0;				// How many times for the same ignition?
-
 	// --
 	// NOTE: Yo. This pin comes down slowly.
 	// --
 
-	// Rollover example from: http://www.baldengineer.com/blog/2012/07/16/arduino-how-do-you-reset-millis/
-	// if ((unsigned long)(millis() - waitUntil) >= interval)
-
 	// Is it time for a check?
-	if ((unsigned long)(millis() - debounce_next_ignition_time) >= CHECK_IGNITION_INTERVAL) {
-
-		// Read it's state.
-		bool now_ignition = digitalRead(PIN_IGNITION);
-		
-		// Is that the same as our last read?
-		if (now_ignition == debounce_last_ignition_state) {
+	if (timerDue(VOP_TIMER_DEBOUNCE)) {
 
-			// That's good, we got the same value in a row -- we want to increment our same counter.
-			debounce_counter_ignition++;
-			
-			if (debounce_counter_ignition >= CHECK_IGNITION_RETRIES) {
+		// Read the whole port at once, and let the debouncer count every watched input.
+		uint32_t now = vop_hal_millis();
+		byte changed = debouncer.sample(vop_hal_readPort(ignition_pin[0]), now);
 
-				// Reset the counter.
-				debounce_counter_ignition = 0;
+#if VOP_INSTRUMENT
+		// How far apart are the samples really?
+		uint32_t sampled = vop_hal_micros();
+		if (stats_last_sample) {
+			stats_histograms[STATS_DEBOUNCE_GAP].add(sampled - stats_last_sample);
+		}
+		stats_last_sample = sampled;
+#endif
 
-				// Did it change from the latched state? We will latch the new value if so.
-				if (ignition_state != now_ignition) {
+		// Did any channel's ignition latch a new state?
+		bool dipping = false;
+		for (byte ch = 0; ch < VOP_CHANNELS; ch++) {
 
-					// Latched it.
-					ignition_state = now_ignition;
-					// Now let's store what time we did this.
-					ignition_delta_time = millis();
+			if (!(changed & ignition_bit[ch])) {
+				// Off for the whole hold-off? Then it's off.
+				if (ignition_dipping[ch] && (uint32_t)(now - ignition_dip_at[ch]) >= ignition_holdoff) {
+					ignition_dipping[ch] = false;
+					latchIgnition(ch, false, ignition_dip_at[ch]);
+				}
+				dipping |= ignition_dipping[ch];
+				continue;
+			}
 
+			bool on = (debouncer.state() & ignition_bit[ch]) != 0;
+
+			if (!on && ignition_state[ch] && ignition_holdoff) {
+				// It's off, but it might just be a dip. Hold off.
+				ignition_dipping[ch] = true;
+				ignition_dip_at[ch] = now;
+				dipping = true;
+			} else if (on && ignition_dipping[ch]) {
+				// Back before the hold-off was up. Note the dip, and carry on like it never happened.
+				uint32_t length = now - ignition_dip_at[ch];
+				ignition_dipping[ch] = false;
+				dip_last[ch] = length;
+				if (dip_last[ch] > dip_longest[ch]) {
+					dip_longest[ch] = dip_last[ch];
 				}
+				if (dip_count[ch] < 0xFFFF) {
+					dip_count[ch]++;
+				}
+				recordEvent(EVENT_IGNITION_DIP, length < 25500 ? length / 100 : 255, ch);
+				logIt(LOG_IGNITION_DIP, ch, length < 0xFFFF ? length : 0xFFFF);
+			} else {
+				latchIgnition(ch, on, now);
 			}
 
-		} else {
-			// Looks like it's flapping.
-			// We need to reset our count.
-			debounce_counter_ignition = 0;
 		}
 
-		// Keep that last state.
-		debounce_last_ignition_state = now_ignition;
+		// If we're sleeping and it's settled where we latched it, stop polling.
+		// The ignition pin interrupts start us up again on the next edge, which is
+		// why we can only do this when every input we watch has one. (And not while a hold-off's running.)
+		if (sleep_mode && !dipping && debouncer.settled() && !(debouncer.watched() & ~wake_bits)) {
+			disarmTimer(VOP_TIMER_DEBOUNCE);
+			return;
+		}
+
 		// And the next time we check.
-		debounce_next_ignition_time += CHECK_IGNITION_INTERVAL;
+		rearmTimer(VOP_TIMER_DEBOUNCE, debounce_interval);
+
+	}
+
+}
+
+// -- latchIgnition : The ignition's on or off, as far as everything else is concerned, since at.
+
+void vOP::latchIgnition(byte ch, bool state, uint32_t at) {
+
+	ignition_state[ch] = state;
+	// Now let's store what time we did this.
+	ignition_delta_time[ch] = at;
+	recordEvent(EVENT_IGNITION, ignition_state[ch], ch);
+	logIt(LOG_IGNITION, ch, ignition_state[ch]);
+	if (!ignition_state[ch]) {
+		journalLog(ch, JOURNAL_IGNITION_OFF);
+	}
+	// And let the boot up handler have a look.
+	armTimer(VOP_TIMER_BOOTUP(ch), vop_hal_millis());
+
+}
+
+// --------------------------------------------------------------------------------
+// -- watchInput : Debounce another input alongside the ignition.
+// It has to be on the same port as the ignition (pins 0-7 on an Uno), and it latches
+// after depth samples (TUNE_DEBOUNCE_INTERVAL apart) that disagree with its latched state.
+
+void vOP::watchInput(byte pin, byte depth) {
+
+	debouncer.watch(vop_hal_pinBit(pin), depth);
+
+}
 
+// -- inputState : The debounced state of a watched input.
+
+bool vOP::inputState(byte pin) {
+
+	return (debouncer.state() & vop_hal_pinBit(pin)) != 0;
+
+}
+
+// -- inputChangedAt : When did a watched input last latch a change? (millis)
+
+uint32_t vOP::inputChangedAt(byte pin) {
+
+	byte mask = vop_hal_pinBit(pin);
+	byte bit = 0;
+	while (mask > 1) {
+		mask >>= 1;
+		bit++;
 	}
+	return debouncer.changedAt(bit);
 
 }
 
 // --------------------------------------------------------------------------------
-// -- ignitionChangedLast : When did we change that?
+// -- ignitionChangedLast : When did we change that? (On the selected channel.)
 // if "seconds" is true, then returns seconds.
 // else, if false, returns minutes.
 
 unsigned int vOP::ignitionChangedLast(bool seconds) {
 	
-	long now = millis();
-	long last = ignition_delta_time;
-	long delta =  now - last;
+	int32_t now = vop_hal_millis();
+	int32_t last = ignition_delta_time[selected_channel];
+	int32_t delta =  now - last;
 	delta = delta / 1000;
 	if (!seconds) {
 		delta = delta / 60;
@@ -669,36 +3397,228 @@ unsigned int vOP::ignitionChangedLast(bool seconds) {
 
 }
 
+// --------------------------------------------------------------------------------
+// -- The deadline scheduler.
+// Each timer holds an absolute millis() deadline, and we keep the earliest one handy.
+// Comparisons are done on the signed difference, so they survive millis() rolling over.
+// Rollover example from: http://www.baldengineer.com/blog/2012/07/16/arduino-how-do-you-reset-millis/
+// The i2c events arm timers too, so changes happen with interrupts held off.
+
+void vOP::armTimer(byte timer, uint32_t deadline) {
+
+	byte state = vop_hal_interruptsOff();
+	timer_deadline[timer] = deadline;
+	timer_armed |= VOP_TIMER_BIT(timer);
+	findNextTimer();
+	vop_hal_interruptsRestore(state);
+
+}
+
+// -- rearmTimer : Move a periodic timer one interval along, without drift.
+// If we've fallen a whole interval behind, we don't burst to catch up, we start again from now.
+
+void vOP::rearmTimer(byte timer, uint32_t interval) {
+
+	uint32_t now = vop_hal_millis();
+	uint32_t deadline = timer_deadline[timer] + interval;
+	if ((int32_t)(now - deadline) >= 0) {
+		deadline = now + interval;
+	}
+	armTimer(timer, deadline);
+
+}
+
+void vOP::disarmTimer(byte timer) {
+
+	byte state = vop_hal_interruptsOff();
+	timer_armed &= ~VOP_TIMER_BIT(timer);
+	findNextTimer();
+	vop_hal_interruptsRestore(state);
+
+}
+
+bool vOP::timerDue(byte timer) {
+
+	byte state = vop_hal_interruptsOff();
+	bool due = (timer_armed & VOP_TIMER_BIT(timer)) && (int32_t)(vop_hal_millis() - timer_deadline[timer]) >= 0;
+	vop_hal_interruptsRestore(state);
+	return due;
+
+}
+
+// -- findNextTimer : Recompute the earliest deadline. (call with interrupts off)
+
+void vOP::findNextTimer() {
+
+	bool found = false;
+	for (byte i = 0; i < VOP_TIMER_COUNT; i++) {
+		if (timer_armed & VOP_TIMER_BIT(i)) {
+			if (!found || (int32_t)(timer_deadline[i] - timer_next) < 0) {
+				timer_next = timer_deadline[i];
+				found = true;
+			}
+		}
+	}
+
+}
+
+// --------------------------------------------------------------------------------
+// -- nextDeadline : How many millis until vOP has something to do?
+// Returns 0 if something is due now, or VOP_NO_DEADLINE when nothing is scheduled.
+// Use it to idle (or sleep) between calls to loop().
+
+uint32_t vOP::nextDeadline() {
+
+	byte state = vop_hal_interruptsOff();
+	vOPTimerMask armed = timer_armed;
+	uint32_t next = timer_next;
+	vop_hal_interruptsRestore(state);
+
+	if (!armed) {
+		return VOP_NO_DEADLINE;
+	}
+	int32_t remaining = (int32_t)(next - vop_hal_millis());
+	return remaining > 0 ? (uint32_t)remaining : 0;
+
+}
+
+// --------------------------------------------------------------------------------
+// -- Sleep mode : Nap between deadlines to save the vehicle battery.
+// Debounce, watchdog and shutdown timing are unchanged, we just don't spin while we wait.
+
+void vOP::setSleepMode(bool enabled) {
+
+	sleep_mode = enabled;
+	// Coming out of sleep mode, the debouncer might be parked.
+	if (!sleep_mode && debug_ign_debounce && !(timer_armed & VOP_TIMER_BIT(VOP_TIMER_DEBOUNCE))) {
+		armTimer(VOP_TIMER_DEBOUNCE, vop_hal_millis());
+	}
+
+}
+
+// -- idle : Sleep until the next deadline, or until the ignition or the i2c wakes us.
+// Clear sleep_woken before looking, so an interrupt after we've looked still cuts the nap short.
+// Nothing due at all, and we still come up once a SLEEP_MAX_NAP, which costs next to nothing.
+
+void vOP::idle() {
+
+	sleep_woken = 0;
+	uint32_t wait = nextDeadline();
+	if (wait == 0 || ignition_edge || queue_tail != queue_head) {
+		return;
+	}
+	if (wait > SLEEP_MAX_NAP) {
+		wait = SLEEP_MAX_NAP;
+	}
+
+	uint32_t started = vop_hal_micros();
+	vop_hal_sleep(wait, &sleep_woken);
+	uint32_t slept = vop_hal_micros() - started;
+
+	// Keep the total in millis, carrying the remainder so short naps still add up.
+	slept += sleep_micros;
+	sleep_millis += slept / 1000;
+	sleep_micros = slept % 1000;
+
+}
+
+uint32_t vOP::sleepMillis() {
+
+	return sleep_millis;
+
+}
+
+uint32_t vOP::awakeMillis() {
+
+	return (vop_hal_millis() - sleep_stats_since) - sleep_millis;
+
+}
+
 
 // the infamous setup routine.
 
 // --------------------------------------------------------------------------------
-// -- debugIt : Print a serial line if the debug parameter is set on.
+// -- logIt : Put a record in the log, with none, one or two numbers. (See vOPLog.h for the LOG_ IDs.)
+// Nothing waits on the serial port, so it's fine anywhere, even in an interrupt.
 
-void vOP::debugIt(char *msg) {
+void vOP::logIt(byte id) {
 
-#if SERIAL_ON > 0
-		Serial.println(msg);
+#if VOP_LOG
+	debug_log.log(id, 0, 0, 0, vop_hal_millis());
 #endif
 
 }
 
-void vOP::debugItDEC(byte msg) {
+void vOP::logIt(byte id, unsigned int a) {
 
-#if SERIAL_ON > 0
-		Serial.println(msg,DEC);
-#endif 
+#if VOP_LOG
+	debug_log.log(id, 1, a, 0, vop_hal_millis());
+#endif
 
 }
 
-void vOP::debugItBIN(int msg) {
+void vOP::logIt(byte id, unsigned int a, unsigned int b) {
 
-#if SERIAL_ON > 0
-		Serial.println(msg,DEC);
+#if VOP_LOG
+	debug_log.log(id, 2, a, b, vop_hal_millis());
 #endif
-		
+
+}
+
+#if VOP_LOG
+
+// -- drainLogSerial : Move what the serial port has room for out of the ring. (From loop.)
+// It's only ever called through log_drain, so a sketch that never calls setLogSerial() doesn't get Serial linked in.
+
+static void drainLogSerial(vOPLog &log) {
+
+	byte room = vop_hal_serialRoom();
+	if (!room || !log.used()) {
+		return;
+	}
+
+	byte chunk[VOP_LOG_SIZE];
+	byte count = log.read(chunk, room < VOP_LOG_SIZE ? room : VOP_LOG_SIZE, false);
+	vop_hal_serialWrite(chunk, count);
+
+}
+
+#endif
+
+// -- setLogSerial : Send the log out of the serial port, at this baud rate.
+// It's binary, so look at it with extras/host/vop_log, not the serial monitor.
+
+void vOP::setLogSerial(unsigned long baud) {
+
+#if VOP_LOG
+	vop_hal_serialBegin(baud);
+	log_drain = drainLogSerial;
+#else
+	(void)baud;
+#endif
+
+}
+
+#if VOP_LOG
+
+// -- fillLogRequest : Send as many whole records as fit, taking them off the ring.
+
+void vOP::fillLogRequest() {
+
+	byte writer[4 + LOG_PER_READ];
+
+	byte count = debug_log.read(&writer[4], LOG_PER_READ, true);
+
+	writer[0] = 0;
+	writer[1] = CMD_READ_LOG;
+	writer[2] = count;
+	writer[3] = debug_log.used() ? LOG_MORE : 0;
+	vop_hal_i2cWrite(writer, 4 + count);
+
 }
 
+#endif
+
 // ------------------------------- reference consider
 
 // --------------------------------------------------------------------------
@@ -2,27 +2,360 @@
 #define Morse_h
 
 #include "Arduino.h"
+#include "vOPConfig.h"
+#include "vOPDebounce.h"
+#include "vOPCommands.h"
+#include "vOPJournal.h"
+#include "vOPSettings.h"
+#include "vOPInstrument.h"
+#include "vOPSupply.h"
+#include "vOPLog.h"
+
+// ----------------------------------------
+// -- Channels ----------------------------
+// ----------------------------------------
+// One vOP can power several computers, each with its own relay, ignition, watchdog and shutdown
+// request. Set VOP_CHANNELS (here, or with -D) to how many, and give channels past the first
+// their pins with setChannelPins(). Every ignition has to be on the same port as the first.
+
+#define VOP_MAX_CHANNELS 4
+#if VOP_CHANNELS < 1 || VOP_CHANNELS > VOP_MAX_CHANNELS
+#error "VOP_CHANNELS has to be between 1 and VOP_MAX_CHANNELS"
+#endif
+
+// What a channel's pins are, until they're set.
+#define PIN_NONE 0xFF
+
+// ----------------------------------------
+// -- Deadline Scheduler Timers -----------
+// ----------------------------------------
+// Each subsystem owns one timer, and loop() only runs them when the earliest deadline has passed.
+// The timers after VOP_TIMER_CHANNEL_FIRST come in a set for each channel.
+
+#define VOP_TIMER_DEBOUNCE 0
+#define VOP_TIMER_STATUS 1
+#define VOP_TIMER_EEPROM 2
+#define VOP_TIMER_HALT 3
+#define VOP_TIMER_SUPPLY 4
+#define VOP_TIMER_CHANNEL_FIRST 5
+#define VOP_TIMER_WATCHDOG(ch) (VOP_TIMER_CHANNEL_FIRST + (ch) * 3)
+#define VOP_TIMER_SHUTDOWN_REQUEST(ch) (VOP_TIMER_CHANNEL_FIRST + (ch) * 3 + 1)
+#define VOP_TIMER_BOOTUP(ch) (VOP_TIMER_CHANNEL_FIRST + (ch) * 3 + 2)
+#define VOP_TIMER_COUNT (VOP_TIMER_CHANNEL_FIRST + VOP_CHANNELS * 3)
+
+// There's a bit of timer_armed for each timer. Sixteen fit an int, more take a long.
+#if VOP_TIMER_COUNT > 16
+typedef unsigned long vOPTimerMask;
+#else
+typedef unsigned int vOPTimerMask;
+#endif
+#define VOP_TIMER_BIT(timer) ((vOPTimerMask)1 << (timer))
+
+// How many commands fit in one CMD_BATCH. (4 bytes of result each, in the 32 byte Wire buffer.)
+#define BATCH_MAX_COMMANDS 8
+
+// How big the status register block is. (See the REG_ definitions in vOP.cpp.)
+#define STATUS_BLOCK_SIZE 20
+
+// How many commands the deferred mode ring holds. (A power of two, one slot is always left empty.)
+#define COMMAND_QUEUE_SIZE 16
+
+// Flags on a queued command, marking the ends of a frame (a single command, or a whole batch.)
+#define QUEUED_FIRST 1
+#define QUEUED_LAST 2
+#define QUEUED_TAGGED 4
+
+// A command parsed by the i2c interrupt, waiting for loop() to run it.
+struct vOPQueuedCommand {
+	byte command;
+	byte params[2];
+	byte frame;				// Which write it came in with. (Or its tag, if it's tagged.)
+	byte flags;				// QUEUED_FIRST / QUEUED_LAST.
+};
+
+// The results of one frame, published by loop() for the i2c interrupt to send.
+struct vOPResponse {
+	byte frame;
+	byte length;
+	byte data[BATCH_MAX_COMMANDS * 4];
+};
+
+// How many tagged results we keep, and the state of each slot.
+#define TAGGED_RESULTS 8
+#define TAG_EMPTY 0
+#define TAG_PENDING 1
+#define TAG_DONE 2
+
+struct vOPTaggedResult {
+	byte tag;
+	volatile byte state;	// TAG_ above.
+	byte result[4];			// The error, command, and two result bytes.
+};
+
+// How many events the feed remembers.
+#define EVENT_RING_SIZE 16
+
+// The things that land in the event feed (and go to the setEventHook hook), and what their argument is.
+#define EVENT_IGNITION 1 				// The ignition latched a new state. (the state)
+#define EVENT_WATCHDOG 2 				// The watchdog changed state. (the WATCHDOG_STATE_)
+#define EVENT_SHUTDOWN_REQUESTED 3 		// A shutdown was requested.
+#define EVENT_SHUTDOWN_CANCELLED 4 		// It was cancelled.
+#define EVENT_SHUTDOWN_EXECUTED 5 		// It came due, and we cut the power.
+#define EVENT_RELAY 6 					// The raspberry pi relay switched. (1 for on)
+#define EVENT_SHUTDOWN_DUE 7 			// A requested shutdown is SHUTDOWN_WARNING_INTERVAL away.
+#define EVENT_HALTED 8 					// The Pi halted, and we cut the power. (HALT_BY_COMMAND or HALT_BY_PIN)
+#define EVENT_IGNITION_DIP 9 			// The ignition went off and back on inside the hold-off. (tenths of a second, up to 255)
+#define EVENT_SUPPLY 10 				// The supply went under the cutoff, and we're shutting down (1), or it came back (0).
+
+struct vOPEvent {
+	unsigned int sequence;
+	byte type;				// EVENT_ above.
+	byte arg;
+	uint32_t time;			// millis() when it happened.
+};
+
+// The histograms kept when VOP_INSTRUMENT is on. (See vOPInstrument.h)
+#define STATS_LOOP_PERIOD 0				// Between one loop() and the next.
+#define STATS_DEBOUNCE_GAP 1			// Between one debounce sample and the next.
+#define STATS_FILL_REQUEST 2			// Time in the i2c request event.
+#define STATS_RECEIVE_DATA 3			// Time in the i2c receive event.
+#define STATS_DEBOUNCE 4				// Then time in each handler, when the scheduler runs them.
+#define STATS_WATCHDOG 5
+#define STATS_SHUTDOWN_REQUEST 6
+#define STATS_BOOTUP 7
+#define STATS_STATUS 8
+#define STATS_EEPROM 9
+#define STATS_QUEUED 10					// Running deferred commands.
+#define STATS_HALT 11
+#define STATS_SUPPLY 12
+#define STATS_HISTOGRAMS 13
+
+// And the counters: one per error code, and one per opcode starting at CMD_FIRST
+// (the last slot counts everything past them, the debug and user commands.)
+#define STATS_ERRORS 16
+#define STATS_COMMANDS 40
+
+// The timing you can tune over i2c (CMD_GET_TUNING and CMD_SET_TUNING), and what each is in.
+#define TUNE_WATCHDOG_TIMEOUT 0			// Seconds.
+#define TUNE_WATCHDOG_TURNOFF 1			// Seconds.
+#define TUNE_WATCHDOG_RUN 2				// Seconds.
+#define TUNE_WATCHDOG_BOOT 3			// Seconds.
+#define TUNE_POWER_MINIMUM_OFF 4		// Seconds.
+#define TUNE_POWER_ON_STAGGER 5			// Millis.
+#define TUNE_DEBOUNCE_INTERVAL 6		// Millis.
+#define TUNE_DEBOUNCE_ON_DEPTH 7		// Samples, for the ignition to latch on.
+#define TUNE_IGNITION_HOLDOFF 8			// Millis.
+#define TUNE_DEBOUNCE_OFF_DEPTH 9		// Samples, for the ignition to latch off.
+#define TUNE_SUPPLY_CUTOFF 10			// Millivolts, 0 for never.
+#define TUNE_COUNT 11
+
+// What CMD_GET_BOOT_STATS can send back, for the selected channel.
+#define BOOT_STAT_MEAN 0				// The learned boot time, relay on to first pat (millis.)
+#define BOOT_STAT_DEVIATION 1			// How far from it they usually land (millis.)
+#define BOOT_STAT_SAMPLES 2				// How many boots it's learned from.
+#define BOOT_STAT_LAST 3				// The last boot time (millis.)
+#define BOOT_STAT_TIMEOUT 4				// The boot timeout we're using now (seconds, rounded up.)
+#define BOOT_STAT_BYTES 5				// What's saved for each channel: the mean, deviation and samples.
+
+// What CMD_GET_DIP_STATS can send back, for the selected channel.
+#define DIP_STAT_COUNT 0				// How many dips the hold-off rode out.
+#define DIP_STAT_LONGEST 1				// The longest of them (millis.)
+#define DIP_STAT_LAST 2					// And the last one (millis.)
+
+// What CMD_GET_RESET_STATS can send back.
+#define RESET_STAT_WARM 0				// How many resets we came back from with the power kept on, out of RAM.
+#define RESET_STAT_FALLBACK 1			// And out of the EEPROM, when RAM didn't make it.
+#define RESET_STAT_LAST 2				// How we came back the last time. (RESET_ below)
+#define RESET_STAT_BYTES 5				// What's saved: which channels were on, and the two counts.
+
+// What CMD_GET_SUPPLY can send back.
+#define SUPPLY_STAT_MILLIVOLTS 0		// The supply voltage, filtered.
+#define SUPPLY_STAT_READING 1			// The last reading, before it was filtered.
+#define SUPPLY_STAT_MINIMUM 2			// The lowest it's been (0xFFFF for not yet.)
+#define SUPPLY_STAT_LOW 3				// 1 while it's under the cutoff, and we've shut down for it.
+
+// How we started.
+#define RESET_COLD 0					// From scratch, everything off.
+#define RESET_WARM 1					// Picked up where we were, from the warm state in RAM.
+#define RESET_FALLBACK 2				// Kept the power on for the channels the EEPROM says were on.
+
+// Where things live in the EEPROM. The tuning and what we've learned are saved at the start,
+// and the journal has the rest.
+#define EEPROM_TUNING 0
+#define EEPROM_BOOT_STATS 32
+#define EEPROM_RESET_STATS 56
+#define EEPROM_JOURNAL 64
+
+// ----------------------------------------
+// -- Warm State --------------------------
+// ----------------------------------------
+// What we need to carry on after a reset of the micro (a brown out, or the AVR's watchdog) without
+// cutting the Pi's power. It lives in RAM the reset doesn't clear (see VOP_NOINIT in vOPHal.h), and
+// saveWarmState() keeps it up to date from loop(). The times are millis() as they were at saved_at.
+
+#define WARM_POWER 1					// The relay's on.
+#define WARM_IGNITION 2					// The ignition's latched on.
+#define WARM_WATCHDOG_MODE 4			// Watchdog mode's on.
+#define WARM_SHUTDOWN_REQUEST 8			// A shutdown's been requested.
+
+struct vOPWarmChannel {
+	byte flags;							// WARM_ above.
+	byte watchdog_state;
+	byte halt_state;
+	byte halt_by;
+	uint32_t ignition_delta_time;
+	uint32_t watchdog_last_pat;
+	uint32_t watchdog_turnoff_time;
+	uint32_t watchdog_boot_time;
+	uint32_t shutdown_request_at;
+	uint32_t halt_cut_at;
+	uint32_t power_minimum_off_time;
+};
+
+struct vOPWarmState {
+	unsigned int magic;					// WARM_STATE_MAGIC (vOP.cpp), once it's been saved.
+	unsigned int length;				// sizeof(vOPWarmState), in case a new build moved things about.
+	uint32_t saved_at;					// millis() when it was saved.
+	vOPWarmChannel channels[VOP_CHANNELS];
+	byte crc;							// The CRC-8 of all of the above.
+};
+
+// The one copy. (The host mock wipes it, to fake a power cut.)
+extern vOPWarmState vop_warm_state;
+
+// Where each channel is in shutting down. (See CMD_HALTING in vOP.cpp.)
+#define HALT_NONE 0						// Running, as far as we know.
+#define HALT_ANNOUNCED 1				// The Pi said it's halting, so we watch for it to finish.
+#define HALT_CONFIRMED 2				// It's finished, and the power goes at halt_cut_at.
+
+// How a halt was confirmed. (The argument of EVENT_HALTED.)
+#define HALT_BY_COMMAND 0
+#define HALT_BY_PIN 1
+
+// What setAttentionPin() is, until it's called.
+#define ATTENTION_PIN_NONE 0xFF
+
+// What nextDeadline() returns when nothing is scheduled.
+#define VOP_NO_DEADLINE 0xFFFFFFFFUL
 
 class vOP {
   public:
     vOP();
     void loop();
     void setup();
+    void setChannelPins(byte ch, byte relay, byte ignition);
+    void setPowerOnStagger(unsigned int interval);
+    void setHaltPin(byte ch, byte pin, byte level, unsigned int hold);
+    void setSupplyPin(byte pin, unsigned int full_scale);
+    unsigned int supplyMillivolts();
     void bootUpHandler();
-    void shutDownHandler();
+    void shutDownHandler(byte ch = 0);
     void shutdownRequestHandler();
     void watchDog();
-    void resetWatchDog();
+    void resetWatchDog(byte ch = 0);
     void fillRequest();
+    void fillResponse();
+    void setDeferredMode(bool enabled);
+    void runQueuedCommands();
+    byte queueHighWater();
+    unsigned int isrMaxMicros();
+    void recordEvent(byte type, byte arg, byte ch = 0);
+    unsigned int eventSequence();
+    void setEventHook(void (*hook)(byte type, byte arg, byte ch));
+    void setAttentionPin(byte pin);
+    unsigned int getTuning(byte id);
+    byte setTuning(byte id, unsigned int value);
+    void resetTuning();
+    void resetBootStats(byte ch = 0);
+    byte resetKind();
+    void fillBatchRequest();
+    void fillRegisterRequest();
+    void refreshStatus();
+    byte runCommand(byte cmd, byte *params, byte *return_buffer);
+    void beginI2c(byte address);
     void receiveData(int byteCount);
+    void receiveByte(byte inbyte, byte buffer_index);
     unsigned int paramsToInt(byte a,byte b);
     void debounceIgnition();
     unsigned int ignitionChangedLast(bool seconds);
-    void debugIt(char *msg);
-    void debugItDEC(byte msg);
-    void debugItBIN(int msg);
+    void watchInput(byte pin, byte depth);
+    bool inputState(byte pin);
+    uint32_t inputChangedAt(byte pin);
+    void logIt(byte id);
+    void logIt(byte id, unsigned int a);
+    void logIt(byte id, unsigned int a, unsigned int b);
+    void setLogSerial(unsigned long baud);
+    uint32_t nextDeadline();
+    void setSleepMode(bool enabled);
+    void idle();
+    uint32_t sleepMillis();
+    uint32_t awakeMillis();
   private:
-  	// Our i2c address.
+	friend class vOPCommands;
+	static void i2cReceived(int count);
+	static void i2cReceivedByte(byte value, byte index);
+	static void i2cRequested();
+	static void ignitionEdge();
+	void queueCommand();
+	void fillDeferredRequest();
+	void noteIsrTime(uint32_t started);
+	void submitTagged();
+	void completeTagged(byte tag, byte *result);
+	vOPTaggedResult *findTagged(byte tag);
+	void fillTaggedRequest();
+	void fillEventsRequest();
+	void bootUpChannel(byte ch);
+	void shutdownRequestChannel(byte ch);
+	void watchDogChannel(byte ch);
+	void setRelay(byte ch, bool on);
+	void setWatchdogState(byte ch, byte state);
+	void requestShutdown(byte ch, uint32_t delay);
+	void haltHandler();
+	bool haltChannel(byte ch);
+	void confirmHalt(byte ch, byte by, uint32_t cut_at);
+	void watchHalt();
+	byte attentionBit(byte type, byte arg);
+	void setAttention(bool asserted);
+#if VOP_INSTRUMENT
+	void countError(byte error);
+	void countCommand(byte cmd);
+	void fillStatsRequest();
+	unsigned int *statsWord(unsigned int index);
+#endif
+	void journalLog(byte ch, byte cause);
+	void eepromHandler();
+#if VOP_JOURNAL
+	void fillJournalRequest();
+#endif
+	bool applyTuning(byte id, unsigned int value);
+	void learnBootTime(byte ch, uint32_t sample);
+	void latchIgnition(byte ch, bool state, uint32_t at);
+	void watchIgnitions();
+	uint32_t bootTimeout(byte ch);
+	void saveBootStats();
+	bool warmStateValid();
+	byte warmStateCrc();
+	void saveWarmState();
+	void restoreWarmState(uint32_t now);
+	bool restoreFallback(uint32_t now);
+	void saveResetStats();
+#if VOP_SUPPLY
+	void supplyHandler();
+	void supplyLow(bool low);
+	void fillSupplyRequest();
+#endif
+#if VOP_LOG
+	void fillLogRequest();
+#endif
+	void saveTuning();
+	void rebaseTimers();
+	void armTimer(byte timer, uint32_t deadline);
+	void rearmTimer(byte timer, uint32_t interval);
+	void disarmTimer(byte timer);
+	bool timerDue(byte timer);
+	void findNextTimer();
+
+  	// Our i2c address. (Set by beginI2c)
 	byte i2c_address;
 
 	// Just a test variable.
@@ -42,34 +375,195 @@ class vOP {
 	byte param_buffer[2];	// The two posible bytes for the command parameters.
 	byte command_complete;	// Did we finish getting the command?
 
+	// A batch carries up to BATCH_MAX_COMMANDS commands, 3 bytes each (the command, and its two parameters.)
+	byte batch_buffer[BATCH_MAX_COMMANDS * 3];
+	byte batch_count;		// How many commands the master said were in it.
+	byte batch_length;		// How many bytes of commands we actually got.
+
+	// ----------------------------------------
+	// -- Status Register Variables -----------
+	// ----------------------------------------
+	// Two copies of the status block: loop() writes one while the Pi reads the other.
+
+	byte status_block[2][STATUS_BLOCK_SIZE];
+	volatile byte status_front;		// Which copy the Pi reads from.
+	byte status_sequence;			// Bumped on every refresh.
+	byte register_pointer;			// Where the next register read starts.
+	byte register_length;			// And how many bytes it gets (0 for the whole block.)
+
+	// ----------------------------------------
+	// -- Deferred Command Variables ----------
+	// ----------------------------------------
+	// The i2c interrupt only writes queue_head, and loop() only writes queue_tail.
+	// loop() builds results in the spare response slot, then flips response_front to publish.
+
+	bool deferred_mode;
+	vOPQueuedCommand command_queue[COMMAND_QUEUE_SIZE];
+	volatile byte queue_head;
+	volatile byte queue_tail;
+	volatile byte queued_frame;		// Numbers each command (or batch) we queue.
+	byte queue_high_water;			// The deepest the ring has been.
+	byte queue_overflows;			// Commands turned away because it was full.
+	vOPResponse responses[2];
+	volatile byte response_front;	// Which response slot is published.
+	unsigned int isr_max_micros;	// The longest we've spent in an i2c event.
+
+	// ----------------------------------------
+	// -- Tagged Command Variables ------------
+	// ----------------------------------------
+
+	vOPTaggedResult tagged_results[TAGGED_RESULTS];
+	byte tagged_next;				// The slot we hand out next, oldest first.
+
+	// ----------------------------------------
+	// -- Event Feed Variables ----------------
+	// ----------------------------------------
+
+	vOPEvent events[EVENT_RING_SIZE];
+	unsigned int event_sequence;	// The newest event's number (the first is 1.)
+	byte event_head;				// Where the next event goes.
+	byte event_count;				// How many the ring holds.
+	void (*event_hook)(byte type, byte arg, byte ch);	// Called with each new one (see setEventHook.)
+
+	// ----------------------------------------
+	// -- Attention Line Variables ------------
+	// ----------------------------------------
+	// An open drain line to the Pi, pulled low while there are events it should come and read.
+
+	byte attention_pin;				// ATTENTION_PIN_NONE if there isn't one.
+	byte attention_mask;			// ATTENTION_ bits (in vOP.cpp), the events that pull it.
+	volatile bool attention_asserted;	// Is it pulled right now?
+
+#if VOP_INSTRUMENT
+	// ----------------------------------------
+	// -- Instrumentation Variables -----------
+	// ----------------------------------------
+
+	vOPHistogram stats_histograms[STATS_HISTOGRAMS];
+	unsigned int stats_errors[STATS_ERRORS];		// How often each error code was raised.
+	unsigned int stats_commands[STATS_COMMANDS];	// And each command was sent.
+	uint32_t stats_last_loop;						// When loop() last ran (micros.)
+	uint32_t stats_last_sample;						// When the debouncer last sampled (micros.)
+	unsigned int stats_offset;						// Where the next CMD_READ_STATS read starts.
+	bool stats_reset;								// Zero the counters as they're read?
+#endif
+
+	// ----------------------------------------
+	// -- Journal Variables -------------------
+	// ----------------------------------------
+	// Why the power went on and off, kept in EEPROM so it's still there after a brown out.
+
+#if VOP_JOURNAL
+	vOPJournal journal;
+#endif
+
+	// ----------------------------------------
+	// -- Tuning Variables --------------------
+	// ----------------------------------------
+	// The TUNE_ values, as they're saved in EEPROM (two bytes each, high byte first.)
+
+	vOPSettings tuning;
+	byte tuning_block[TUNE_COUNT * 2];	// What's saved, or being saved.
+	byte tuning_selected;				// The TUNE_ that CMD_SET_TUNING sets.
+
+	// ----------------------------------------
+	// -- Boot Learning Variables -------------
+	// ----------------------------------------
+	// How long each Pi really takes to boot, so a hung boot is caught sooner than watchdog_boot_interval.
+
+	vOPSettings boot_stats;
+	byte boot_stats_block[VOP_CHANNELS * BOOT_STAT_BYTES];	// What's saved, or being saved.
+	unsigned int boot_mean[VOP_CHANNELS];		// The smoothed boot time (millis.)
+	unsigned int boot_deviation[VOP_CHANNELS];	// The smoothed distance of each boot from it (millis.)
+	byte boot_samples[VOP_CHANNELS];			// How many boots went into them (stops at 255.)
+	unsigned int boot_last[VOP_CHANNELS];		// The last boot time (millis.)
+	bool boot_backoff[VOP_CHANNELS];			// The last boot timed out on what we learned, give the next one the lot.
+	bool boot_unknown[VOP_CHANNELS];			// It was kept on through a reset, and we don't know when it booted.
+
+	// ----------------------------------------
+	// -- Reset Variables ---------------------
+	// ----------------------------------------
+	// How we came back from the last reset, and how often we've kept the power on through one.
+
+	vOPSettings reset_stats;
+	byte reset_stats_block[RESET_STAT_BYTES];	// What's saved, or being saved.
+	byte reset_kind;							// RESET_ above.
+	unsigned int warm_resets;					// Kept on out of RAM (stops at 0xFFFF.)
+	unsigned int fallback_resets;				// Kept on out of the EEPROM (stops at 0xFFFF.)
+
 	// ----------------------------------------
 	// -- Debug Variables ---------------------
 	// ----------------------------------------
 
 	byte debug_ign_debounce;	// Turns off ignition detection, only useful for debugging.
 
+#if VOP_LOG
+	vOPLog debug_log;			// What we've been up to, waiting to be read. (See vOPLog.h)
+	void (*log_drain)(vOPLog &log);	// Where it goes, besides i2c. (Out of the serial port, once it's set.)
+#endif
+
 
 	// ----------------------------------------
 	// -- Stateful Device Information ---------
 	// ----------------------------------------
 
-	bool ignition_state; 			// 0 = off, 1 = on.
-	unsigned long ignition_delta_time;	// The time when the ignition was last changed.
-	bool raspberry_power;			// State of Raspberry Pi Power (0 = off, 1 = on)
+	// Everything about a computer is kept per channel, indexed by the channel.
+
+	byte selected_channel;						// The channel commands act on. (CMD_SELECT_CHANNEL)
+	byte relay_pin[VOP_CHANNELS];				// The relay for each channel (PIN_NONE if it hasn't one.)
+	byte ignition_pin[VOP_CHANNELS];			// And its ignition input.
+
+	bool ignition_state[VOP_CHANNELS]; 			// 0 = off, 1 = on.
+	uint32_t ignition_delta_time[VOP_CHANNELS];			// The time when the ignition was last changed.
+	bool raspberry_power[VOP_CHANNELS];			// State of Raspberry Pi Power (0 = off, 1 = on)
 
 
 	// ----------------------------------------
 	// -- Ignition Debounce Definition --------
 	// ----------------------------------------
 	// used in debounceIgnition()
-	// defines the retry interval, and sequential successes to consider a digital pin change
+	// every watched input on the ignition's port is debounced together, in one read.
+
+	vOPDebouncer debouncer;			// The vertical counters, and the latched state of each input.
+	byte ignition_bit[VOP_CHANNELS];	// Which bit of the port is each ignition.
+	byte wake_bits;					// The inputs that wake us on an edge, so the debouncer can park.
+	unsigned int debounce_interval;	// How often we sample (millis.)
+	byte debounce_on_depth;			// And how many samples in a row it takes the ignition to latch on.
+	byte debounce_off_depth;		// Or off.
+
+	// ----------------------------------------
+	// -- Ignition Hold-off Variables ---------
+	// ----------------------------------------
+	// An ignition that's latched off has to stay off for ignition_holdoff before we act on it.
+	// If it comes back sooner, it was a dip: we count it, and nothing else changes.
+
+	unsigned int ignition_holdoff;				// How long (millis, 0 to act straight away.)
+	bool ignition_dipping[VOP_CHANNELS];		// Latched off, but we're not believing it yet.
+	uint32_t ignition_dip_at[VOP_CHANNELS];			// When it latched off.
+	unsigned int dip_count[VOP_CHANNELS];		// How many dips (stops at 0xFFFF.)
+	unsigned int dip_longest[VOP_CHANNELS];		// The longest (millis.)
+	unsigned int dip_last[VOP_CHANNELS];		// And the last (millis.)
 
 	// ----------------------------------------
 	// -- Shutdown Request Variables ----------
 	// ----------------------------------------
 
-	bool shutdown_request_mode;
-	unsigned long shutdown_request_at;
+	bool shutdown_request_mode[VOP_CHANNELS];
+	uint32_t shutdown_request_at[VOP_CHANNELS];
+
+	// ----------------------------------------
+	// -- Halt Variables ----------------------
+	// ----------------------------------------
+	// So we can cut the power as soon as the Pi has halted, instead of waiting out the timeouts.
+
+	byte halt_state[VOP_CHANNELS];				// HALT_ above.
+	byte halt_by[VOP_CHANNELS];					// And how it was confirmed. (HALT_BY_)
+	uint32_t halt_cut_at[VOP_CHANNELS];			// When a confirmed halt loses its power.
+	byte halt_pin[VOP_CHANNELS];				// The pin that shows the Pi has halted (PIN_NONE if it hasn't one.)
+	byte halt_level[VOP_CHANNELS];				// What it reads once it has.
+	unsigned int halt_hold[VOP_CHANNELS];		// And for how long it has to read it (millis.)
+	bool halt_seen[VOP_CHANNELS];				// Is it reading that now?
+	uint32_t halt_seen_at[VOP_CHANNELS];		// Since when?
 
 	// ----------------------------------------
 	// -- Watchdog Timer (WdT) Variables ------
@@ -79,29 +573,75 @@ class vOP {
 	// In the negative case, the ignition is still on, but no WdT pat is received -- it will just turn it off for a moment, and then back on.
 	// I chose the term pat, as opposed to kick. It's just more polite: http://en.wikipedia.org/wiki/Watchdog_timer#Watchdog_restart
 
-	byte watchdog_state;						// This is the current state of the watchdog.
+	byte watchdog_state[VOP_CHANNELS];			// This is the current state of the watchdog.
 
-	bool watchdog_mode;							// When not in watchdog mode, turns off by request only.
+	bool watchdog_mode[VOP_CHANNELS];			// When not in watchdog mode, turns off by request only.
 	bool watchdog_shutdown_initiated;			// Are we going to shutdown? If we're in this mode, we're waiting to shutdown (interruptible by a pat)
 
-	unsigned long watchdog_last_pat;			// When's the last time they pet the dog?
-	unsigned int watchdog_timeout_interval;		// How long can we wait between pats? (SECONDS) If we don't see a pat in this long, we begin to shutdown power.
+	uint32_t watchdog_last_pat[VOP_CHANNELS];		// When's the last time they pet the dog?
+	uint32_t watchdog_turnoff_time[VOP_CHANNELS];		// And the next time we turn off (set when it fails.)
+	uint32_t watchdog_boot_time[VOP_CHANNELS];		// When's the time we mark a boot initiated?
 
-	unsigned int watchdog_turnoff_interval; 	// How long after the watchdog fails to turn it off?
-	unsigned long watchdog_turnoff_time;		// And the next time we turn off (set when it fails.)
+	// The intervals (millis), which start out as the VOP_ defaults in vOPConfig.h,
+	// or are those defaults for good with VOP_FIXED_TIMING.
+#if VOP_FIXED_TIMING
+	static const uint32_t watchdog_timeout_interval = VOP_WATCHDOG_TIMEOUT;
+	static const uint32_t watchdog_turnoff_interval = VOP_WATCHDOG_TURNOFF;
+	static const uint32_t watchdog_run_interval = VOP_WATCHDOG_RUN;
+	static const uint32_t watchdog_boot_interval = VOP_WATCHDOG_BOOT;
+	static const uint32_t power_minimum_off_interval = VOP_POWER_MINIMUM_OFF;
+#else
+	uint32_t watchdog_timeout_interval;			// How long can we wait between pats? If we don't see a pat in this long, we begin to shutdown power.
+	uint32_t watchdog_turnoff_interval;			// How long after the watchdog fails to turn it off?
+	uint32_t watchdog_run_interval;				// And this is how often it runs.
+	uint32_t watchdog_boot_interval;			// How long do we give the raspberry pi to boot?
+	uint32_t power_minimum_off_interval;		// Minimum time the pi can be off (in order to reboot.)
+#endif
 
-	unsigned long watchdog_next_run;			// When's the next time the watchdog will run?
-	unsigned int watchdog_run_interval;			// And this is how often it runs. (SECONDS)
+	// ----------------------------------------
+	// -- Power Timer Variables ---------------
+	// ----------------------------------------
+
+	uint32_t power_minimum_off_time[VOP_CHANNELS];		// The time we turned it off.
 
-	unsigned long watchdog_boot_time;			// When's the time we mark a boot initiated?
-	unsigned int watchdog_boot_interval;		// How long do we give the raspberry pi to boot? (SECONDS)
+	unsigned int power_on_stagger;				// Leave this long between turning channels on, for the inrush (millis, 0 for no wait.)
+	uint32_t power_on_last;						// When we last turned one on.
+	bool power_on_any;							// Have we turned one on yet?
 
+#if VOP_SUPPLY
 	// ----------------------------------------
-	// -- Power Timer Variables ---------------
+	// -- Supply Monitor Variables ------------
+	// ----------------------------------------
+	// The supply voltage, so the Pis can be shut down before they flatten the battery.
+
+	vOPSupply supply;
+	byte supply_pin;							// The analog pin it's on (PIN_NONE until the sketch gives us one.)
+	unsigned int supply_full_scale;				// The millivolts that read as full scale, through the divider.
+	bool supply_dipped;							// It's under the cutoff now...
+	uint32_t supply_dipped_at;					// ...since when.
+#endif
+	unsigned int supply_cutoff;					// Millivolts, 0 for never. (There even without VOP_SUPPLY, for the tuning.)
+	bool supply_low;							// It's been under the cutoff, and it's not back yet.
+
+	// ----------------------------------------
+	// -- Deadline Scheduler Variables --------
+	// ----------------------------------------
+
+	uint32_t timer_deadline[VOP_TIMER_COUNT];		// When each timer is next due (millis).
+	vOPTimerMask timer_armed;						// Bit per timer, set when it's scheduled.
+	uint32_t timer_next;							// The earliest armed deadline, so loop() can bail early.
+
+	// ----------------------------------------
+	// -- Sleep Mode Variables ----------------
 	// ----------------------------------------
+	// When sleep mode is on, loop() naps until the next deadline, an ignition edge or an i2c address match.
 
-	unsigned int power_minimum_off_interval;	// Minimum number of seconds the pi can be off (in order to reboot) (SECONDS)
-	unsigned long power_minimum_off_time;		// The time we turned it off.
+	bool sleep_mode;							// Opt-in, off by default.
+	uint32_t sleep_millis;						// How long we've spent asleep, in total.
+	unsigned int sleep_micros;					// And the part of a milli we haven't counted yet.
+	uint32_t sleep_stats_since;					// When we started counting (setup).
+	volatile byte ignition_edge;				// Set by an ignition pin interrupt, until loop() starts debouncing.
+	volatile byte sleep_woken;					// Set by the ignition and i2c interrupts, so a nap ends early.
 
 };
 
@@ -0,0 +1,63 @@
+#ifndef vOPCommands_h
+#define vOPCommands_h
+
+#include "Arduino.h"
+
+// --------------------------------------------------------------------------
+// -- vOPCommands: The command dispatch table.
+// Every i2c command is a row: its opcode, how to read its parameters, what it sends back,
+// and the function that runs it. The rows live in flash (PROGMEM), and lookups are a
+// plain index into the table, however many commands there are.
+
+class vOP;
+
+// -- How a command's two parameter bytes are handed to its handler.
+#define PARAM_NONE 0 			// Not used, the handler gets 0.
+#define PARAM_FIRST 1 			// Just the first byte.
+#define PARAM_SECOND 2 			// Just the second byte.
+#define PARAM_INT 3 			// Both, first byte low. (see vOP::paramsToInt)
+#define PARAM_WORD 4 			// Both, first byte high.
+
+// -- What a command sends back, in the two result bytes.
+#define RESPONSE_NONE 0 		// Nothing, just zeros.
+#define RESPONSE_INT 1 			// The handler's return value, high byte first.
+
+// Runs a command. Set *error (it starts at 0) to send an error back instead.
+typedef unsigned int (*vOPCommandHandler)(vOP &vop, unsigned int param, byte *error);
+
+struct vOPCommand {
+	byte opcode;
+	byte params;				// PARAM_ above.
+	byte response;				// RESPONSE_ above.
+	vOPCommandHandler handler;	// Null for an opcode that's reserved, but not a command.
+};
+
+// --------------------------------------------------------------------------
+// -- Adding your own commands.
+// Opcodes CMD_USER_FIRST to CMD_USER_LAST are yours. In your sketch, write a handler,
+// and list it in VOP_USER_COMMANDS, in opcode order starting at CMD_USER_FIRST:
+//
+//	unsigned int getAnswer(vOP &vop, unsigned int param, byte *error) {
+//		return 42;
+//	}
+//
+//	VOP_USER_COMMANDS(
+//		VOP_COMMAND(CMD_USER_FIRST, PARAM_NONE, RESPONSE_INT, getAnswer),
+//		VOP_COMMAND_NONE(CMD_USER_FIRST + 1),
+//		VOP_COMMAND(CMD_USER_FIRST + 2, PARAM_INT, RESPONSE_NONE, setSomething)
+//	);
+//
+// Skip an opcode with VOP_COMMAND_NONE, so each opcode stays at its own index.
+// Rows that aren't where their opcode says they should be are treated as unknown commands.
+
+#define CMD_USER_FIRST 128
+#define CMD_USER_LAST 199
+
+#define VOP_COMMAND(opcode, params, response, handler) { (opcode), (params), (response), (handler) }
+#define VOP_COMMAND_NONE(opcode) { (opcode), PARAM_NONE, RESPONSE_NONE, 0 }
+
+#define VOP_USER_COMMANDS(...) \
+	extern const vOPCommand vop_user_commands[] PROGMEM = { __VA_ARGS__ }; \
+	extern const byte vop_user_command_count = sizeof(vop_user_commands) / sizeof(vop_user_commands[0])
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef vOPConfig_h
+#define vOPConfig_h
+
+// --------------------------------------------------------------------------
+// -- vOPConfig: Everything that gets decided when vOP is built.
+// Each of these can be changed here, or (without touching the library) with -D on the
+// compiler's command line, e.g. -DVOP_WATCHDOG_BOOT=90000UL. Anything left alone keeps
+// the default below, which is how vOP has always behaved.
+//
+// The intervals are in millis, and 32 bits (unsigned long on the micro), so they can go past 65 seconds.
+
+// ----------------------------------------
+// -- Pins --------------------------------
+// ----------------------------------------
+
+#ifndef PIN_RASPI_RELAY
+#define PIN_RASPI_RELAY 3 		// The first channel's. (see setChannelPins for the rest)
+#endif
+#ifndef PIN_IGNITION
+#define PIN_IGNITION 2
+#endif
+#ifndef PIN_DEBUG_LED
+#define PIN_DEBUG_LED 13
+#endif
+
+// ----------------------------------------
+// -- Timing (millis) ---------------------
+// ----------------------------------------
+
+#ifndef VOP_WATCHDOG_TIMEOUT
+#define VOP_WATCHDOG_TIMEOUT 20000UL		// How long can we wait between pats before we begin to shutdown power.
+#endif
+#ifndef VOP_WATCHDOG_TURNOFF
+#define VOP_WATCHDOG_TURNOFF 30000UL		// How long after the watchdog fails to turn it off.
+#endif
+#ifndef VOP_WATCHDOG_RUN
+#define VOP_WATCHDOG_RUN 5000UL				// How often the watchdog runs.
+#endif
+#ifndef VOP_WATCHDOG_BOOT
+#define VOP_WATCHDOG_BOOT 60000UL			// How long do we give the raspberry pi to boot.
+#endif
+#ifndef VOP_POWER_MINIMUM_OFF
+#define VOP_POWER_MINIMUM_OFF 5000UL		// Minimum time the pi can be off (in order to reboot.)
+#endif
+
+// Set VOP_FIXED_TIMING to 1 and the intervals above become constants, instead of variables
+// that start out with them. They cost no RAM then, and the compiler folds them into the
+// comparisons, but nothing can change them while we're running.
+#ifndef VOP_FIXED_TIMING
+#define VOP_FIXED_TIMING 0
+#endif
+
+// How long the ignition has to stay off before we believe it (a crank or a start/stop engine
+// dips it for a second or two.) Shorter dips are only reported, as EVENT_IGNITION_DIP. 0 to
+// believe it straight away. It's tunable even with VOP_FIXED_TIMING, see TUNE_IGNITION_HOLDOFF.
+#ifndef VOP_IGNITION_HOLDOFF
+#define VOP_IGNITION_HOLDOFF 0
+#endif
+
+// ----------------------------------------
+// -- Features ----------------------------
+// ----------------------------------------
+
+// How many computers this vOP powers (see vOP.h.)
+#ifndef VOP_CHANNELS
+#define VOP_CHANNELS 1
+#endif
+
+// The EEPROM journal of power cycles (see vOPJournal.h.) Set it to 0 to leave it out,
+// and CMD_READ_JOURNAL comes back ERR_COMMAND_UNKNOWN.
+#ifndef VOP_JOURNAL
+#define VOP_JOURNAL 1
+#endif
+
+// Timing histograms and counters (see vOPInstrument.h.)
+#ifndef VOP_INSTRUMENT
+#define VOP_INSTRUMENT 0
+#endif
+
+// The binary debug log (see vOPLog.h, and setLogSerial.) It's cheap enough to leave on, and
+// VOP_LOG_SIZE bytes of RAM holds what hasn't been read yet.
+#ifndef VOP_LOG
+#define VOP_LOG 1
+#endif
+#ifndef VOP_LOG_SIZE
+#define VOP_LOG_SIZE 64
+#endif
+
+// Talk i2c with our own TWI slave driver (see vOPHal.cpp) instead of Wire. It parses each byte
+// as it comes off the bus, and sends straight from our buffers, so Wire's buffers and their
+// copies go. It takes the TWI interrupt, so nothing else in the sketch can use Wire. AVR only.
+#ifndef VOP_TWI
+#define VOP_TWI 0
+#endif
+
+// The supply voltage monitor (see vOPSupply.h, and setSupplyPin.) It takes over the ADC, so
+// the sketch can't analogRead() with it on.
+#ifndef VOP_SUPPLY
+#define VOP_SUPPLY 0
+#endif
+
+// Below this (millivolts, 0 for never) for VOP_SUPPLY_HOLD, and we shut the Pis down before
+// they flatten the battery. Tunable, see TUNE_SUPPLY_CUTOFF. The hold rides out the sag
+// while the engine's cranking.
+#ifndef VOP_SUPPLY_CUTOFF
+#define VOP_SUPPLY_CUTOFF 11800
+#endif
+#ifndef VOP_SUPPLY_HOLD
+#define VOP_SUPPLY_HOLD 30000UL
+#endif
+
+#endif
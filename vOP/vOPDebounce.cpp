@@ -0,0 +1,136 @@
+// --------------------------------------------------------------------------
+// -- vOPDebouncer: Bit-parallel (vertical counter) debouncing.
+// See vOPDebounce.h for the idea, and vOP::debounceIgnition() for how it's driven.
+
+#include "vOPDebounce.h"
+
+vOPDebouncer::vOPDebouncer() {
+
+	watched_mask = 0;
+	latched = 0;
+	count0 = 0;
+	count1 = 0;
+	count2 = 0;
+	on0 = 0;
+	on1 = 0;
+	on2 = 0;
+	off0 = 0;
+	off1 = 0;
+	off2 = 0;
+	for (byte i = 0; i < 8; i++) {
+		changed_at[i] = 0;
+	}
+
+}
+
+// -- watch : Start debouncing the bits in mask, latching after depth disagreeing samples.
+
+void vOPDebouncer::watch(byte mask, byte depth) {
+
+	watch(mask, depth, depth);
+
+}
+
+// -- watch : The same, with one depth to latch on, and another to latch off.
+
+void vOPDebouncer::watch(byte mask, byte on_depth, byte off_depth) {
+
+	if (on_depth < 1) {
+		on_depth = 1;
+	} else if (on_depth > DEBOUNCE_MAX_DEPTH) {
+		on_depth = DEBOUNCE_MAX_DEPTH;
+	}
+	if (off_depth < 1) {
+		off_depth = 1;
+	} else if (off_depth > DEBOUNCE_MAX_DEPTH) {
+		off_depth = DEBOUNCE_MAX_DEPTH;
+	}
+
+	watched_mask |= mask;
+
+	// Spread the depths out across the vertical bytes, for just these bits.
+	on0 = (on0 & ~mask) | ((on_depth & 1) ? mask : 0);
+	on1 = (on1 & ~mask) | ((on_depth & 2) ? mask : 0);
+	on2 = (on2 & ~mask) | ((on_depth & 4) ? mask : 0);
+	off0 = (off0 & ~mask) | ((off_depth & 1) ? mask : 0);
+	off1 = (off1 & ~mask) | ((off_depth & 2) ? mask : 0);
+	off2 = (off2 & ~mask) | ((off_depth & 4) ? mask : 0);
+
+}
+
+// -- latch : Force the latched state of some bits (without counting it as a change.)
+
+void vOPDebouncer::latch(byte mask, byte values) {
+
+	latched = (latched & ~mask) | (values & mask);
+	count0 &= ~mask;
+	count1 &= ~mask;
+	count2 &= ~mask;
+
+}
+
+// -- sample : Feed in a port read. Returns the bits that latched a new state.
+
+byte vOPDebouncer::sample(byte port, uint32_t now) {
+
+	// Which inputs disagree with what we've latched? The rest start counting over.
+	byte delta = (port ^ latched) & watched_mask;
+	count0 &= delta;
+	count1 &= delta;
+	count2 &= delta;
+
+	// Count the disagreeing ones up by one, rippling the carry up the bytes.
+	byte carry = count0 & delta;
+	count0 ^= delta;
+	byte carry1 = count1 & carry;
+	count1 ^= carry;
+	count2 ^= carry1;
+
+	// The depth each one needs: to latch on if it's off, and off if it's on.
+	byte depth0 = (on0 & ~latched) | (off0 & latched);
+	byte depth1 = (on1 & ~latched) | (off1 & latched);
+	byte depth2 = (on2 & ~latched) | (off2 & latched);
+
+	// Anyone reached their depth? Then they latch, and their counters are done.
+	byte changed = delta & ~((count0 ^ depth0) | (count1 ^ depth1) | (count2 ^ depth2));
+	if (changed) {
+		latched ^= changed;
+		count0 &= ~changed;
+		count1 &= ~changed;
+		count2 &= ~changed;
+		for (byte i = 0; i < 8; i++) {
+			if (changed & (1 << i)) {
+				changed_at[i] = now;
+			}
+		}
+	}
+
+	return changed;
+
+}
+
+byte vOPDebouncer::state() {
+
+	return latched;
+
+}
+
+byte vOPDebouncer::watched() {
+
+	return watched_mask;
+
+}
+
+// -- settled : True when nothing is mid-count, i.e. every input agrees with its latch.
+
+bool vOPDebouncer::settled() {
+
+	return !(count0 | count1 | count2);
+
+}
+
+uint32_t vOPDebouncer::changedAt(byte bit) {
+
+	return changed_at[bit & 7];
+
+}
@@ -0,0 +1,47 @@
+#ifndef vOPDebounce_h
+#define vOPDebounce_h
+
+#include "Arduino.h"
+
+// The deepest debounce an input can have (counters are three bits tall.)
+#define DEBOUNCE_MAX_DEPTH 7
+
+// --------------------------------------------------------------------------
+// -- vOPDebouncer: Debounce up to eight inputs at once, from one port read.
+// Each bit of the port gets a three bit counter, stored "vertically" across three bytes
+// (count0 holds bit 0 of every counter, and so on), so all eight count in a handful of
+// byte-wide instructions. A counter runs while its input disagrees with the latched state,
+// resets when it agrees, and the input latches once it's disagreed for its own depth of samples.
+// Each input can have one depth for latching on, and another for latching off.
+
+class vOPDebouncer {
+  public:
+    vOPDebouncer();
+    void watch(byte mask, byte depth);
+    void watch(byte mask, byte on_depth, byte off_depth);
+    void latch(byte mask, byte values);
+    byte sample(byte port, uint32_t now);
+    byte state();
+    byte watched();
+    bool settled();
+    uint32_t changedAt(byte bit);
+  private:
+	byte watched_mask;			// Which bits of the port we care about.
+	byte latched;				// The debounced state of each bit.
+
+	byte count0;				// The vertical counters, low bit...
+	byte count1;
+	byte count2;				// ...to high bit.
+
+	byte on0;					// The depth each input needs to latch on, stored vertically the same way.
+	byte on1;
+	byte on2;
+
+	byte off0;					// And to latch off.
+	byte off1;
+	byte off2;
+
+	uint32_t changed_at[8];			// When each bit last latched a change.
+};
+
+#endif
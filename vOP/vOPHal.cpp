@@ -0,0 +1,196 @@
+// --------------------------------------------------------------------------
+// -- vOPHal: The parts of the HAL that can't be inline. See vOPHal.h.
+// (Interrupt vectors, mostly. There can only be one of each, so they're only taken when they're used.)
+
+#include "vOPHal.h"
+#include "vOPConfig.h"
+
+#ifndef VOP_HAL_EXTERNAL
+
+#if VOP_TWI
+
+#include <util/twi.h>
+
+// -- The TWI slave driver.
+// Every state the TWI moves through is an interrupt, so we take them one at a time: each byte the
+// master writes goes to received with its place in the write (no buffer, vOP parses it as it comes),
+// and when it wants to read, requested fills it and we send one byte per interrupt. Whatever was
+// handed to vop_hal_i2cSend goes out straight from where it is, and only vop_hal_i2cWrite copies.
+
+#define TWI_TX_BUFFER 32 				// As much as one read can get, the same as Wire's.
+
+static void (*twi_received)(byte value, byte index) = 0;
+static void (*twi_requested)() = 0;
+static byte twi_rx_index = 0;					// Where the next byte written goes in the write.
+static byte twi_tx_buffer[TWI_TX_BUFFER];		// What vop_hal_i2cWrite copied.
+static const byte *twi_tx_data = twi_tx_buffer;	// What the read's sending: that, or a buffer of vOP's.
+static byte twi_tx_length = 0;
+static byte twi_tx_index = 0;
+static volatile bool twi_sending = false;		// Is a buffer of vOP's going out?
+
+// Carry on, acknowledging the next byte (or, sending, expecting more after it.)
+#define TWI_ACK() (TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWINT) | _BV(TWEA))
+// Carry on, but that's the last.
+#define TWI_NACK() (TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWINT))
+
+void vop_hal_twiBegin(byte address, void (*received)(byte value, byte index), void (*requested)()) {
+
+	byte state = vop_hal_interruptsOff();
+	twi_received = received;
+	twi_requested = requested;
+	// The Pi has the pull-ups (to 3.3V), so unlike Wire we leave the pins alone.
+	TWAR = address << 1;
+	TWI_ACK();
+	vop_hal_interruptsRestore(state);
+
+}
+
+void vop_hal_i2cWrite(const byte *data, byte length) {
+
+	// Anything sent in place so far is copied in ahead of it, so it all goes out in order.
+	if (twi_tx_data != twi_tx_buffer) {
+		memmove(twi_tx_buffer, twi_tx_data, twi_tx_length);
+		twi_tx_data = twi_tx_buffer;
+	}
+	if (length > TWI_TX_BUFFER - twi_tx_length) {
+		length = TWI_TX_BUFFER - twi_tx_length;
+	}
+	memcpy(twi_tx_buffer + twi_tx_length, data, length);
+	twi_tx_length += length;
+
+}
+
+void vop_hal_i2cSend(const byte *data, byte length) {
+
+	// Only the first piece of a read can go out in place.
+	if (twi_tx_length) {
+		vop_hal_i2cWrite(data, length);
+		return;
+	}
+	twi_tx_data = data;
+	twi_tx_length = length > TWI_TX_BUFFER ? TWI_TX_BUFFER : length;
+
+}
+
+bool vop_hal_i2cSending() {
+
+	return twi_sending;
+
+}
+
+ISR(TWI_vect) {
+
+	switch (TW_STATUS) {
+
+		// Addressed for a write. (Or a general call.)
+		case TW_SR_SLA_ACK:
+		case TW_SR_GCALL_ACK:
+		case TW_SR_ARB_LOST_SLA_ACK:
+		case TW_SR_ARB_LOST_GCALL_ACK:
+			twi_rx_index = 0;
+			twi_sending = false;
+			TWI_ACK();
+			break;
+
+		// A byte of it, straight to the parser.
+		case TW_SR_DATA_ACK:
+		case TW_SR_GCALL_DATA_ACK:
+			twi_received(TWDR, twi_rx_index);
+			if (twi_rx_index < 0xFF) {
+				twi_rx_index++;
+			}
+			TWI_ACK();
+			break;
+
+		// Addressed for a read. Have it filled, then send the first byte.
+		case TW_ST_SLA_ACK:
+		case TW_ST_ARB_LOST_SLA_ACK:
+			twi_tx_data = twi_tx_buffer;
+			twi_tx_length = 0;
+			twi_tx_index = 0;
+			twi_requested();
+			twi_sending = twi_tx_data != twi_tx_buffer;
+			// Fall through.
+
+		// The master wants the next one. (Past the end, it gets 0xFF, like Wire sends.)
+		case TW_ST_DATA_ACK:
+			TWDR = twi_tx_index < twi_tx_length ? twi_tx_data[twi_tx_index++] : 0xFF;
+			if (twi_tx_index < twi_tx_length) {
+				TWI_ACK();
+			} else {
+				TWI_NACK();
+			}
+			break;
+
+		// The read's over.
+		case TW_ST_DATA_NACK:
+		case TW_ST_LAST_DATA:
+			twi_sending = false;
+			TWI_ACK();
+			break;
+
+		// Something went wrong on the bus. Let it go, and listen again.
+		case TW_BUS_ERROR:
+			twi_sending = false;
+			TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWINT) | _BV(TWEA) | _BV(TWSTO);
+			break;
+
+		// A stop (or a repeated start) after a write, and anything else: just listen again.
+		default:
+			TWI_ACK();
+			break;
+
+	}
+
+}
+
+#endif
+
+#if VOP_SUPPLY && defined(__AVR__)
+
+static void (*adc_handler)(unsigned int value) = 0;
+
+bool vop_hal_adcStart(byte pin, void (*handler)(unsigned int value)) {
+
+	// The analog pins can be given as A0 and on, or just as their channel.
+	byte channel = pin >= A0 ? pin - A0 : pin;
+	if (channel > 7) {
+		return false;
+	}
+
+	adc_handler = handler;
+	// AVcc as the reference, right adjusted, on this channel.
+	ADMUX = _BV(REFS0) | channel;
+	// Started by timer 0 overflowing.
+	ADCSRB = _BV(ADTS2);
+	// The pin's only ever analog now, so its digital input can go.
+#ifdef DIDR0
+	DIDR0 |= _BV(channel);
+#endif
+	// On, auto triggered, interrupting when it's done, at 16MHz / 128.
+	ADCSRA = _BV(ADEN) | _BV(ADATE) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+	return true;
+
+}
+
+ISR(ADC_vect) {
+
+	if (adc_handler) {
+		adc_handler(ADC);
+	}
+
+}
+
+#else
+
+bool vop_hal_adcStart(byte pin, void (*handler)(unsigned int value)) {
+
+	(void)pin;
+	(void)handler;
+	return false;
+
+}
+
+#endif
+
+#endif
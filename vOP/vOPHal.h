@@ -0,0 +1,187 @@
+#ifndef vOPHal_h
+#define vOPHal_h
+
+// --------------------------------------------------------------------------
+// -- vOPHal: The hardware abstraction layer.
+// Everything vOP touches on the board (the clock, the pins, the EEPROM and the i2c bus) goes through here.
+// On the Arduino these just forward to the core and to Wire, and get inlined away.
+// Define VOP_HAL_EXTERNAL and provide the functions yourself to run vOP somewhere else,
+// which is how the host build in extras/host runs it against mocks.
+
+#include "Arduino.h"
+#include "vOPConfig.h"
+
+#ifdef VOP_HAL_EXTERNAL
+
+// -- Clock.
+uint32_t vop_hal_millis();
+uint32_t vop_hal_micros();
+
+// -- GPIO.
+void vop_hal_pinMode(byte pin, byte mode);
+int vop_hal_digitalRead(byte pin);
+void vop_hal_digitalWrite(byte pin, byte value);
+byte vop_hal_readPort(byte pin);		// The whole input port the pin lives on, in one read.
+byte vop_hal_pinBit(byte pin);			// And which bit of it the pin is.
+
+// -- Critical sections. Off returns the previous interrupt state, restore puts it back.
+byte vop_hal_interruptsOff();
+void vop_hal_interruptsRestore(byte state);
+
+// -- Power. Sleep for at most ms, or until an interrupt sets *woken.
+// attachWake calls handler (from interrupt context) on every edge of the pin, and
+// returns false if the pin can't interrupt.
+void vop_hal_sleep(uint32_t ms, volatile byte *woken);
+bool vop_hal_attachWake(byte pin, void (*handler)());
+
+// -- i2c (slave side). Begin joins the bus at address, through Wire: received gets each whole write,
+// and reads it with available and read. twiBegin is the same with our own driver (VOP_TWI): received
+// gets each byte as it comes off the bus, and its index in the write. requested fills each read.
+void vop_hal_i2cBegin(byte address, void (*received)(int count), void (*requested)());
+void vop_hal_twiBegin(byte address, void (*received)(byte value, byte index), void (*requested)());
+
+// Called from inside the receive and request events. Write copies the bytes out, send may leave
+// them where they are until the read's over (so only for buffers that stay put), and sending says
+// if one of those is still going out.
+int vop_hal_i2cAvailable();
+int vop_hal_i2cRead();
+void vop_hal_i2cWrite(const byte *data, byte length);
+void vop_hal_i2cSend(const byte *data, byte length);
+bool vop_hal_i2cSending();
+
+// -- EEPROM. Write only starts the write, and mustn't be called until ready says the last one's done.
+byte vop_hal_eepromRead(unsigned int address);
+void vop_hal_eepromWrite(unsigned int address, byte value);
+bool vop_hal_eepromReady();
+unsigned int vop_hal_eepromSize();
+
+// -- Serial (transmit only, for the log.) Room is how many bytes write can take without waiting,
+// and write is never given more than that.
+void vop_hal_serialBegin(unsigned long baud);
+byte vop_hal_serialRoom();
+void vop_hal_serialWrite(const byte *data, byte length);
+
+// -- ADC. Start converting an analog pin over and over, in the background, calling handler (from
+// interrupt context) with every result. Returns false if the pin can't.
+bool vop_hal_adcStart(byte pin, void (*handler)(unsigned int value));
+
+// -- RAM that a reset doesn't clear. Wherever you run it, a plain variable will do, it just won't outlive the process.
+#ifndef VOP_NOINIT
+#define VOP_NOINIT
+#endif
+
+#else
+
+#if !VOP_TWI
+#include <Wire.h>
+#endif
+#ifdef __AVR__
+#include <avr/sleep.h>
+#include <avr/eeprom.h>
+#endif
+
+#ifndef digitalPinToInterrupt
+#define digitalPinToInterrupt(p) ((p) == 2 ? 0 : ((p) == 3 ? 1 : -1))
+#endif
+
+inline uint32_t vop_hal_millis() { return millis(); }
+inline uint32_t vop_hal_micros() { return micros(); }
+
+inline void vop_hal_pinMode(byte pin, byte mode) { pinMode(pin, mode); }
+inline int vop_hal_digitalRead(byte pin) { return digitalRead(pin); }
+inline void vop_hal_digitalWrite(byte pin, byte value) { digitalWrite(pin, value); }
+inline byte vop_hal_readPort(byte pin) { return *portInputRegister(digitalPinToPort(pin)); }
+inline byte vop_hal_pinBit(byte pin) { return digitalPinToBitMask(pin); }
+
+#ifdef __AVR__
+inline byte vop_hal_interruptsOff() { byte state = SREG; cli(); return state; }
+inline void vop_hal_interruptsRestore(byte state) { SREG = state; }
+#else
+inline byte vop_hal_interruptsOff() { noInterrupts(); return 1; }
+inline void vop_hal_interruptsRestore(byte state) { if (state) { interrupts(); } }
+#endif
+
+// Idle sleep stops the CPU but leaves the timers and the TWI running, so millis() stays honest
+// and an i2c address match or the ignition pin interrupt wakes us. But so does Timer 0, every
+// millisecond, so we go straight back down until the time's up, or one of vOP's interrupts has set
+// *woken. Interrupts are held off between the check and sleep_cpu() (sei lets one more instruction
+// run first), so an interrupt in between can't leave us asleep for a whole tick with it set.
+#ifdef __AVR__
+inline void vop_hal_sleep(uint32_t ms, volatile byte *woken) {
+	uint32_t started = millis();
+	byte state = SREG;
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	cli();
+	while (!*woken && (uint32_t)(millis() - started) < ms) {
+		sleep_enable();
+		sei();
+		sleep_cpu();
+		sleep_disable();
+		cli();
+	}
+	SREG = state;
+}
+#else
+inline void vop_hal_sleep(uint32_t ms, volatile byte *woken) { (void)ms; (void)woken; }
+#endif
+inline bool vop_hal_attachWake(byte pin, void (*handler)()) {
+	int interrupt = digitalPinToInterrupt(pin);
+	if (interrupt < 0) {
+		return false;
+	}
+	attachInterrupt(interrupt, handler, CHANGE);
+	return true;
+}
+
+#if VOP_TWI
+// Our own TWI slave driver, in vOPHal.cpp. It hands over each byte straight from TWDR, and sends
+// straight out of vOP's buffers, so there's no Wire buffer in between.
+#ifndef __AVR__
+#error "VOP_TWI drives the AVR's TWI registers, so it needs an AVR"
+#endif
+void vop_hal_twiBegin(byte address, void (*received)(byte value, byte index), void (*requested)());
+inline int vop_hal_i2cAvailable() { return 0; }
+inline int vop_hal_i2cRead() { return -1; }
+void vop_hal_i2cWrite(const byte *data, byte length);
+void vop_hal_i2cSend(const byte *data, byte length);
+bool vop_hal_i2cSending();
+#else
+inline void vop_hal_i2cBegin(byte address, void (*received)(int count), void (*requested)()) {
+	Wire.begin(address);
+	Wire.onReceive(received);
+	Wire.onRequest(requested);
+}
+inline int vop_hal_i2cAvailable() { return Wire.available(); }
+inline int vop_hal_i2cRead() { return Wire.read(); }
+inline void vop_hal_i2cWrite(const byte *data, byte length) { Wire.write(data, length); }
+inline void vop_hal_i2cSend(const byte *data, byte length) { Wire.write(data, length); }
+inline bool vop_hal_i2cSending() { return false; }
+#endif
+
+// eeprom_write_byte only waits if the last write is still going, which we never let it find.
+inline byte vop_hal_eepromRead(unsigned int address) { return eeprom_read_byte((const uint8_t *)address); }
+inline void vop_hal_eepromWrite(unsigned int address, byte value) { eeprom_write_byte((uint8_t *)address, value); }
+inline bool vop_hal_eepromReady() { return eeprom_is_ready(); }
+inline unsigned int vop_hal_eepromSize() { return E2END + 1; }
+
+// HardwareSerial's transmit interrupt sends its buffer out on its own, we only ever fill it as far as it has room.
+inline void vop_hal_serialBegin(unsigned long baud) { Serial.begin(baud); }
+inline byte vop_hal_serialRoom() { int room = Serial.availableForWrite(); return room > 255 ? 255 : room; }
+inline void vop_hal_serialWrite(const byte *data, byte length) { Serial.write(data, length); }
+
+// The ADC runs off timer 0 overflowing (the millis() tick, about 1kHz), so it needs no CPU to
+// start each conversion, and wakes nothing that wasn't already awake. It's in vOPHal.cpp, with
+// the interrupt that hands each result on.
+bool vop_hal_adcStart(byte pin, void (*handler)(unsigned int value));
+
+// The C runtime zeroes .bss and copies .data on every reset, but leaves .noinit alone, so whatever
+// was there before a brown out or a watchdog reset is still there after it. (After a power cut it's noise.)
+#ifdef __AVR__
+#define VOP_NOINIT __attribute__((section(".noinit")))
+#else
+#define VOP_NOINIT
+#endif
+
+#endif
+
+#endif
@@ -0,0 +1,41 @@
+// --------------------------------------------------------------------------
+// -- vOPInstrument: The timing histograms. See vOPInstrument.h.
+
+#include "vOPInstrument.h"
+
+// Only built with VOP_INSTRUMENT (see vOPConfig.h.)
+#if VOP_INSTRUMENT
+
+vOPHistogram::vOPHistogram() {
+
+	clear();
+
+}
+
+// -- add : Count a duration into its bucket.
+
+void vOPHistogram::add(uint32_t micros) {
+
+	// The bucket is how many bits are left once the bottom two are gone.
+	byte bucket = 0;
+	micros >>= 2;
+	while (micros && bucket < HISTOGRAM_BUCKETS - 1) {
+		micros >>= 1;
+		bucket++;
+	}
+
+	if (buckets[bucket] != 0xFFFF) {
+		buckets[bucket]++;
+	}
+
+}
+
+void vOPHistogram::clear() {
+
+	for (byte i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		buckets[i] = 0;
+	}
+
+}
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef vOPInstrument_h
+#define vOPInstrument_h
+
+#include "Arduino.h"
+#include "vOPConfig.h"
+
+// --------------------------------------------------------------------------
+// -- Instrumentation.
+// Set VOP_INSTRUMENT to 1 (in vOPConfig.h, or with -DVOP_INSTRUMENT=1) to build in timing histograms
+// and error and command counters, readable with CMD_READ_STATS. They cost about 500 bytes
+// of RAM and a micros() call either side of each thing timed, so they're off by default,
+// and when they're off the hooks compile to nothing at all.
+
+// How many buckets a histogram has. Bucket 0 is under 4us, then each bucket is twice as wide
+// as the last (bucket n is 2^(n+1) to 2^(n+2) micros), and the last one takes everything over 65ms.
+#define HISTOGRAM_BUCKETS 16
+
+// --------------------------------------------------------------------------
+// -- vOPHistogram: Counts of durations, in power of two buckets. Counts stop at 0xFFFF.
+
+class vOPHistogram {
+  public:
+    vOPHistogram();
+    void add(uint32_t micros);
+    void clear();
+    unsigned int buckets[HISTOGRAM_BUCKETS];
+};
+
+#endif
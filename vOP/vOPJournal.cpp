@@ -0,0 +1,218 @@
+// --------------------------------------------------------------------------
+// -- vOPJournal: The wear-levelled EEPROM journal. See vOPJournal.h.
+
+#include "vOPJournal.h"
+#include "vOPHal.h"
+
+// Left out altogether without VOP_JOURNAL (see vOPConfig.h.)
+#if VOP_JOURNAL
+
+vOPJournal::vOPJournal() {
+
+	first_address = 0;
+	slots = 0;
+	head = 0;
+	stored = 0;
+	next_sequence = 1;
+	pending_count = 0;
+	write_offset = 0;
+	read_slot = 0;
+	read_left = 0;
+	reading = false;
+	read_time = 0;
+
+}
+
+// -- begin : Take the EEPROM between two addresses (inclusive), and find where we left off.
+
+void vOPJournal::begin(unsigned int first, unsigned int last) {
+
+	first_address = first;
+	slots = (last - first + 1) / JOURNAL_RECORD_SIZE;
+	head = 0;
+	stored = 0;
+	next_sequence = 1;
+
+	// The newest record is the one whose sequence is furthest ahead (by difference, as it wraps.)
+	byte record[JOURNAL_RECORD_SIZE];
+	bool found = false;
+	unsigned int newest = 0;
+	for (unsigned int slot = 0; slot < slots; slot++) {
+		if (readRecord(slot, record)) {
+			unsigned int sequence = ((unsigned int)record[0] << 8) | record[1];
+			if (!found || (int)(sequence - next_sequence) >= 0) {
+				next_sequence = sequence + 1;
+				newest = slot;
+				found = true;
+			}
+			stored++;
+		}
+	}
+
+	if (found) {
+		head = (newest + 1) % slots;
+	}
+
+}
+
+// -- log : Queue a record. If the last one waiting is the same thing again, just bring it up to date.
+
+void vOPJournal::log(byte cause, byte state, uint32_t uptime) {
+
+	if (!slots) {
+		return;
+	}
+
+	// A debug command can log from the i2c interrupt, so keep service() out while we're at it.
+	byte interrupts = vop_hal_interruptsOff();
+
+	byte *record;
+	if (pending_count > 1 && pending[pending_count - 1][2] == cause && pending[pending_count - 1][3] == state) {
+		// Not started yet, and it's a repeat. Coalesce.
+		record = pending[pending_count - 1];
+	} else if (pending_count < JOURNAL_PENDING) {
+		record = pending[pending_count++];
+		record[0] = next_sequence >> 8;
+		record[1] = next_sequence & 0xFF;
+		next_sequence++;
+	} else {
+		// Full up, and we won't block. The newest waiting one gets replaced.
+		record = pending[pending_count - 1];
+	}
+
+	record[2] = cause;
+	record[3] = state;
+	record[4] = (uptime >> 16) & 0xFF;
+	record[5] = (uptime >> 8) & 0xFF;
+	record[6] = uptime & 0xFF;
+	record[7] = checkByte(record);
+
+	vop_hal_interruptsRestore(interrupts);
+
+}
+
+// -- service : Start writing the next byte, if the EEPROM is free. Returns true while there's more to do.
+
+bool vOPJournal::service(uint32_t now) {
+
+	if (!pending_count) {
+		return false;
+	}
+
+	// Don't write under a dump, unless the reader has wandered off.
+	if (reading && (uint32_t)(now - read_time) < JOURNAL_READ_TIMEOUT) {
+		return true;
+	}
+	reading = false;
+
+	if (!vop_hal_eepromReady()) {
+		return true;
+	}
+
+	// Only write it if it's different, it saves wear.
+	unsigned int address = slotAddress(head) + write_offset;
+	byte value = pending[0][write_offset];
+	if (vop_hal_eepromRead(address) != value) {
+		vop_hal_eepromWrite(address, value);
+	}
+
+	// That record's done? (the check byte goes last) Move on to the next slot.
+	if (++write_offset == JOURNAL_RECORD_SIZE) {
+		byte interrupts = vop_hal_interruptsOff();
+		write_offset = 0;
+		head = (head + 1) % slots;
+		if (stored < slots) {
+			stored++;
+		}
+		pending_count--;
+		for (byte i = 0; i < pending_count; i++) {
+			for (byte j = 0; j < JOURNAL_RECORD_SIZE; j++) {
+				pending[i][j] = pending[i + 1][j];
+			}
+		}
+		vop_hal_interruptsRestore(interrupts);
+	}
+
+	return pending_count > 0;
+
+}
+
+// -- rewind : Start a dump from the oldest record.
+
+void vOPJournal::rewind(uint32_t now) {
+
+	read_left = stored;
+	read_slot = (head + slots - stored) % slots;
+	// If we're part way through writing a record, that slot's not trustworthy yet.
+	if (write_offset && read_left == slots) {
+		read_slot = (read_slot + 1) % slots;
+		read_left--;
+	}
+	reading = true;
+	read_time = now;
+
+}
+
+// -- read : Copy out as many whole records as fit, oldest first.
+// Once they're all sent, a single record of 0xFF marks the end (its check byte won't match.)
+
+byte vOPJournal::read(byte *out, byte length, uint32_t now) {
+
+	byte sent = 0;
+	read_time = now;
+
+	while (read_left && sent + JOURNAL_RECORD_SIZE <= length) {
+		unsigned int address = slotAddress(read_slot);
+		for (byte i = 0; i < JOURNAL_RECORD_SIZE; i++) {
+			out[sent++] = vop_hal_eepromRead(address + i);
+		}
+		read_slot = (read_slot + 1) % slots;
+		read_left--;
+	}
+
+	if (!sent) {
+		for (byte i = 0; i < JOURNAL_RECORD_SIZE && i < length; i++) {
+			out[sent++] = 0xFF;
+		}
+		reading = false;
+	}
+
+	return sent;
+
+}
+
+unsigned int vOPJournal::count() {
+
+	return stored;
+
+}
+
+unsigned int vOPJournal::slotAddress(unsigned int slot) {
+
+	return first_address + slot * JOURNAL_RECORD_SIZE;
+
+}
+
+bool vOPJournal::readRecord(unsigned int slot, byte *record) {
+
+	unsigned int address = slotAddress(slot);
+	for (byte i = 0; i < JOURNAL_RECORD_SIZE; i++) {
+		record[i] = vop_hal_eepromRead(address + i);
+	}
+	return record[7] == checkByte(record);
+
+}
+
+// -- checkByte : A sum of the rest of the record, offset so that blank (0xFF) EEPROM never passes.
+
+byte vOPJournal::checkByte(const byte *record) {
+
+	byte sum = 0x5A;
+	for (byte i = 0; i < JOURNAL_RECORD_SIZE - 1; i++) {
+		sum = (sum << 1 | sum >> 7) + record[i];
+	}
+	return sum;
+
+}
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef vOPJournal_h
+#define vOPJournal_h
+
+#include "Arduino.h"
+#include "vOPConfig.h"
+
+// --------------------------------------------------------------------------
+// -- vOPJournal: A post-mortem journal of power cycles, kept in EEPROM.
+// Records go round its part of the EEPROM as a ring, one slot after the next, so every cell
+// wears at the same rate. Each record carries a sequence number, which is how begin()
+// finds the newest one again after a reset, and a check byte (written last), so a record
+// torn by a power cut mid-write is simply skipped.
+//
+// Writing a byte of EEPROM takes ~3.3ms, so log() only queues the record in RAM, and
+// service() (called from loop) starts one byte at a time, only when the EEPROM is ready.
+// Bytes that already hold the right value aren't written at all.
+
+#define JOURNAL_RECORD_SIZE 8
+#define JOURNAL_PENDING 4 				// How many records can wait in RAM to be written.
+#define JOURNAL_READ_TIMEOUT 2000 		// Writes pause during a dump, for at most this long between reads (millis.)
+
+// -- The record, as it sits in EEPROM.
+// 0-1: Sequence number, high byte first.
+// 2:   Cause (JOURNAL_ in vOP.cpp.)
+// 3:   State: the watchdog state in bits 0-2, ignition in bit 4, raspberry pi power in bit 5,
+//      and the channel in bits 6-7.
+// 4-6: Uptime of the MCU in seconds, high byte first.
+// 7:   Check byte.
+
+class vOPJournal {
+  public:
+    vOPJournal();
+    void begin(unsigned int first_address, unsigned int last_address);
+    void log(byte cause, byte state, uint32_t uptime);
+    bool service(uint32_t now);
+    void rewind(uint32_t now);
+    byte read(byte *out, byte length, uint32_t now);
+    unsigned int count();
+  private:
+	unsigned int slotAddress(unsigned int slot);
+	bool readRecord(unsigned int slot, byte *record);
+	static byte checkByte(const byte *record);
+
+	unsigned int first_address;		// Where our part of the EEPROM starts.
+	unsigned int slots;				// How many records fit in it.
+	unsigned int head;				// The slot the next record goes in.
+	unsigned int stored;			// How many valid records there are.
+	unsigned int next_sequence;		// The sequence number the next record gets.
+
+	byte pending[JOURNAL_PENDING][JOURNAL_RECORD_SIZE];
+	byte pending_count;				// Records waiting to be written, the first is in progress.
+	byte write_offset;				// Which byte of the first one we're on.
+
+	unsigned int read_slot;			// The next slot a dump sends.
+	unsigned int read_left;			// And how many records it has left to send.
+	bool reading;					// A dump is under way, so hold off writing.
+	uint32_t read_time;				// When the dump last read.
+};
+
+#endif
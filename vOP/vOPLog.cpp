@@ -0,0 +1,138 @@
+// --------------------------------------------------------------------------
+// -- vOPLog: The binary debug log. See vOPLog.h.
+
+#include "vOPLog.h"
+#include "vOPHal.h"
+
+// Left out altogether without VOP_LOG (see vOPConfig.h.)
+#if VOP_LOG
+
+#define LOG_MASK (VOP_LOG_SIZE - 1)
+
+vOPLog::vOPLog() {
+
+	for (byte i = 0; i < VOP_LOG_SIZE; i++) {
+		ring[i] = 0;
+	}
+	head = 0;
+	tail = 0;
+	drops = 0;
+	drops_total = 0;
+	time_high = 0;
+	time_sent = false;
+
+}
+
+// -- log : Add a record with this many arguments (0 to 2), or count it as dropped if it won't fit.
+// It can be called from anywhere, interrupts included.
+
+void vOPLog::log(byte id, byte args, unsigned int a, unsigned int b, uint32_t now) {
+
+	byte state = vop_hal_interruptsOff();
+
+	// It might need the time, and word of what we've lost, ahead of it. It all goes in, or none of it.
+	bool stamp = !time_sent || (now >> 16) != time_high;
+	byte size = LOG_HEADER_SIZE + args * 2;
+	if (stamp) {
+		size += LOG_HEADER_SIZE + 2;
+	}
+	if (drops) {
+		size += LOG_HEADER_SIZE + 2;
+	}
+
+	if (VOP_LOG_SIZE - 1 - used() < size) {
+		if (drops < 0xFFFF) {
+			drops++;
+		}
+		if (drops_total < 0xFFFF) {
+			drops_total++;
+		}
+	} else {
+		if (stamp) {
+			time_high = now >> 16;
+			time_sent = true;
+			put(LOG_TIME, 1, time_high, 0, now);
+		}
+		if (drops) {
+			put(LOG_DROPPED, 1, drops, 0, now);
+			drops = 0;
+		}
+		put(id, args, a, b, now);
+	}
+
+	vop_hal_interruptsRestore(state);
+
+}
+
+// -- read : Take up to length bytes off the ring. With whole, only records that fit in full are taken.
+// Returns how many bytes.
+
+byte vOPLog::read(byte *out, byte length, bool whole) {
+
+	byte state = vop_hal_interruptsOff();
+
+	byte count = used();
+	if (count > length) {
+		count = length;
+	}
+	if (whole) {
+		// Walk the records until the next one wouldn't fit.
+		byte fits = 0;
+		while (fits < count) {
+			byte size = LOG_RECORD_SIZE(ring[(tail + fits) & LOG_MASK]);
+			if (fits + size > count) {
+				break;
+			}
+			fits += size;
+		}
+		count = fits;
+	}
+
+	for (byte i = 0; i < count; i++) {
+		out[i] = ring[tail];
+		tail = (tail + 1) & LOG_MASK;
+	}
+
+	vop_hal_interruptsRestore(state);
+	return count;
+
+}
+
+// -- used : How many bytes are waiting to go out.
+
+byte vOPLog::used() {
+
+	return (head - tail) & LOG_MASK;
+
+}
+
+// -- dropped : How many records haven't fitted, since we started. (Stops at 0xFFFF.)
+
+unsigned int vOPLog::dropped() {
+
+	return drops_total;
+
+}
+
+// -- put : Write the record in. (Interrupts are already off, and log() has made sure there's room.)
+
+void vOPLog::put(byte id, byte args, unsigned int a, unsigned int b, uint32_t now) {
+
+	byte record[LOG_HEADER_SIZE + 4];
+	record[0] = (id & LOG_ID_MASK) | (args << LOG_ARGS_SHIFT);
+	record[1] = (now >> 8) & 0xFF;
+	record[2] = now & 0xFF;
+	record[3] = a >> 8;
+	record[4] = a & 0xFF;
+	record[5] = b >> 8;
+	record[6] = b & 0xFF;
+
+	byte size = LOG_RECORD_SIZE(record[0]);
+	for (byte i = 0; i < size; i++) {
+		ring[head] = record[i];
+		head = (head + 1) & LOG_MASK;
+	}
+
+}
+
+#endif
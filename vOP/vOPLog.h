@@ -0,0 +1,71 @@
+#ifndef vOPLog_h
+#define vOPLog_h
+
+#include "Arduino.h"
+#include "vOPConfig.h"
+
+// --------------------------------------------------------------------------
+// -- vOPLog: The debug log, kept as small binary records in a RAM ring.
+// Set VOP_LOG to 0 (in vOPConfig.h, or with -DVOP_LOG=0) to leave it out.
+//
+// A record is just a message ID, when it happened, and a couple of numbers. The words that go
+// with each ID never make it onto the micro, they're in the decoder on the host (extras/host/vop_log.cpp),
+// so writing one is a handful of byte copies, and nothing waits on the serial port.
+// The ring is emptied from loop() into the serial port's own transmit buffer (only as much as
+// fits, the transmit interrupt does the rest), or over i2c with CMD_READ_LOG. When it's full,
+// new records are dropped and counted, and a LOG_DROPPED saying how many goes in once there's room.
+// Records only carry the low 16 bits of millis(), and a LOG_TIME with the high 16 goes in ahead
+// of the first one, and again whenever they change, so the decoder always has the whole time.
+
+// The size of the ring (bytes, a power of two up to 128.)
+#if VOP_LOG_SIZE < 16 || VOP_LOG_SIZE > 128 || (VOP_LOG_SIZE & (VOP_LOG_SIZE - 1))
+#error "VOP_LOG_SIZE has to be a power of two, from 16 to 128"
+#endif
+
+// -- The record.
+// 0:   The message ID in bits 0-5, and how many arguments follow in bits 6-7.
+// 1-2: millis() when it was logged, the low 16 bits, high byte first.
+// 3-:  The arguments, two bytes each, high byte first.
+
+#define LOG_HEADER_SIZE 3
+#define LOG_ID_MASK 0x3F
+#define LOG_ARGS_SHIFT 6
+#define LOG_RECORD_SIZE(tag) (LOG_HEADER_SIZE + ((tag) >> LOG_ARGS_SHIFT) * 2)
+
+// -- The messages, and their arguments. (The decoder has the words.)
+#define LOG_DROPPED 0 					// How many records didn't fit.
+#define LOG_STARTED 1 					// How we started. (RESET_ in vOP.h)
+#define LOG_POWER_ON 2 					// The channel.
+#define LOG_POWER_OFF 3 				// The channel.
+#define LOG_SHUTDOWN_EXECUTED 4 		// The channel.
+#define LOG_HALT_CUT 5 					// The channel.
+#define LOG_WATCHDOG_CHECK 6 			// The channel, and its watchdog state.
+#define LOG_WATCHDOG_FAILED 7 			// The channel.
+#define LOG_WATCHDOG_SHUTDOWN 8 		// The channel.
+#define LOG_BOOT_FAILED 9 				// The channel, and how long it had (seconds.)
+#define LOG_SUPPLY_LOW 10 				// The channel, and the supply (millivolts.)
+#define LOG_IGNITION 11 				// The channel, and its new state.
+#define LOG_IGNITION_DIP 12 			// The channel, and how long the dip was (millis.)
+#define LOG_TIME 13 					// The high 16 bits of millis(), for the records after it.
+#define LOG_COUNT 14
+
+class vOPLog {
+  public:
+    vOPLog();
+    void log(byte id, byte args, unsigned int a, unsigned int b, uint32_t now);
+    byte read(byte *out, byte length, bool whole);
+    byte used();
+    unsigned int dropped();
+  private:
+	void put(byte id, byte args, unsigned int a, unsigned int b, uint32_t now);
+
+	byte ring[VOP_LOG_SIZE];		// The records, back to back.
+	byte head;						// Where the next byte goes.
+	byte tail;						// And the oldest one still to go out.
+	unsigned int drops;				// Records dropped since the last LOG_DROPPED (stops at 0xFFFF.)
+	unsigned int drops_total;		// And since we started.
+	unsigned int time_high;			// The high bits of millis() in the last LOG_TIME...
+	bool time_sent;					// ...if there's been one.
+};
+
+#endif
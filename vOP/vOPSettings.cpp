@@ -0,0 +1,132 @@
+// --------------------------------------------------------------------------
+// -- vOPSettings: Settings kept in EEPROM. See vOPSettings.h.
+
+#include "vOPSettings.h"
+#include "vOPHal.h"
+
+vOPSettings::vOPSettings() {
+
+	address = 0;
+	version = 0;
+	data = 0;
+	length = 0;
+	crc = 0;
+	write_offset = 0;
+	dirty = false;
+
+}
+
+// -- begin : Use the block at address for data. If there's a good one there, it's copied into data.
+// Returns false (and leaves data alone) if there wasn't.
+
+bool vOPSettings::begin(unsigned int first, byte block_version, byte *block_data, byte block_length) {
+
+	address = first;
+	version = block_version;
+	data = block_data;
+	length = block_length;
+	dirty = false;
+
+	byte header[2];
+	header[0] = vop_hal_eepromRead(address);
+	header[1] = vop_hal_eepromRead(address + 1);
+	if (header[0] != version || header[1] != length) {
+		return false;
+	}
+
+	// Check it before we take any of it.
+	byte check = crc8(header, 2, 0);
+	for (byte i = 0; i < length; i++) {
+		byte value = vop_hal_eepromRead(address + 2 + i);
+		check = crc8(&value, 1, check);
+	}
+	if (check != vop_hal_eepromRead(address + 2 + length)) {
+		return false;
+	}
+
+	for (byte i = 0; i < length; i++) {
+		data[i] = vop_hal_eepromRead(address + 2 + i);
+	}
+	return true;
+
+}
+
+// -- save : The data changed, write it out (from the top, if a write was already going.)
+
+void vOPSettings::save() {
+
+	if (!data) {
+		return;
+	}
+
+	// Settings change from the i2c interrupt, so keep service() out while we're at it.
+	byte interrupts = vop_hal_interruptsOff();
+	byte header[2] = { version, length };
+	crc = crc8(data, length, crc8(header, 2, 0));
+	write_offset = 0;
+	dirty = true;
+	vop_hal_interruptsRestore(interrupts);
+
+}
+
+// -- service : Start writing the next byte that needs it, if the EEPROM is free. Returns true while there's more to do.
+
+bool vOPSettings::service() {
+
+	if (!dirty) {
+		return false;
+	}
+
+	if (!vop_hal_eepromReady()) {
+		return true;
+	}
+
+	byte interrupts = vop_hal_interruptsOff();
+	while (write_offset < length + SETTINGS_OVERHEAD) {
+		// Only write it if it's different, it saves wear.
+		unsigned int cell = address + write_offset;
+		byte value = blockByte(write_offset++);
+		if (vop_hal_eepromRead(cell) != value) {
+			vop_hal_eepromWrite(cell, value);
+			break;
+		}
+	}
+	if (write_offset == length + SETTINGS_OVERHEAD) {
+		dirty = false;
+	}
+	vop_hal_interruptsRestore(interrupts);
+
+	return dirty;
+
+}
+
+// -- crc8 : The CRC-8 (polynomial 0x07) of some bytes, carrying on from crc.
+
+byte vOPSettings::crc8(const byte *bytes, byte count, byte crc) {
+
+	for (byte i = 0; i < count; i++) {
+		crc ^= bytes[i];
+		for (byte bit = 0; bit < 8; bit++) {
+			crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+		}
+	}
+	return crc;
+
+}
+
+// -- blockByte : What goes at this offset of the block.
+
+byte vOPSettings::blockByte(byte offset) {
+
+	if (offset == 0) {
+		return version;
+	}
+	if (offset == 1) {
+		return length;
+	}
+	if (offset < length + 2) {
+		return data[offset - 2];
+	}
+	return crc;
+
+}
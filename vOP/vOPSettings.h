@@ -0,0 +1,46 @@
+#ifndef vOPSettings_h
+#define vOPSettings_h
+
+#include "Arduino.h"
+
+// --------------------------------------------------------------------------
+// -- vOPSettings: A block of settings, kept in EEPROM so they outlive a reset.
+// The bytes live in the caller's RAM, and this just mirrors them to the EEPROM and
+// back. The block starts with a version and a length, and ends with a CRC, so a
+// blank EEPROM, a block from another version, or one torn by a power cut mid-save
+// are all turned away by begin(), and the caller keeps its defaults.
+//
+// Like the journal, save() doesn't wait on the EEPROM: it just notes the block needs
+// writing, and service() (called from loop) starts one byte at a time, only when the
+// EEPROM is ready. Bytes that already hold the right value aren't written at all,
+// and the CRC goes last.
+
+#define SETTINGS_OVERHEAD 3 			// The version, length and CRC around the data.
+
+// -- The block, as it sits in EEPROM.
+// 0:   Version.
+// 1:   Length of the data.
+// 2-:  The data.
+// And the CRC-8 of all of the above.
+
+class vOPSettings {
+  public:
+    vOPSettings();
+    bool begin(unsigned int address, byte version, byte *data, byte length);
+    void save();
+    bool service();
+    static byte crc8(const byte *data, byte length, byte crc);
+  private:
+	byte blockByte(byte offset);
+
+	unsigned int address;			// Where the block starts in EEPROM.
+	byte version;					// What version the data is.
+	byte *data;						// The caller's copy of it.
+	byte length;					// And how long it is.
+
+	byte crc;						// The CRC of what's being written.
+	byte write_offset;				// The next byte of the block to write.
+	bool dirty;						// Is there writing to do?
+};
+
+#endif
@@ -0,0 +1,161 @@
+// --------------------------------------------------------------------------
+// -- vOPSupply: The oversampled, filtered supply voltage. See vOPSupply.h.
+
+#include "vOPSupply.h"
+#include "vOPHal.h"
+
+// Left out altogether without VOP_SUPPLY (see vOPConfig.h.)
+#if VOP_SUPPLY
+
+vOPSupply::vOPSupply() {
+
+	sum = 0;
+	count = 0;
+	filtered = 0;
+	primed = false;
+	filtered_mv = 0;
+	reading_mv = 0;
+	minimum_mv = 0xFFFF;
+	for (byte i = 0; i < SUPPLY_RING_SIZE; i++) {
+		ring[i] = 0;
+	}
+	ring_sequence = 0;
+	ring_count = 0;
+
+}
+
+// -- add : One ADC result. (From the ADC interrupt.)
+
+void vOPSupply::add(unsigned int sample) {
+
+	// A thousand a second for a minute still fits.
+	if (count < 0xFFFF) {
+		sum += sample;
+		count++;
+	}
+
+}
+
+// -- update : Average what's been added since last time into a reading, and filter it.
+// full_scale is the millivolts at the supply that read as 1024, through the divider. Returns false if nothing had been added.
+
+bool vOPSupply::update(unsigned int full_scale) {
+
+	byte state = vop_hal_interruptsOff();
+	unsigned long total = sum;
+	unsigned int samples = count;
+	sum = 0;
+	count = 0;
+	vop_hal_interruptsRestore(state);
+
+	if (!samples) {
+		return false;
+	}
+
+	// The average, keeping the extra bits the oversampling bought.
+	unsigned int value = (total << SUPPLY_FRACTION_BITS) / samples;
+
+	if (!primed) {
+		filtered = value;
+		primed = true;
+	} else {
+		filtered += ((long)value - (long)filtered) / (1 << SUPPLY_FILTER_SHIFT);
+	}
+
+	reading_mv = toMillivolts(value, full_scale);
+	filtered_mv = toMillivolts(filtered, full_scale);
+	if (filtered_mv < minimum_mv) {
+		minimum_mv = filtered_mv;
+	}
+
+	// And into the stream.
+	ring_sequence++;
+	ring[ring_sequence % SUPPLY_RING_SIZE] = reading_mv;
+	if (ring_count < SUPPLY_RING_SIZE) {
+		ring_count++;
+	}
+
+	return true;
+
+}
+
+// -- millivolts : The filtered supply voltage. (0 until the first reading.)
+
+unsigned int vOPSupply::millivolts() {
+
+	return filtered_mv;
+
+}
+
+// -- reading : The last reading, before it was filtered.
+
+unsigned int vOPSupply::reading() {
+
+	return reading_mv;
+
+}
+
+// -- minimum : The lowest filtered voltage since resetMinimum(). (0xFFFF if there's been none.)
+
+unsigned int vOPSupply::minimum() {
+
+	return minimum_mv;
+
+}
+
+void vOPSupply::resetMinimum() {
+
+	minimum_mv = 0xFFFF;
+
+}
+
+// -- sequence : The newest reading's number in the stream.
+
+unsigned int vOPSupply::sequence() {
+
+	return ring_sequence;
+
+}
+
+// -- read : Copy out up to count readings after the one numbered since, two bytes each (high byte first.)
+// Returns how many, and sets SUPPLY_ flags. Sequence numbers wrap, so everything's compared by difference.
+
+byte vOPSupply::read(unsigned int since, byte *out, byte count, byte *flags) {
+
+	unsigned int oldest = ring_sequence - ring_count + 1;
+	unsigned int next = since + 1;
+	byte copied = 0;
+
+	*flags = 0;
+	if ((int)(next - oldest) < 0 || (int)(since - ring_sequence) > 0) {
+		// They've fallen behind the ring (or we've restarted), so start from what we have.
+		if (ring_count && since != 0) {
+			*flags |= SUPPLY_MISSED;
+		}
+		next = oldest;
+	}
+
+	while (copied < count && ring_count && (int)(next - ring_sequence) <= 0) {
+		unsigned int value = ring[next % SUPPLY_RING_SIZE];
+		out[copied * 2] = value >> 8;
+		out[copied * 2 + 1] = value & 0xFF;
+		copied++;
+		next++;
+	}
+
+	if (ring_count && (int)(next - ring_sequence) <= 0) {
+		*flags |= SUPPLY_MORE;
+	}
+	return copied;
+
+}
+
+// -- toMillivolts : A reading (with its fraction bits) at the supply, in millivolts.
+
+unsigned int vOPSupply::toMillivolts(unsigned int value, unsigned int full_scale) {
+
+	return ((unsigned long)value * full_scale) >> (10 + SUPPLY_FRACTION_BITS);
+
+}
+
+#endif
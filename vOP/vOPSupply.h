@@ -0,0 +1,54 @@
+#ifndef vOPSupply_h
+#define vOPSupply_h
+
+#include "Arduino.h"
+#include "vOPConfig.h"
+
+// --------------------------------------------------------------------------
+// -- vOPSupply: The supply voltage, measured in the background.
+// Set VOP_SUPPLY to 1 (in vOPConfig.h, or with -DVOP_SUPPLY=1) to build it in.
+//
+// The ADC converts on its own, about a thousand times a second (see vop_hal_adcStart), and
+// add() just sums each result from the interrupt. Every so often update() takes the lot and
+// averages it, which is the oversampling: a couple of hundred noisy 10 bit readings make one
+// with SUPPLY_FRACTION_BITS more bits, in fixed point. That goes through a first order filter,
+// to smooth out the wiring, and into a ring that the Pi can stream out (see CMD_READ_SUPPLY.)
+// Nothing ever waits on a conversion, the way analogRead() does.
+
+#define SUPPLY_FRACTION_BITS 6 			// The bits we keep below the ADC's own. (1023 << 6 still fits an int.)
+#define SUPPLY_FILTER_SHIFT 2 			// The filter moves a quarter of the way to each reading.
+#define SUPPLY_RING_SIZE 32 			// How many readings the stream keeps. (A power of two.)
+
+// Flags on a read of the stream.
+#define SUPPLY_MISSED 1 				// Some fell out of the ring before you asked.
+#define SUPPLY_MORE 2 					// There are more after these.
+
+class vOPSupply {
+  public:
+    vOPSupply();
+    void add(unsigned int sample);
+    bool update(unsigned int full_scale);
+    unsigned int millivolts();
+    unsigned int reading();
+    unsigned int minimum();
+    void resetMinimum();
+    unsigned int sequence();
+    byte read(unsigned int since, byte *out, byte count, byte *flags);
+  private:
+	unsigned int toMillivolts(unsigned int value, unsigned int full_scale);
+
+	volatile unsigned long sum;		// The ADC results added up since the last update (interrupt side.)
+	volatile unsigned int count;	// And how many.
+
+	unsigned int filtered;			// The filtered reading, in ADC counts with SUPPLY_FRACTION_BITS below.
+	bool primed;					// Has the filter had its first reading?
+	unsigned int filtered_mv;		// The filtered reading, in millivolts.
+	unsigned int reading_mv;		// And the last one before filtering.
+	unsigned int minimum_mv;		// The lowest filtered reading, since resetMinimum().
+
+	unsigned int ring[SUPPLY_RING_SIZE];	// The last readings (millivolts, before filtering.)
+	unsigned int ring_sequence;		// The newest one's number (the first is 1.)
+	byte ring_count;				// How many the ring holds.
+};
+
+#endif